@@ -0,0 +1,288 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "util.h"
+#include "dump.h"
+#include "aread.h"
+#include "stats.h"
+
+static int uring_setup(unsigned int entries, struct io_uring_params *p) {
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags) {
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**
+ * This function picks the read opcode of the running kernel
+ * IORING_OP_READ and IORING_REGISTER_PROBE both came with 5.6; the rings of
+ * 5.1 to 5.5 set up fine but fail every READ with -EINVAL, so they get
+ * IORING_OP_READV
+*/
+static unsigned char ring_read_opcode(AReader *ar) {
+  struct io_uring_probe *probe = calloc(1, sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op));
+  int ret = uring_register(ar->ring_fd, IORING_REGISTER_PROBE, probe, 256);
+  STATS_ADD(syscalls, 1);
+  int has_read = ret == 0 && IORING_OP_READ < probe->ops_len && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+  free(probe);
+  _debug("DEBUG: io_uring reads with %s", has_read ? "IORING_OP_READ" : "IORING_OP_READV");
+  return has_read ? IORING_OP_READ : IORING_OP_READV;
+}
+
+/**
+ * This function maps the rings of a new io_uring
+ * @returns 0 or -1 if the ring cannot be used, ar->ring_fd is then closed
+*/
+static int ring_init(AReader *ar) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  ar->ring_fd = uring_setup(ar->depth, &p);
+  STATS_ADD(syscalls, 1);
+  if (ar->ring_fd == -1) {
+    return -1;
+  }
+
+  ar->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  ar->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ar->cq_map_len > ar->sq_map_len) {
+      ar->sq_map_len = ar->cq_map_len;
+    }
+    ar->cq_map_len = 0;
+  }
+  ar->sq_map = mmap(NULL, ar->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ar->ring_fd, IORING_OFF_SQ_RING);
+  ar->cq_map = ar->cq_map_len ? mmap(NULL, ar->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ar->ring_fd, IORING_OFF_CQ_RING) : ar->sq_map;
+  ar->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  ar->sqes = mmap(NULL, ar->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ar->ring_fd, IORING_OFF_SQES);
+  STATS_ADD(syscalls, 3);
+  if (ar->sq_map == MAP_FAILED || ar->cq_map == MAP_FAILED || ar->sqes == MAP_FAILED) {
+    _debug("DEBUG: unable to map io_uring rings");
+    if (ar->sqes != MAP_FAILED) {
+      munmap(ar->sqes, ar->sqes_len);
+    }
+    if (ar->cq_map_len && ar->cq_map != MAP_FAILED) {
+      munmap(ar->cq_map, ar->cq_map_len);
+    }
+    if (ar->sq_map != MAP_FAILED) {
+      munmap(ar->sq_map, ar->sq_map_len);
+    }
+    close(ar->ring_fd);
+    ar->ring_fd = -1;
+    return -1;
+  }
+
+  unsigned char *sq = ar->sq_map;
+  unsigned char *cq = ar->cq_map;
+  ar->sq_tail = (unsigned int *) (sq + p.sq_off.tail);
+  ar->sq_mask = (unsigned int *) (sq + p.sq_off.ring_mask);
+  ar->sq_array = (unsigned int *) (sq + p.sq_off.array);
+  ar->cq_head = (unsigned int *) (cq + p.cq_off.head);
+  ar->cq_tail = (unsigned int *) (cq + p.cq_off.tail);
+  ar->cq_mask = (unsigned int *) (cq + p.cq_off.ring_mask);
+  ar->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+  ar->depth = p.sq_entries;
+  ar->opcode = ring_read_opcode(ar);
+  return 0;
+}
+
+/**
+ * This function creates a reader for a dump
+ * @params dump - the opened dump
+ * @params depth - reads kept in flight, 0 to always use pread
+ * @returns the reader
+*/
+AReader* aread_create(Dump *dump, unsigned int depth) {
+  AReader *ar = calloc(1, sizeof(AReader));
+  ar->dump = dump;
+  ar->ring_fd = -1;
+  ar->depth = depth;
+  if (depth && ring_init(ar) == -1) {
+    _debug("DEBUG: io_uring unavailable, reading the dump with pread");
+  }
+  if (ar->ring_fd != -1) {
+    ar->slot_tag = malloc(sizeof(void *) * ar->depth);
+    ar->slot_iov = malloc(sizeof(struct iovec) * ar->depth);
+    ar->slot_off = malloc(sizeof(unsigned long long) * ar->depth);
+    ar->free_slots = malloc(sizeof(unsigned int) * ar->depth);
+    for (unsigned int i = 0; i < ar->depth; i++) {
+      ar->free_slots[i] = ar->depth - 1 - i;
+    }
+    ar->num_free = ar->depth;
+  }
+  return ar;
+}
+
+/**
+ * This function queues a finished read to be handed back by aread_complete
+*/
+static void push_done(AReader *ar, void *tag, int status) {
+  if (ar->done_head == ar->num_done) {
+    ar->done_head = ar->num_done = 0;
+  }
+  if (ar->num_done == ar->done_capacity) {
+    ar->done_capacity = ar->done_capacity ? ar->done_capacity * 2 : 64;
+    ar->done = realloc(ar->done, sizeof(AReadDone) * ar->done_capacity);
+    if (!ar->done) {
+      _die("aread - Unable to grow completion queue to %u entries", ar->done_capacity);
+    }
+  }
+  ar->done[ar->num_done].tag = tag;
+  ar->done[ar->num_done].status = status;
+  ar->num_done += 1;
+}
+
+/**
+ * This function reads with pread, as the fallback of the ring
+ * @returns 0 or -1 if fewer than length bytes were read
+*/
+static int pread_all(int fd, void *buf, unsigned int length, unsigned long long offset) {
+  long n = pread(fd, buf, length, offset);
+  STATS_ADD(syscalls, 1);
+  STATS_ADD(bytes_read, n > 0 ? n : 0);
+  return n == length ? 0 : -1;
+}
+
+/**
+ * This function submits what is queued and moves every completed read of
+ * the ring to the done queue
+ * @params wait - number of completions to wait for
+*/
+static void reap(AReader *ar, unsigned int wait) {
+  if (ar->pending || wait) {
+    int ret = uring_enter(ar->ring_fd, ar->pending, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+    STATS_ADD(syscalls, 1);
+    if (ret == -1) {
+      _die("aread - io_uring_enter failed");
+    }
+    ar->pending = 0;
+  }
+
+  unsigned int head = *ar->cq_head;
+  unsigned int tail = __atomic_load_n(ar->cq_tail, __ATOMIC_ACQUIRE);
+  while (head != tail) {
+    struct io_uring_cqe *cqe = &ar->cqes[head & *ar->cq_mask];
+    unsigned int slot = cqe->user_data;
+    struct iovec *iov = &ar->slot_iov[slot];
+    int ok = cqe->res >= 0 && (size_t) cqe->res == iov->iov_len;
+    if (cqe->res > 0) {
+      STATS_ADD(bytes_read, cqe->res);
+    }
+    if (!ok) {
+      ok = pread_all(ar->dump->fd, iov->iov_base, iov->iov_len, ar->slot_off[slot]) == 0;
+    }
+    push_done(ar, ar->slot_tag[slot], ok ? 0 : -1);
+    ar->free_slots[ar->num_free++] = slot;
+    ar->in_flight -= 1;
+    head += 1;
+  }
+  __atomic_store_n(ar->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * This function starts reading [paddr, paddr + length) of the dump into buf
+ * The read is only known to be done once aread_complete hands back its tag
+ * A read that spans lime blocks, or any read of a compressed dump, is done
+ * at once and only its completion is deferred
+ * @params ar - the reader
+ * @params paddr - physical address to read from
+ * @params buf - destination, at least length bytes, untouched until completion
+ * @params length - number of bytes
+ * @params tag - handed back by aread_complete
+*/
+void aread_submit(AReader *ar, unsigned long long paddr, void *buf, unsigned int length, void *tag) {
+  Dump *dump = ar->dump;
+  long long offset = dump->cdump || !length ? -1 : dump_paddr_to_offset(dump, paddr);
+  if (offset == -1 || dump_paddr_to_offset(dump, paddr + length - 1) != offset + length - 1) {
+    push_done(ar, tag, dump_read(dump, paddr, buf, length));
+    return;
+  }
+  STATS_ADD(dump_bytes, length);
+
+  if (ar->ring_fd == -1) {
+    push_done(ar, tag, pread_all(dump->fd, buf, length, offset));
+    return;
+  }
+
+  if (!ar->num_free) {
+    reap(ar, 1);
+  }
+  unsigned int slot = ar->free_slots[--ar->num_free];
+  ar->slot_tag[slot] = tag;
+  ar->slot_iov[slot].iov_base = buf;
+  ar->slot_iov[slot].iov_len = length;
+  ar->slot_off[slot] = offset;
+
+  unsigned int tail = *ar->sq_tail;
+  unsigned int idx = tail & *ar->sq_mask;
+  struct io_uring_sqe *sqe = &ar->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = ar->opcode;
+  sqe->fd = dump->fd;
+  sqe->off = offset;
+  if (ar->opcode == IORING_OP_READV) {
+    sqe->addr = (unsigned long long) &ar->slot_iov[slot];
+    sqe->len = 1;
+  } else {
+    sqe->addr = (unsigned long long) buf;
+    sqe->len = length;
+  }
+  sqe->user_data = slot;
+  ar->sq_array[idx] = idx;
+  __atomic_store_n(ar->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ar->pending += 1;
+  ar->in_flight += 1;
+}
+
+/**
+ * This function hands back a finished read, in completion order
+ * Queued reads are submitted first, so a caller can submit a whole batch
+ * and pay one syscall for it
+ * @params ar - the reader
+ * @params tag - set to the tag the read was submitted with
+ * @returns 0, -1 if the read failed or AREAD_IDLE if nothing is outstanding
+*/
+int aread_complete(AReader *ar, void **tag) {
+  if (ar->done_head == ar->num_done && ar->in_flight) {
+    reap(ar, 1);
+  }
+  if (ar->done_head == ar->num_done) {
+    return AREAD_IDLE;
+  }
+  AReadDone *d = &ar->done[ar->done_head++];
+  *tag = d->tag;
+  return d->status;
+}
+
+/**
+ * This function waits for every read in flight and frees the reader
+*/
+void aread_free(AReader *ar) {
+  if (ar->ring_fd != -1) {
+    while (ar->in_flight) {
+      reap(ar, 1);
+    }
+    munmap(ar->sqes, ar->sqes_len);
+    if (ar->cq_map_len) {
+      munmap(ar->cq_map, ar->cq_map_len);
+    }
+    munmap(ar->sq_map, ar->sq_map_len);
+    close(ar->ring_fd);
+    STATS_ADD(syscalls, 4);
+  }
+  free(ar->slot_tag);
+  free(ar->slot_iov);
+  free(ar->slot_off);
+  free(ar->free_slots);
+  free(ar->done);
+  free(ar);
+}
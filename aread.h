@@ -0,0 +1,67 @@
+#ifndef _AREAD_H
+#define _AREAD_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include "dump.h"
+
+#define AREAD_DEPTH 64  /* default number of reads kept in flight */
+#define AREAD_IDLE 1    /* aread_complete: nothing left to complete */
+
+/**
+ * This struct is a read waiting for its turn to be handed back
+*/
+
+typedef struct aread_done {
+	void *tag;
+	int status;                /* 0 or -1 if the read failed */
+} AReadDone;
+
+/**
+ * This struct is an asynchronous reader of one dump
+ * Reads are queued on an io_uring and completed out of order; without a ring
+ * (old kernel, seccomp, depth 0) every read is a pread done at submit time,
+ * and a read the ring fails or cuts short is done again with pread
+*/
+
+typedef struct areader {
+	Dump *dump;
+	int ring_fd;               /* -1 when reads fall back to pread */
+	unsigned int depth;
+	unsigned char opcode;      /* IORING_OP_READ, or IORING_OP_READV before 5.6 */
+	unsigned int in_flight;    /* submitted to the ring, not yet reaped */
+	unsigned int pending;      /* queued since the last io_uring_enter */
+	/* the rings shared with the kernel */
+	void *sq_map;
+	size_t sq_map_len;
+	void *cq_map;
+	size_t cq_map_len;
+	struct io_uring_sqe *sqes;
+	size_t sqes_len;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+	/* what each ring slot was submitted for */
+	void **slot_tag;
+	struct iovec *slot_iov;    /* destination, READV reads it until completion */
+	unsigned long long *slot_off;
+	unsigned int *free_slots;
+	unsigned int num_free;
+	/* reads that finished, handed back in order by aread_complete */
+	AReadDone *done;
+	unsigned int done_head;
+	unsigned int num_done;
+	unsigned int done_capacity;
+} AReader;
+
+AReader* aread_create(Dump *dump, unsigned int depth);
+void aread_submit(AReader *ar, unsigned long long paddr, void *buf, unsigned int length, void *tag);
+int aread_complete(AReader *ar, void **tag);
+void aread_free(AReader *ar);
+
+#endif
@@ -0,0 +1,164 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "util.h"
+#include "batch.h"
+
+/**
+ * This function reads a manifest, one job per line
+ * Lines are "<dump> <System.map> [profile]", blank lines and lines
+ * starting with # are skipped
+ * @params filename - the manifest
+ * @params count - set to the number of jobs
+ * @returns the jobs
+*/
+BatchJob* batch_read_manifest(const char *filename, int *count) {
+  FILE *f = fopen(filename, "r");
+  if (!f) {
+    _die("Could not open file: %s", filename);
+  }
+
+  BatchJob *jobs = NULL;
+  int capacity = 0;
+  *count = 0;
+  char *line = NULL;
+  size_t len = 0;
+  int lineno = 0;
+  while (getline(&line, &len, f) != -1) {
+    lineno += 1;
+    char *save = NULL;
+    char *dump = strtok_r(line, " \t\r\n", &save);
+    if (!dump || dump[0] == '#') {
+      continue;
+    }
+    char *sysmap = strtok_r(NULL, " \t\r\n", &save);
+    char *profile = strtok_r(NULL, " \t\r\n", &save);
+    if (!sysmap) {
+      _die("batch_read_manifest - Line %d has no System.map: %s", lineno, dump);
+    }
+
+    if (*count == capacity) {
+      capacity = capacity ? capacity * 2 : 16;
+      jobs = realloc(jobs, capacity * sizeof(BatchJob));
+    }
+    BatchJob *job = &jobs[(*count)++];
+    memset(job, 0, sizeof(*job));
+    job->dump = strdup(dump);
+    job->sysmap = strdup(sysmap);
+    job->profile = profile ? strdup(profile) : NULL;
+  }
+  free(line);
+  fclose(f);
+  return jobs;
+}
+
+void batch_free_manifest(BatchJob *jobs, int count) {
+  for (int i = 0; i < count; i++) {
+    free(jobs[i].dump);
+    free(jobs[i].sysmap);
+    free(jobs[i].profile);
+  }
+  free(jobs);
+}
+
+/**
+ * This function finds a cached input by content hash
+ * @returns the value or NULL
+*/
+void* batch_cache_lookup(BatchCache *cache, unsigned long long hash) {
+  for (int i = 0; i < cache->count; i++) {
+    if (cache->entries[i].hash == hash) {
+      return cache->entries[i].value;
+    }
+  }
+  return NULL;
+}
+
+void batch_cache_insert(BatchCache *cache, unsigned long long hash, void *value) {
+  if (cache->count == cache->capacity) {
+    cache->capacity = cache->capacity ? cache->capacity * 2 : 8;
+    cache->entries = realloc(cache->entries, cache->capacity * sizeof(BatchCacheEntry));
+  }
+  cache->entries[cache->count].hash = hash;
+  cache->entries[cache->count].value = value;
+  cache->count += 1;
+}
+
+/**
+ * This function runs one job in a forked worker
+ * stdout goes to <out_dir>/<index>-<dump name>.txt, the parsed inputs are
+ * shared with the parent copy on write
+*/
+static pid_t batch_start(BatchJob *job, int index, const char *out_dir, batch_fn fn) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == -1) {
+    _die("batch_run - Unable to fork a worker");
+  }
+  if (pid) {
+    return pid;
+  }
+
+  char *dump = strdup(job->dump);
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/%03d-%s.txt", out_dir, index, basename(dump));
+  if (!freopen(path, "w", stdout)) {
+    _die("Could not open file: %s", path);
+  }
+  free(dump);
+  fn(job);
+  exit(0); // flushes stdout and runs the atexit handlers, e.g. --stats
+}
+
+/**
+ * This function analyses every job across a bounded pool of worker processes
+ * A worker that dies (e.g. _die on a bad dump) only fails its own job
+ * @params jobs - the jobs, map and prof already filled in
+ * @params count - number of jobs
+ * @params workers - most jobs running at once
+ * @params out_dir - directory the per dump outputs are written to
+ * @params fn - analyses one job in the worker
+ * @returns the number of jobs that failed
+*/
+int batch_run(BatchJob *jobs, int count, int workers, const char *out_dir, batch_fn fn) {
+  pid_t *pids = calloc(count ? count : 1, sizeof(pid_t));
+  int next = 0;
+  int running = 0;
+  int failed = 0;
+  if (workers < 1) {
+    workers = 1;
+  }
+
+  while (next < count || running) {
+    if (next < count && running < workers) {
+      pids[next] = batch_start(&jobs[next], next, out_dir, fn);
+      next += 1;
+      running += 1;
+      continue;
+    }
+
+    int status;
+    pid_t pid = wait(&status);
+    if (pid == -1) {
+      break;
+    }
+    running -= 1;
+    for (int i = 0; i < next; i++) {
+      if (pids[i] != pid) {
+        continue;
+      }
+      int ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+      printf("%-6s %s\n", ok ? "ok" : "FAILED", jobs[i].dump);
+      fflush(stdout);
+      failed += !ok;
+      break;
+    }
+  }
+  free(pids);
+  return failed;
+}
@@ -0,0 +1,39 @@
+#ifndef _BATCH_H
+#define _BATCH_H
+
+/**
+ * This struct is one line of a batch manifest: dump System.map [profile]
+*/
+
+typedef struct batch_job {
+	char *dump;
+	char *sysmap;
+	char *profile;           /* NULL to use the default/-p/-P profile */
+	void *map;               /* parsed System.map shared with other jobs */
+	void *prof;              /* loaded profile shared with other jobs */
+} BatchJob;
+
+/**
+ * This struct caches parsed inputs by the hash of their contents
+*/
+
+typedef struct batch_cache_entry {
+	unsigned long long hash;
+	void *value;
+} BatchCacheEntry;
+
+typedef struct batch_cache {
+	BatchCacheEntry *entries;
+	int count;
+	int capacity;
+} BatchCache;
+
+typedef void (*batch_fn)(BatchJob *job);
+
+BatchJob* batch_read_manifest(const char *filename, int *count);
+void batch_free_manifest(BatchJob *jobs, int count);
+void* batch_cache_lookup(BatchCache *cache, unsigned long long hash);
+void batch_cache_insert(BatchCache *cache, unsigned long long hash, void *value);
+int batch_run(BatchJob *jobs, int count, int workers, const char *out_dir, batch_fn fn);
+
+#endif
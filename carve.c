@@ -0,0 +1,220 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "util.h"
+#include "dump.h"
+#include "locate.h"
+#include "carve.h"
+#include "stats.h"
+
+/**
+ * This struct is one piece of a lime block handed to a worker
+ * start and end are byte offsets into the range's data
+*/
+typedef struct carve_work {
+  const DumpRange *range;
+  unsigned long long start;
+  unsigned long long end;
+} CarveWork;
+
+/**
+ * This struct is the state shared by the carving threads
+ * Idle threads take the next chunk from the shared counter, so a thread
+ * stuck on a dense chunk never holds back the rest of the dump
+*/
+typedef struct carve_ctx {
+  Dump *dump;
+  const CarveParams *params;
+  CarveWork *work;
+  int num_work;
+  int next;
+} CarveCtx;
+
+/**
+ * This function appends a task, growing the array when full
+*/
+static CarvedTask* carve_add(CarveResult *result) {
+  if (result->count == result->capacity) {
+    result->capacity = result->capacity ? result->capacity * 2 : 256;
+    result->tasks = realloc(result->tasks, result->capacity * sizeof(CarvedTask));
+    if (!result->tasks) {
+      _die("carve_tasks - Unable to grow task array to %d entries", result->capacity);
+    }
+  }
+  return &result->tasks[result->count++];
+}
+
+static inline int is_printable(unsigned char c) {
+  return c >= 0x20 && c < 0x7f;
+}
+
+static inline unsigned long long load_ptr(const unsigned char *p) {
+  unsigned long long v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+/**
+ * This function runs the plausibility checks on one candidate
+ * Checks are ordered cheapest and most selective first, an empty page is
+ * rejected on the first byte of comm
+ * @params params - the offsets
+ * @params task - candidate base in the mapping, task_size bytes readable
+ * @returns 1 if the candidate looks like a task_struct
+*/
+static inline int plausible(const CarveParams *params, const unsigned char *task) {
+  const unsigned char *comm = task + params->comm_offset;
+  if (!is_printable(comm[0])) {
+    return 0;
+  }
+
+  int pid;
+  memcpy(&pid, task + params->pid_offset, sizeof(pid));
+  if (pid < 0 || pid > CARVE_PID_MAX) {
+    return 0;
+  }
+
+  unsigned long long next = load_ptr(task + params->tasks_offset);
+  unsigned long long prev = load_ptr(task + params->tasks_offset + sizeof(unsigned long long));
+  unsigned long long parent = load_ptr(task + params->parent_offset);
+  unsigned long long kernel_start = params->la57 ? KERNEL_SPACE_START_LA57 : KERNEL_SPACE_START;
+  if (next < kernel_start || prev < kernel_start || parent < kernel_start ||
+      ((next | prev | parent) & 7)) {
+    return 0;
+  }
+
+  int i = 1;
+  while (i < CARVE_COMM_LEN && is_printable(comm[i])) {
+    i++;
+  }
+  return i < CARVE_COMM_LEN && comm[i] == '\0';
+}
+
+/**
+ * This function carves one work item into result
+ * The item is looked at DUMP_WINDOW_SIZE bytes of candidates at a time
+ * @params buf - window buffer for a compressed dump, NULL otherwise
+*/
+static void carve_work(Dump *dump, const CarveParams *params, const CarveWork *work, CarveResult *result, unsigned char *buf) {
+  const DumpRange *range = work->range;
+  STATS_ADD(scan_bytes, work->end - work->start);
+  unsigned long long block_len = range->e_addr - range->s_addr + 1;
+  if (block_len < params->task_size) {
+    return;
+  }
+
+  // candidates are aligned in physical memory, not in the block
+  unsigned long long off = work->start;
+  unsigned long long misalign = (range->s_addr + off) & (CARVE_ALIGN - 1);
+  if (misalign) {
+    off += CARVE_ALIGN - misalign;
+  }
+  unsigned long long last = block_len - params->task_size;
+  unsigned long long end = work->end <= last ? work->end : last + 1;
+
+  for (unsigned long long pos = off; pos < end; pos += DUMP_WINDOW_SIZE) {
+    unsigned long long stop = pos + DUMP_WINDOW_SIZE < end ? pos + DUMP_WINDOW_SIZE : end;
+    const unsigned char *base = dump_range_bytes(dump, range, pos, stop - 1 - pos + params->task_size, buf);
+
+    for (off = pos; off < stop; off += CARVE_ALIGN) {
+      const unsigned char *task = base + (off - pos);
+      if (!plausible(params, task)) {
+        continue;
+      }
+      CarvedTask *t = carve_add(result);
+      t->paddr = range->s_addr + off;
+      memcpy(&t->pid, task + params->pid_offset, sizeof(t->pid));
+      memcpy(t->comm, task + params->comm_offset, CARVE_COMM_LEN);
+      t->next = load_ptr(task + params->tasks_offset);
+      t->prev = load_ptr(task + params->tasks_offset + sizeof(unsigned long long));
+      t->parent = load_ptr(task + params->parent_offset);
+    }
+  }
+}
+
+static void* carve_worker(void *arg) {
+  CarveCtx *ctx = arg;
+  CarveResult *result = calloc(1, sizeof(CarveResult));
+  unsigned char *buf = ctx->dump->cdump ? malloc(DUMP_WINDOW_SIZE + ctx->params->task_size) : NULL;
+  for (;;) {
+    int w = __atomic_fetch_add(&ctx->next, 1, __ATOMIC_RELAXED);
+    if (w >= ctx->num_work) {
+      break;
+    }
+    carve_work(ctx->dump, ctx->params, &ctx->work[w], result, buf);
+  }
+  free(buf);
+  return result;
+}
+
+static int carved_cmp(const void *a, const void *b) {
+  const CarvedTask *ta = a;
+  const CarvedTask *tb = b;
+  return (ta->paddr > tb->paddr) - (ta->paddr < tb->paddr);
+}
+
+/**
+ * This function scans every lime block for task_structs
+ * Unlike the tasks list walk this also finds unlinked and exited tasks
+ * that are still resident
+ * @params dump - the opened dump
+ * @params params - the offsets and the number of threads
+ * @returns the plausible tasks sorted by physical address
+*/
+CarveResult* carve_tasks(Dump *dump, const CarveParams *params) {
+  CarveCtx ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.dump = dump;
+  ctx.params = params;
+
+  for (int i = 0; i < dump->num_ranges; i++) {
+    unsigned long long len = dump->ranges[i].e_addr - dump->ranges[i].s_addr + 1;
+    ctx.num_work += (len + CARVE_CHUNK_SIZE - 1) / CARVE_CHUNK_SIZE;
+  }
+  ctx.work = malloc(sizeof(CarveWork) * (ctx.num_work ? ctx.num_work : 1));
+
+  int w = 0;
+  for (int i = 0; i < dump->num_ranges; i++) {
+    unsigned long long len = dump->ranges[i].e_addr - dump->ranges[i].s_addr + 1;
+    for (unsigned long long start = 0; start < len; start += CARVE_CHUNK_SIZE) {
+      ctx.work[w].range = &dump->ranges[i];
+      ctx.work[w].start = start;
+      ctx.work[w].end = start + CARVE_CHUNK_SIZE < len ? start + CARVE_CHUNK_SIZE : len;
+      w += 1;
+    }
+  }
+
+  int threads = params->threads > 0 ? params->threads : 1;
+  pthread_t *tids = malloc(sizeof(pthread_t) * threads);
+  int started = 0;
+  for (int i = 1; i < threads; i++) {
+    if (pthread_create(&tids[started], NULL, carve_worker, &ctx) != 0) {
+      _debug("DEBUG: unable to start carve thread %d", i);
+      break;
+    }
+    started += 1;
+  }
+
+  CarveResult *result = carve_worker(&ctx);
+  for (int i = 0; i < started; i++) {
+    CarveResult *part;
+    pthread_join(tids[i], (void **) &part);
+    for (int j = 0; j < part->count; j++) {
+      *carve_add(result) = part->tasks[j];
+    }
+    carve_result_free(part);
+  }
+  free(tids);
+  free(ctx.work);
+
+  qsort(result->tasks, result->count, sizeof(CarvedTask), carved_cmp);
+  _debug("DEBUG: carved %d candidate tasks", result->count);
+  return result;
+}
+
+void carve_result_free(CarveResult *result) {
+  free(result->tasks);
+  free(result);
+}
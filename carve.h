@@ -0,0 +1,54 @@
+#ifndef _CARVE_H
+#define _CARVE_H
+
+#include "dump.h"
+
+/* task_structs come from a cache aligned slab, so only these offsets are tried */
+#define CARVE_ALIGN 64
+#define CARVE_COMM_LEN 16
+#define CARVE_PID_MAX 4194304  /* PID_MAX_LIMIT on 64 bit */
+
+/* each worker takes this much of a lime block at a time */
+#define CARVE_CHUNK_SIZE (16ULL << 20)
+
+/**
+ * This struct holds the task_struct offsets the carver checks
+*/
+
+typedef struct carve_params {
+	unsigned long long comm_offset;
+	unsigned long long pid_offset;
+	unsigned long long tasks_offset;
+	unsigned long long parent_offset;
+	unsigned long long task_size;
+	int la57;               /* kernel pointers start lower with 5-level paging */
+	int threads;
+} CarveParams;
+
+/**
+ * This struct is one plausible task_struct found in the dump
+*/
+
+typedef struct carved_task {
+	unsigned long long paddr;
+	int pid;
+	char comm[CARVE_COMM_LEN];
+	unsigned long long next;    /* tasks.next */
+	unsigned long long prev;    /* tasks.prev */
+	unsigned long long parent;
+} CarvedTask;
+
+/**
+ * This struct is the result of a carve, sorted by physical address
+*/
+
+typedef struct carve_result {
+	CarvedTask *tasks;
+	int count;
+	int capacity;
+} CarveResult;
+
+CarveResult* carve_tasks(Dump *dump, const CarveParams *params);
+void carve_result_free(CarveResult *result);
+
+#endif
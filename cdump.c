@@ -0,0 +1,405 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <zlib.h>
+
+#include "util.h"
+#include "dump.h"
+#include "cdump.h"
+#include "stats.h"
+
+/**
+ * This struct is one decompressed chunk held by a thread
+*/
+typedef struct cdump_slot {
+  const CDump *cd;
+  unsigned long long chunk;
+  unsigned long long used;    /* clock value of the last lookup */
+  unsigned char *data;
+} CDumpSlot;
+
+/**
+ * This struct is a thread's chunk cache
+ * Each thread has its own so the scanning threads never lock, and a pointer
+ * handed out stays valid until the same thread's next lookup
+*/
+typedef struct cdump_cache {
+  CDumpSlot slots[CDUMP_CACHE_SLOTS];
+  unsigned long long clock;
+  unsigned int chunk_size;    /* size of the slot buffers */
+} CDumpCache;
+
+static pthread_key_t cache_key;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
+static void cache_free(void *arg) {
+  CDumpCache *cache = arg;
+  for (int i = 0; i < CDUMP_CACHE_SLOTS; i++) {
+    free(cache->slots[i].data);
+  }
+  free(cache);
+}
+
+static void cache_key_create() {
+  pthread_key_create(&cache_key, cache_free);
+}
+
+/**
+ * This function returns the calling thread's cache, sized for cd's chunks
+*/
+static CDumpCache* thread_cache(const CDump *cd) {
+  pthread_once(&cache_once, cache_key_create);
+  CDumpCache *cache = pthread_getspecific(cache_key);
+  if (!cache) {
+    cache = calloc(1, sizeof(CDumpCache));
+    pthread_setspecific(cache_key, cache);
+  }
+  if (cache->chunk_size < cd->header->chunk_size) {
+    for (int i = 0; i < CDUMP_CACHE_SLOTS; i++) {
+      free(cache->slots[i].data);
+      cache->slots[i].data = NULL;
+      cache->slots[i].cd = NULL;
+    }
+    cache->chunk_size = cd->header->chunk_size;
+  }
+  return cache;
+}
+
+/**
+ * This function checks whether an open file is a compressed dump
+ * @params fd - the open file, its offset is left at 0
+ * @returns 1 if it starts with CDUMP_MAGIC
+*/
+int cdump_check(int fd) {
+  char magic[sizeof(((CDumpHeader *) 0)->magic)] = { 0 };
+  int n = pread(fd, magic, sizeof(magic), 0);
+  STATS_ADD(syscalls, 1);
+  STATS_ADD(bytes_read, n > 0 ? n : 0);
+  return n == sizeof(magic) && memcmp(magic, CDUMP_MAGIC, sizeof(CDUMP_MAGIC)) == 0;
+}
+
+/**
+ * This function maps a compressed dump and checks its tables
+ * @params fd - the open file
+ * @params file_len - its size
+ * @returns the compressed dump
+*/
+CDump* cdump_open(int fd, unsigned long long file_len) {
+  if (file_len < sizeof(CDumpHeader)) {
+    _die("cdump_open - Truncated compressed dump");
+  }
+  CDump *cd = calloc(1, sizeof(CDump));
+  cd->file = mmap(NULL, file_len, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (cd->file == MAP_FAILED) {
+    _die("cdump_open - Unable to map compressed dump");
+  }
+  STATS_ADD(syscalls, 1);
+  cd->file_len = file_len;
+  cd->header = (const CDumpHeader *) cd->file;
+
+  const CDumpHeader *h = cd->header;
+  if (memcmp(h->magic, CDUMP_MAGIC, sizeof(CDUMP_MAGIC)) != 0 || h->version != CDUMP_VERSION || !h->chunk_size) {
+    _die("cdump_open - Not a version %d compressed dump", CDUMP_VERSION);
+  }
+  /* divided rather than multiplied and added so huge counts cannot wrap */
+  if (h->ranges_off > file_len || h->num_ranges > (file_len - h->ranges_off) / sizeof(CDumpRange) ||
+      h->chunks_off > file_len || h->num_chunks > (file_len - h->chunks_off) / sizeof(CDumpChunk)) {
+    _die("cdump_open - Tables past the end of the file");
+  }
+  cd->ranges = (const CDumpRange *) (cd->file + h->ranges_off);
+  cd->chunks = (const CDumpChunk *) (cd->file + h->chunks_off);
+  for (unsigned long long i = 0; i < h->num_chunks; i++) {
+    if (cd->chunks[i].offset > file_len || cd->chunks[i].size > file_len - cd->chunks[i].offset ||
+        cd->chunks[i].raw_size > h->chunk_size ||
+        (cd->chunks[i].type == CDUMP_CHUNK_RAW && cd->chunks[i].size != cd->chunks[i].raw_size)) {
+      _die("cdump_open - Chunk %llu is corrupt", i);
+    }
+  }
+  /* every chunk a range points at must exist and hold exactly its piece, so
+   * reads never index past the chunk table or copy past a short chunk */
+  for (unsigned int i = 0; i < h->num_ranges; i++) {
+    const CDumpRange *r = &cd->ranges[i];
+    if (r->e_addr < r->s_addr) {
+      _die("cdump_open - Range %u ends before it starts", i);
+    }
+    unsigned long long n = (r->e_addr - r->s_addr) / h->chunk_size + 1;
+    if (r->first_chunk > h->num_chunks || n > h->num_chunks - r->first_chunk) {
+      _die("cdump_open - Range %u needs chunks past the chunk table", i);
+    }
+    for (unsigned long long j = 0; j < n; j++) {
+      unsigned long long raw_size = j < n - 1 ? h->chunk_size : (r->e_addr - r->s_addr) % h->chunk_size + 1;
+      if (cd->chunks[r->first_chunk + j].raw_size != raw_size) {
+        _die("cdump_open - Chunk %llu of range %u holds %u bytes, not %llu", r->first_chunk + j, i,
+          cd->chunks[r->first_chunk + j].raw_size, raw_size);
+      }
+    }
+  }
+  cd->zero = calloc(1, h->chunk_size);
+  _debug("DEBUG: compressed dump, %u ranges, %llu chunks of %u bytes", h->num_ranges,
+    (unsigned long long) h->num_chunks, h->chunk_size);
+  return cd;
+}
+
+/**
+ * This function unmaps a compressed dump and drops the calling thread's
+ * cached chunks of it
+*/
+void cdump_close(CDump *cd) {
+  CDumpCache *cache = pthread_getspecific(cache_key);
+  for (int i = 0; cache && i < CDUMP_CACHE_SLOTS; i++) {
+    if (cache->slots[i].cd == cd) {
+      cache->slots[i].cd = NULL;
+    }
+  }
+  munmap((void *) cd->file, cd->file_len);
+  STATS_ADD(syscalls, 1);
+  free(cd->zero);
+  free(cd);
+}
+
+/**
+ * This function decompresses one chunk
+ * @params cd - the compressed dump
+ * @params chunk - index of the chunk
+ * @params out - at least the chunk's raw_size bytes
+ * @returns 0 or -1 if the chunk is corrupt
+*/
+int cdump_inflate(const CDump *cd, unsigned long long chunk, unsigned char *out) {
+  const CDumpChunk *c = &cd->chunks[chunk];
+  STATS_ADD(chunks_inflated, 1);
+  switch (c->type) {
+    case CDUMP_CHUNK_ZERO:
+      memset(out, 0, c->raw_size);
+      return 0;
+    case CDUMP_CHUNK_RAW:
+      memcpy(out, cd->file + c->offset, c->size);
+      return 0;
+    case CDUMP_CHUNK_ZLIB: {
+      uLongf len = c->raw_size;
+      if (uncompress(out, &len, cd->file + c->offset, c->size) != Z_OK || len != c->raw_size) {
+        return -1;
+      }
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/**
+ * This function returns a decompressed chunk from the calling thread's cache
+ * The least recently used slot is refilled on a miss; chunks stored raw or
+ * all zero are handed out in place and never take a slot
+ * @params cd - the compressed dump
+ * @params chunk - index of the chunk
+ * @returns the chunk's bytes, valid until this thread's next lookup evicts
+ * them, dies if the chunk is corrupt
+*/
+const unsigned char* cdump_chunk(const CDump *cd, unsigned long long chunk) {
+  if (cd->chunks[chunk].type == CDUMP_CHUNK_RAW) {
+    return cd->file + cd->chunks[chunk].offset;
+  }
+  if (cd->chunks[chunk].type == CDUMP_CHUNK_ZERO) {
+    return cd->zero;
+  }
+  CDumpCache *cache = thread_cache(cd);
+  CDumpSlot *victim = &cache->slots[0];
+  cache->clock += 1;
+  for (int i = 0; i < CDUMP_CACHE_SLOTS; i++) {
+    CDumpSlot *slot = &cache->slots[i];
+    if (slot->cd == cd && slot->chunk == chunk) {
+      slot->used = cache->clock;
+      STATS_ADD(chunk_hits, 1);
+      return slot->data;
+    }
+    if (slot->used < victim->used) {
+      victim = slot;
+    }
+  }
+
+  if (!victim->data) {
+    victim->data = malloc(cache->chunk_size);
+  }
+  victim->cd = NULL;
+  if (cdump_inflate(cd, chunk, victim->data) == -1) {
+    _die("cdump_chunk - Chunk %llu is corrupt", chunk);
+  }
+  victim->cd = cd;
+  victim->chunk = chunk;
+  victim->used = cache->clock;
+  return victim->data;
+}
+
+/**
+ * This struct is one chunk being compressed by cdump_write
+*/
+typedef struct cdump_job {
+  unsigned long long paddr;
+  unsigned int raw_size;
+  unsigned int type;
+  unsigned char *out;     /* compressBound(chunk_size) bytes */
+  uLongf out_len;
+} CDumpJob;
+
+typedef struct cdump_write_ctx {
+  Dump *dump;
+  CDumpJob *jobs;
+  int num_jobs;
+  int next;
+  int level;
+  unsigned int chunk_size;
+} CDumpWriteCtx;
+
+static int is_zero(const unsigned char *p, unsigned int len) {
+  return len == 0 || (p[0] == 0 && memcmp(p, p + 1, len - 1) == 0);
+}
+
+static void* compress_worker(void *arg) {
+  CDumpWriteCtx *ctx = arg;
+  unsigned char *raw = malloc(ctx->chunk_size);
+  for (;;) {
+    int j = __atomic_fetch_add(&ctx->next, 1, __ATOMIC_RELAXED);
+    if (j >= ctx->num_jobs) {
+      break;
+    }
+    CDumpJob *job = &ctx->jobs[j];
+    if (dump_read(ctx->dump, job->paddr, raw, job->raw_size) == -1) {
+      _die("cdump_write - Unable to read %llx", job->paddr);
+    }
+    if (is_zero(raw, job->raw_size)) {
+      job->type = CDUMP_CHUNK_ZERO;
+      job->out_len = 0;
+      continue;
+    }
+    job->out_len = compressBound(ctx->chunk_size);
+    if (compress2(job->out, &job->out_len, raw, job->raw_size, ctx->level) != Z_OK ||
+        job->out_len >= job->raw_size) {
+      memcpy(job->out, raw, job->raw_size);
+      job->out_len = job->raw_size;
+      job->type = CDUMP_CHUNK_RAW;
+    } else {
+      job->type = CDUMP_CHUNK_ZLIB;
+    }
+  }
+  free(raw);
+  return NULL;
+}
+
+/**
+ * This function writes a dump in the compressed format
+ * Chunks are compressed by a pool of threads a batch at a time and written
+ * in order, so memory stays bounded on dumps of any size
+ * @params dump - the opened dump (lime or already compressed)
+ * @params filename - the file to write
+ * @params chunk_size - bytes of memory per chunk
+ * @params level - zlib level, 1 (fast) to 9 (small)
+ * @params threads - compressing threads
+ * @returns 0 or -1 if the file could not be written
+*/
+int cdump_write(Dump *dump, const char *filename, unsigned int chunk_size, int level, int threads) {
+  FILE *f = fopen(filename, "wb");
+  if (!f) {
+    return -1;
+  }
+  if (threads < 1) {
+    threads = 1;
+  }
+
+  unsigned long long num_chunks = 0;
+  CDumpRange *ranges = calloc(dump->num_ranges ? dump->num_ranges : 1, sizeof(CDumpRange));
+  for (int i = 0; i < dump->num_ranges; i++) {
+    unsigned long long len = dump->ranges[i].e_addr - dump->ranges[i].s_addr + 1;
+    ranges[i].s_addr = dump->ranges[i].s_addr;
+    ranges[i].e_addr = dump->ranges[i].e_addr;
+    ranges[i].first_chunk = num_chunks;
+    num_chunks += (len + chunk_size - 1) / chunk_size;
+  }
+  CDumpChunk *chunks = calloc(num_chunks ? num_chunks : 1, sizeof(CDumpChunk));
+
+  CDumpHeader h;
+  memset(&h, 0, sizeof(h));
+  int ok = fwrite(&h, sizeof(h), 1, f) == 1;
+  unsigned long long offset = sizeof(h);
+
+  /* every chunk in physical order, compressed threads * 8 at a time */
+  CDumpWriteCtx ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.dump = dump;
+  ctx.level = level;
+  ctx.chunk_size = chunk_size;
+  int batch = threads * 8;
+  ctx.jobs = calloc(batch, sizeof(CDumpJob));
+  for (int j = 0; j < batch; j++) {
+    ctx.jobs[j].out = malloc(compressBound(chunk_size));
+  }
+  pthread_t *tids = malloc(sizeof(pthread_t) * threads);
+
+  unsigned long long c = 0;
+  int r = 0;
+  unsigned long long pos = 0;
+  while (ok && c < num_chunks) {
+    ctx.num_jobs = 0;
+    ctx.next = 0;
+    while (ctx.num_jobs < batch && r < dump->num_ranges) {
+      unsigned long long len = ranges[r].e_addr - ranges[r].s_addr + 1;
+      CDumpJob *job = &ctx.jobs[ctx.num_jobs++];
+      job->paddr = ranges[r].s_addr + pos;
+      job->raw_size = len - pos < chunk_size ? len - pos : chunk_size;
+      pos += job->raw_size;
+      if (pos == len) {
+        r += 1;
+        pos = 0;
+      }
+    }
+
+    int started = 0;
+    for (int i = 1; i < threads && i < ctx.num_jobs; i++) {
+      if (pthread_create(&tids[started], NULL, compress_worker, &ctx) != 0) {
+        break;
+      }
+      started += 1;
+    }
+    compress_worker(&ctx);
+    for (int i = 0; i < started; i++) {
+      pthread_join(tids[i], NULL);
+    }
+
+    for (int j = 0; ok && j < ctx.num_jobs; j++, c++) {
+      CDumpJob *job = &ctx.jobs[j];
+      chunks[c].offset = job->out_len ? offset : 0;
+      chunks[c].size = job->out_len;
+      chunks[c].raw_size = job->raw_size;
+      chunks[c].type = job->type;
+      ok = fwrite(job->out, 1, job->out_len, f) == job->out_len;
+      offset += job->out_len;
+    }
+  }
+
+  memcpy(h.magic, CDUMP_MAGIC, sizeof(CDUMP_MAGIC));
+  h.version = CDUMP_VERSION;
+  h.chunk_size = chunk_size;
+  h.num_ranges = dump->num_ranges;
+  h.num_chunks = num_chunks;
+  h.ranges_off = offset;
+  h.chunks_off = offset + dump->num_ranges * sizeof(CDumpRange);
+  ok = ok &&
+    fwrite(ranges, sizeof(CDumpRange), dump->num_ranges, f) == (size_t) dump->num_ranges &&
+    fwrite(chunks, sizeof(CDumpChunk), num_chunks, f) == num_chunks &&
+    fseek(f, 0, SEEK_SET) == 0 &&
+    fwrite(&h, sizeof(h), 1, f) == 1;
+  _debug("DEBUG: wrote %llu chunks, %llu bytes", num_chunks, h.chunks_off + num_chunks * sizeof(CDumpChunk));
+
+  for (int j = 0; j < batch; j++) {
+    free(ctx.jobs[j].out);
+  }
+  free(ctx.jobs);
+  free(tids);
+  free(ranges);
+  free(chunks);
+  if (fclose(f) != 0) {
+    ok = 0;
+  }
+  return ok ? 0 : -1;
+}
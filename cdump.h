@@ -0,0 +1,70 @@
+#ifndef _CDUMP_H
+#define _CDUMP_H
+
+#include <stdint.h>
+
+#include "dump.h"
+
+#define CDUMP_MAGIC "MACDMP1"
+#define CDUMP_VERSION 1
+#define CDUMP_CHUNK_SIZE (32 * 1024)    /* default bytes of memory per chunk, zlib's window */
+#define CDUMP_CACHE_SLOTS 16            /* decompressed chunks kept per thread */
+
+/* how a chunk is stored */
+#define CDUMP_CHUNK_ZLIB 0
+#define CDUMP_CHUNK_RAW 1   /* did not compress */
+#define CDUMP_CHUNK_ZERO 2  /* all zero, nothing stored */
+
+/**
+ * These structs are the compressed dump format, all little endian
+ * The file is the header, the chunk data, then the range table (sorted by
+ * s_addr) and the chunk table; each range is cut into chunk_size pieces of
+ * memory that are compressed independently, so any one can be read alone
+*/
+
+typedef struct cdump_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t chunk_size;
+	uint32_t num_ranges;
+	uint32_t pad;
+	uint64_t num_chunks;
+	uint64_t ranges_off;
+	uint64_t chunks_off;
+} __attribute__ ((__packed__)) CDumpHeader;
+
+typedef struct cdump_range {
+	uint64_t s_addr;
+	uint64_t e_addr;       /* inclusive, as in the lime header */
+	uint64_t first_chunk;  /* index of the chunk holding s_addr */
+} __attribute__ ((__packed__)) CDumpRange;
+
+typedef struct cdump_chunk {
+	uint64_t offset;       /* file offset of the stored bytes */
+	uint32_t size;         /* stored bytes */
+	uint32_t raw_size;     /* memory bytes, chunk_size except at the end of a range */
+	uint32_t type;         /* CDUMP_CHUNK_* */
+	uint32_t pad;
+} __attribute__ ((__packed__)) CDumpChunk;
+
+/**
+ * This struct is an open compressed dump, the tables are used in place
+*/
+
+typedef struct cdump {
+	const unsigned char *file;   /* the mapped file */
+	unsigned long long file_len;
+	const CDumpHeader *header;
+	const CDumpRange *ranges;
+	const CDumpChunk *chunks;
+	unsigned char *zero;         /* chunk_size zero bytes handed out for CDUMP_CHUNK_ZERO */
+} CDump;
+
+int cdump_check(int fd);
+CDump* cdump_open(int fd, unsigned long long file_len);
+void cdump_close(CDump *cd);
+int cdump_inflate(const CDump *cd, unsigned long long chunk, unsigned char *out);
+const unsigned char* cdump_chunk(const CDump *cd, unsigned long long chunk);
+int cdump_write(Dump *dump, const char *filename, unsigned int chunk_size, int level, int threads);
+
+#endif
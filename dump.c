@@ -0,0 +1,541 @@
+#define _LARGEFILE64_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "util.h"
+#include "dump.h"
+#include "cdump.h"
+#include "dumpindex.h"
+#include "stats.h"
+
+/**
+ * This function adds to the head of a linkedlist of lime headers
+ * These headers are used to seek to the correct block (and address) in the dump file
+ * @params l - the head of the list
+ * @params h - the lime header to be added to the list
+ * @returns l - the updated head of the list
+*/
+LHdr_list* header_list_add(LHdr_list *l, LHdr *h) {
+  LHdr_list* new_head = (LHdr_list*) calloc(1, sizeof(LHdr_list));
+  new_head->header = h;
+  new_head->next = l;
+  l = new_head;
+  return l;
+}
+
+/**
+ * This function fills a linked list of lime headers with data
+ * It seeks to the end of the dump file without resetting it 
+ * 
+ * It also sets PA_MAX to the e_addr of the last header
+ * 
+ * A capture cut short keeps what made it to disk: the last block is
+ * shortened to the bytes present and a trailing partial header is dropped,
+ * with a warning either way
+ * 
+ * @params fp - file pointer for dump file
+ * @return l - the linked list of headers
+*/
+LHdr_list* get_lime_headers(int fd) {
+  LHdr_list *l = calloc(1, sizeof(LHdr_list));
+  unsigned long long fileSize = get_file_length(fd);
+
+  if (lseek64(fd, 0, SEEK_SET) != 0) 
+    _die("Unable to seek to offset 0 in dump");
+  STATS_ADD(syscalls, 1);
+
+  unsigned long long bytes_read = 0;
+  int header_count = 0;
+  unsigned long long block_size = 0;
+  off64_t seek;
+  while (bytes_read < fileSize - 1) {
+    if (fileSize - bytes_read < sizeof(LHdr)) {
+      fprintf(stderr, "WARNING: dump ends inside lime header %d, the dump is truncated\n", header_count);
+      break;
+    }
+    LHdr *header = malloc(sizeof(LHdr));
+    if (read(fd, header, sizeof(LHdr)) != sizeof(LHdr)) {
+      _die("Unable to read in lime header: %d", header_count);
+    }
+    if (header->magic != LIME_MAGIC) {
+      _die("Bad magic %x in lime header %d at offset %llu", header->magic, header_count, bytes_read);
+    }
+    if (header->e_addr < header->s_addr) {
+      _die("Lime header %d ends before it starts: %llx-%llx", header_count, header->s_addr, header->e_addr);
+    }
+
+    unsigned long long block_s_offset = bytes_read + sizeof(LHdr);
+    block_size = header->e_addr - header->s_addr + 1;
+    if (block_size > fileSize - block_s_offset) {
+      fprintf(stderr, "WARNING: lime block %llx-%llx has %llu of its %llu bytes, the dump is truncated\n",
+        header->s_addr, header->e_addr, fileSize - block_s_offset, block_size);
+      if (block_s_offset == fileSize) {
+        free(header);
+        break;
+      }
+      block_size = fileSize - block_s_offset;
+      header->e_addr = header->s_addr + block_size - 1;
+    }
+    
+    l = header_list_add(l, header);
+    l->block_s_offset = lseek64(fd, 0, SEEK_CUR);
+    
+    seek = lseek64(fd, block_size, SEEK_CUR);
+    if (seek == -1) {
+      _die("Unable to seek to next header"); 
+    }
+    l->block_e_offset = lseek64(fd, 0, SEEK_CUR);
+    STATS_ADD(syscalls, 4);
+    STATS_ADD(bytes_read, sizeof(LHdr));
+
+    header_count += 1;
+    bytes_read = seek;
+  }
+
+  if (debug) {
+    LHdr_list *curr = l;
+    while (curr->next) {
+      printf("start: %llx, end: %llx\n", curr->header->s_addr, curr->header->e_addr);
+      curr = curr->next;
+    }
+  }
+  
+  return l;
+}
+
+/**
+ * This function maps a single lime block read-only into memory
+ * mmap needs a page aligned file offset, so the mapping starts at the page
+ * holding the block's first byte and node->data is adjusted past the slack
+ * @params fd - file descriptor of dump
+ * @params node - the lime block to map
+ * @params file_size - length of the dump, the mapping never reaches past it
+*/
+static void map_block(int fd, LHdr_list *node, unsigned long long file_size) {
+  unsigned long long page_size = sysconf(_SC_PAGESIZE);
+  unsigned long long map_offset = node->block_s_offset & ~(page_size - 1);
+  unsigned long long slack = node->block_s_offset - map_offset;
+
+  if (node->block_e_offset > file_size || node->block_s_offset > node->block_e_offset) {
+    _die("Lime block %llx-%llx lies past the end of the dump", node->header->s_addr, node->header->e_addr);
+  }
+  node->map_len = node->block_e_offset - map_offset;
+  node->map_base = mmap(NULL, node->map_len, PROT_READ, MAP_PRIVATE, fd, map_offset);
+  if (node->map_base == MAP_FAILED) {
+    _die("Unable to map lime block: %llx-%llx", node->header->s_addr, node->header->e_addr);
+  }
+  node->data = (const unsigned char *) node->map_base + slack;
+  STATS_ADD(syscalls, 1);
+}
+
+/**
+ * qsort comparator ordering ranges by their first physical address
+*/
+static int range_cmp(const void *a, const void *b) {
+  const DumpRange *ra = a;
+  const DumpRange *rb = b;
+  return (ra->s_addr > rb->s_addr) - (ra->s_addr < rb->s_addr);
+}
+
+/**
+ * This function flattens the (reverse ordered) lime header list into a
+ * contiguous table sorted by physical address
+ * Blocks must already be mapped
+ * @params dump - the dump to build the table for
+*/
+static void build_range_table(Dump *dump) {
+  int count = 0;
+  LHdr_list *node = dump->headers;
+  while (node->next) {
+    count += 1;
+    node = node->next;
+  }
+
+  dump->ranges = malloc(sizeof(DumpRange) * (count ? count : 1));
+  dump->num_ranges = count;
+
+  int i = 0;
+  node = dump->headers;
+  while (node->next) {
+    dump->ranges[i].s_addr = node->header->s_addr;
+    dump->ranges[i].e_addr = node->header->e_addr;
+    dump->ranges[i].offset = node->block_s_offset;
+    dump->ranges[i].data = node->data;
+    i += 1;
+    node = node->next;
+  }
+  qsort(dump->ranges, count, sizeof(DumpRange), range_cmp);
+
+  dump->offsets_sorted = 1;
+  for (i = 1; i < count; i++) {
+    if (dump->ranges[i].s_addr <= dump->ranges[i - 1].e_addr) {
+      _die("Overlapping lime blocks: %llx-%llx and %llx-%llx",
+        dump->ranges[i - 1].s_addr, dump->ranges[i - 1].e_addr,
+        dump->ranges[i].s_addr, dump->ranges[i].e_addr);
+    }
+    if (dump->ranges[i].offset < dump->ranges[i - 1].offset) {
+      dump->offsets_sorted = 0;
+    }
+  }
+}
+
+/**
+ * This function finds the range holding a physical address
+ * The search loop has no data dependent branches, only the final bounds check
+ * @params dump - the opened dump
+ * @params paddr - physical address to look up
+ * @returns the range containing paddr or NULL
+*/
+static inline const DumpRange* find_range(const Dump *dump, unsigned long long paddr) {
+  const DumpRange *base = dump->ranges;
+  int n = dump->num_ranges;
+  if (n == 0) {
+    return NULL;
+  }
+  while (n > 1) {
+    int half = n / 2;
+    base = (base[half].s_addr <= paddr) ? base + half : base;
+    n -= half;
+  }
+  if (paddr < base->s_addr || paddr > base->e_addr) {
+    return NULL;
+  }
+  return base;
+}
+
+/**
+ * This function builds the range table of a compressed dump from its index
+ * File offsets are those the blocks would have in the lime dump
+ * @params dump - the dump, cdump already open
+*/
+static void build_compressed_range_table(Dump *dump) {
+  const CDump *cd = dump->cdump;
+  int count = cd->header->num_ranges;
+  dump->ranges = malloc(sizeof(DumpRange) * (count ? count : 1));
+  dump->num_ranges = count;
+  dump->offsets_sorted = 1;
+
+  unsigned long long offset = 0;
+  for (int i = 0; i < count; i++) {
+    offset += sizeof(LHdr);
+    dump->ranges[i].s_addr = cd->ranges[i].s_addr;
+    dump->ranges[i].e_addr = cd->ranges[i].e_addr;
+    dump->ranges[i].offset = offset;
+    dump->ranges[i].data = NULL;
+    dump->ranges[i].first_chunk = cd->ranges[i].first_chunk;
+    offset += cd->ranges[i].e_addr - cd->ranges[i].s_addr + 1;
+    if (cd->ranges[i].e_addr < cd->ranges[i].s_addr ||
+        (i && cd->ranges[i].s_addr <= cd->ranges[i - 1].e_addr)) {
+      _die("Compressed dump ranges are not sorted: %llx-%llx",
+        dump->ranges[i].s_addr, dump->ranges[i].e_addr);
+    }
+  }
+}
+
+/**
+ * This function opens a lime dump, reads its headers and maps every block
+ * A compressed dump (see cdump.h) is recognised by its magic, only its index
+ * is read and chunks are decompressed as they are touched
+ * @params filename - the name of the memory dump
+ * @returns dump - the opened dump
+*/
+Dump* dump_open(const char *filename) {
+  return dump_open_indexed(filename, NULL);
+}
+
+/**
+ * This function opens a dump with a sidecar index (see dumpindex.h)
+ * While the index matches the dump its ranges are used instead of seeking
+ * through the lime headers; otherwise the headers are read and the index is
+ * rewritten when the dump is closed
+ * @params filename - the name of the memory dump
+ * @params index_filename - the index file, NULL to open without one
+ * @returns dump - the opened dump
+*/
+Dump* dump_open_indexed(const char *filename, const char *index_filename) {
+  Dump *dump = calloc(1, sizeof(Dump));
+  dump->fd = open_file(filename);
+  dump->size = get_file_length(dump->fd);
+  unsigned long long start = stats_now();
+  if (index_filename) {
+    dump->index = dump_index_load(index_filename, dump->fd);
+  }
+  if (cdump_check(dump->fd)) {
+    dump->cdump = cdump_open(dump->fd, dump->size);
+    build_compressed_range_table(dump);
+    stats_phase(STATS_HEADERS, start);
+    return dump;
+  }
+
+  int indexed = dump->index && dump->index->valid;
+  dump->headers = indexed ? dump_index_headers(dump->index) : get_lime_headers(dump->fd);
+  stats_phase(STATS_HEADERS, start);
+
+  LHdr_list *node = dump->headers;
+  while (node->next) {
+    map_block(dump->fd, node, dump->size);
+    node = node->next;
+  }
+  build_range_table(dump);
+  if (dump->index && !indexed) {
+    dump_index_set_ranges(dump->index, dump);
+  }
+  return dump;
+}
+
+/**
+ * This function unmaps every block and closes the dump
+ * The sidecar index is written first if the run added to it
+ * @params dump - the dump to close
+*/
+void dump_close(Dump *dump) {
+  LHdr_list *node = dump->headers;
+  while (node) {
+    LHdr_list *next = node->next;
+    if (node->map_base) {
+      munmap(node->map_base, node->map_len);
+      STATS_ADD(syscalls, 1);
+    }
+    free(node->header);
+    free(node);
+    node = next;
+  }
+  if (dump->cdump) {
+    cdump_close(dump->cdump);
+  }
+  if (dump->index) {
+    if (dump->index->dirty) {
+      dump_index_save(dump->index);
+    }
+    dump_index_free(dump->index);
+  }
+  close(dump->fd);
+  STATS_ADD(syscalls, 1);
+  free(dump->ranges);
+  free(dump);
+}
+
+/**
+ * This function converts a physical address to its offset in the dump file
+ * No seeking is done, the range table is searched
+ * @params dump - the opened dump
+ * @params paddr - physical address to find in dump blocks
+ * @returns the file offset or -1 if paddr is not in the dump
+*/
+long long dump_paddr_to_offset(Dump *dump, unsigned long long paddr) {
+  const DumpRange *range = find_range(dump, paddr);
+  if (!range) {
+    _debug("DEBUG: unable to find correct block in dump for address: %llx", paddr);
+    return -1;
+  }
+  return range->offset + (paddr - range->s_addr);
+}
+
+/**
+ * This function takes an offset from the dump file
+ * and converts it to the physical address 
+ * @params dump - the opened dump
+ * @params offset - position in dump file
+ * @returns paddr - the physical address or -1 if offset is not in a block
+*/
+long long dump_offset_to_paddr(Dump *dump, unsigned long long offset) {
+  const DumpRange *range = NULL;
+  if (dump->offsets_sorted && dump->num_ranges) {
+    const DumpRange *base = dump->ranges;
+    int n = dump->num_ranges;
+    while (n > 1) {
+      int half = n / 2;
+      base = (base[half].offset <= offset) ? base + half : base;
+      n -= half;
+    }
+    range = base;
+  } else {
+    for (int i = 0; i < dump->num_ranges; i++) {
+      if (dump->ranges[i].offset <= offset &&
+          offset - dump->ranges[i].offset <= dump->ranges[i].e_addr - dump->ranges[i].s_addr) {
+        range = &dump->ranges[i];
+        break;
+      }
+    }
+  }
+  if (!range || offset < range->offset || offset - range->offset > range->e_addr - range->s_addr) {
+    _debug("DEBUG: unable to find block that contains offset: %llx", offset);
+    return -1;
+  }
+  return range->s_addr + (offset - range->offset);
+}
+
+/**
+ * This function returns a pointer into the mapping for a physical address
+ * No syscalls or copies are made, the caller reads the dump in place
+ * For a compressed dump the pointer is into the calling thread's chunk cache
+ * and is only valid until that thread's next dump_ptr or dump_read
+ * @params dump - the opened dump
+ * @params paddr - physical address to find in dump blocks
+ * @params length - number of bytes the caller will read from paddr
+ * @returns a const pointer to paddr or NULL if [paddr, paddr + length) is not
+ * in a single block (a single chunk for a compressed dump)
+*/
+const unsigned char* dump_ptr(Dump *dump, unsigned long long paddr, unsigned long long length) {
+  const DumpRange *range = find_range(dump, paddr);
+  if (!range || length > range->e_addr - paddr + 1) {
+    _debug("DEBUG: unable to find correct block in dump for address: %llx", paddr);
+    return NULL;
+  }
+  STATS_ADD(dump_bytes, length);
+  if (dump->cdump) {
+    unsigned int chunk_size = dump->cdump->header->chunk_size;
+    unsigned long long off = paddr - range->s_addr;
+    if (off % chunk_size + length > chunk_size) {
+      return NULL;
+    }
+    return cdump_chunk(dump->cdump, range->first_chunk + off / chunk_size) + off % chunk_size;
+  }
+  return range->data + (paddr - range->s_addr);
+}
+
+/**
+ * This function copies part of a range of a compressed dump
+ * Whole chunks are decompressed straight into buf, so a large read does not
+ * flush the chunk cache
+*/
+static void read_compressed(Dump *dump, const DumpRange *range, unsigned long long off, unsigned char *dst, unsigned long long length) {
+  const CDump *cd = dump->cdump;
+  unsigned int chunk_size = cd->header->chunk_size;
+  while (length) {
+    unsigned long long chunk = range->first_chunk + off / chunk_size;
+    unsigned long long in_chunk = off % chunk_size;
+    unsigned long long n = chunk_size - in_chunk;
+    if (n > length) {
+      n = length;
+    }
+    if (in_chunk == 0 && n == cd->chunks[chunk].raw_size) {
+      if (cdump_inflate(cd, chunk, dst) == -1) {
+        _die("read_compressed - Chunk %llu is corrupt", chunk);
+      }
+    } else {
+      memcpy(dst, cdump_chunk(cd, chunk) + in_chunk, n);
+    }
+    dst += n;
+    off += n;
+    length -= n;
+  }
+}
+
+/**
+ * This function asks the kernel to start reading part of the dump in, so a
+ * later dump_ptr of it does not stall on a page fault
+ * Only a mapped lime block is advised, a compressed dump is left alone
+ * @params dump - the opened dump
+ * @params paddr - physical address of the first byte
+ * @params length - number of bytes, clipped to paddr's block
+*/
+void dump_prefetch(Dump *dump, unsigned long long paddr, unsigned long long length) {
+  const DumpRange *range = find_range(dump, paddr);
+  if (!range || !range->data) {
+    return;
+  }
+  if (length > range->e_addr - paddr + 1) {
+    length = range->e_addr - paddr + 1;
+  }
+  unsigned long long page_size = sysconf(_SC_PAGESIZE);
+  const unsigned char *p = range->data + (paddr - range->s_addr);
+  unsigned long long start = (unsigned long long) p & ~(page_size - 1); // in the mapping, it starts on a page
+  madvise((void *) start, (unsigned long long) p + length - start, MADV_WILLNEED);
+  STATS_ADD(syscalls, 1);
+}
+
+/**
+ * This function tells whether part of the dump is in the page cache, i.e.
+ * whether reading it through the mapping would stall
+ * @params dump - the opened dump
+ * @params paddr - physical address of the first byte
+ * @params length - number of bytes, clipped to paddr's block and DUMP_PROBE_PAGES
+ * @returns 1 if every page is resident or the part is not mapped, else 0
+*/
+int dump_resident(Dump *dump, unsigned long long paddr, unsigned long long length) {
+  const DumpRange *range = find_range(dump, paddr);
+  if (!range || !range->data || !length) {
+    return 1;
+  }
+  if (length > range->e_addr - paddr + 1) {
+    length = range->e_addr - paddr + 1;
+  }
+  unsigned long long page_size = sysconf(_SC_PAGESIZE);
+  const unsigned char *p = range->data + (paddr - range->s_addr);
+  unsigned long long start = (unsigned long long) p & ~(page_size - 1);
+  unsigned long long pages = ((unsigned long long) p + length - start + page_size - 1) / page_size;
+  unsigned char vec[DUMP_PROBE_PAGES];
+  if (pages > DUMP_PROBE_PAGES) {
+    pages = DUMP_PROBE_PAGES;
+  }
+  STATS_ADD(syscalls, 1);
+  if (mincore((void *) start, pages * page_size, vec) == -1) {
+    return 1;
+  }
+  for (unsigned long long i = 0; i < pages; i++) {
+    if (!(vec[i] & 1)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * This function copies [paddr, paddr + length) out of the dump into buf
+ * Unlike dump_ptr the extent may span several adjacent lime blocks
+ * @params dump - the opened dump
+ * @params paddr - physical address to start reading at
+ * @params buf - destination, at least length bytes
+ * @params length - number of bytes to copy
+ * @returns 0 on success or -1 if any byte of the extent is not in the dump
+*/
+int dump_read(Dump *dump, unsigned long long paddr, void *buf, unsigned long long length) {
+  unsigned char *dst = buf;
+  STATS_ADD(dump_bytes, length);
+  while (length) {
+    const DumpRange *range = find_range(dump, paddr);
+    if (!range) {
+      _debug("DEBUG: unable to find correct block in dump for address: %llx", paddr);
+      return -1;
+    }
+    unsigned long long chunk = range->e_addr - paddr + 1;
+    if (chunk > length) {
+      chunk = length;
+    }
+    if (dump->cdump) {
+      read_compressed(dump, range, paddr - range->s_addr, dst, chunk);
+    } else {
+      memcpy(dst, range->data + (paddr - range->s_addr), chunk);
+    }
+    dst += chunk;
+    paddr += chunk;
+    length -= chunk;
+  }
+  return 0;
+}
+
+/**
+ * This function returns [start, start + length) of a range for a scanner
+ * A lime dump is read in place, a compressed one is decompressed into buf
+ * @params dump - the opened dump
+ * @params range - one of dump->ranges
+ * @params start - offset in the range
+ * @params length - bytes wanted, start + length must be within the range
+ * @params buf - length bytes, only used (and only needed) for a compressed dump
+ * @returns the bytes
+*/
+const unsigned char* dump_range_bytes(Dump *dump, const DumpRange *range, unsigned long long start, unsigned long long length, unsigned char *buf) {
+  if (!dump->cdump) {
+    return range->data + start;
+  }
+  read_compressed(dump, range, start, buf, length);
+  return buf;
+}
@@ -0,0 +1,77 @@
+#ifndef _DUMP_H
+#define _DUMP_H
+
+#define LIME_MAGIC 0x4C694D45 /* "EMiL" */
+#define LIME_VERSION 1
+
+/* bytes of a range a scanner looks at in one go, see dump_range_bytes */
+#define DUMP_WINDOW_SIZE (4ULL << 20)
+/* most pages dump_resident looks at */
+#define DUMP_PROBE_PAGES 16
+
+/**
+ * This struct is for the lime header format
+*/
+
+typedef struct lime_header {
+	unsigned int magic;
+	unsigned int version;
+	unsigned long long s_addr;
+	unsigned long long e_addr;
+	unsigned char reserved[8];
+} __attribute__ ((__packed__)) LHdr;
+
+
+typedef struct lime_header_list {
+	LHdr *header;
+	unsigned long long block_s_offset;
+	unsigned long long block_e_offset;
+	const unsigned char *data; /* first byte of the block in the mapping */
+	void *map_base;            /* page aligned base passed to munmap */
+	unsigned long long map_len;
+	struct lime_header_list* next;
+} LHdr_list;
+
+/**
+ * This struct is one entry of the range table used to resolve addresses
+ * The table is sorted by s_addr so lookups are a binary search
+*/
+
+typedef struct dump_range {
+	unsigned long long s_addr;   /* first physical address in the block */
+	unsigned long long e_addr;   /* last physical address in the block (inclusive) */
+	unsigned long long offset;   /* file offset of s_addr */
+	const unsigned char *data;   /* s_addr in the mapping, NULL for a compressed dump */
+	unsigned long long first_chunk; /* compressed dump chunk holding s_addr */
+} DumpRange;
+
+/**
+ * This struct is an open dump with every lime block mapped into memory
+*/
+
+typedef struct dump {
+	int fd;
+	unsigned long long size;
+	LHdr_list *headers;
+	DumpRange *ranges;
+	int num_ranges;
+	int offsets_sorted; /* file offsets ascend with s_addr (always true for LiME) */
+	struct cdump *cdump; /* set for a compressed dump, read through its chunk cache */
+	struct dump_index *index; /* sidecar index, NULL if opened without one */
+} Dump;
+
+LHdr_list* header_list_add(LHdr_list *list, LHdr *lhdr);
+LHdr_list* get_lime_headers(int fd);
+
+Dump* dump_open(const char *filename);
+Dump* dump_open_indexed(const char *filename, const char *index_filename);
+void dump_close(Dump *dump);
+long long dump_paddr_to_offset(Dump *dump, unsigned long long paddr);
+long long dump_offset_to_paddr(Dump *dump, unsigned long long offset);
+const unsigned char* dump_ptr(Dump *dump, unsigned long long paddr, unsigned long long length);
+int dump_read(Dump *dump, unsigned long long paddr, void *buf, unsigned long long length);
+void dump_prefetch(Dump *dump, unsigned long long paddr, unsigned long long length);
+int dump_resident(Dump *dump, unsigned long long paddr, unsigned long long length);
+const unsigned char* dump_range_bytes(Dump *dump, const DumpRange *range, unsigned long long start, unsigned long long length, unsigned char *buf);
+
+#endif
@@ -0,0 +1,205 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "util.h"
+#include "dump.h"
+#include "locate.h"
+#include "dumpindex.h"
+#include "stats.h"
+
+/**
+ * This function fills in the fingerprint of the dump
+ * @returns 0 or -1 if the dump cannot be stat'ed
+*/
+static int fingerprint(int dump_fd, DumpIndexHeader *h) {
+  struct stat st;
+  STATS_ADD(syscalls, 1);
+  if (fstat(dump_fd, &st) == -1) {
+    return -1;
+  }
+  h->dump_size = st.st_size;
+  h->mtime_sec = st.st_mtim.tv_sec;
+  h->mtime_nsec = st.st_mtim.tv_nsec;
+  h->inode = st.st_ino;
+  return 0;
+}
+
+/**
+ * This function reads a dump's sidecar index
+ * A missing, corrupt or stale index is not an error, the returned index is
+ * then empty and filled in as the dump is analysed
+ * @params filename - the index file
+ * @params dump_fd - the open dump, to compare with the fingerprint
+ * @returns the index
+*/
+DumpIndex* dump_index_load(const char *filename, int dump_fd) {
+  DumpIndex *index = calloc(1, sizeof(DumpIndex));
+  index->filename = strdup(filename);
+  DumpIndexHeader current = { 0 };
+  if (fingerprint(dump_fd, &current) == -1) {
+    _debug("DEBUG: unable to stat the dump, not using %s", filename);
+    return index;
+  }
+
+  FILE *f = fopen(filename, "rb");
+  if (f) {
+    DumpIndexHeader h;
+    STATS_ADD(syscalls, 2);
+    if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, DUMP_INDEX_MAGIC, sizeof(DUMP_INDEX_MAGIC)) != 0 ||
+        h.version != DUMP_INDEX_VERSION) {
+      _debug("DEBUG: %s is not a version %d index", filename, DUMP_INDEX_VERSION);
+    } else if (h.dump_size != current.dump_size || h.mtime_sec != current.mtime_sec ||
+        h.mtime_nsec != current.mtime_nsec || h.inode != current.inode) {
+      _debug("DEBUG: %s is stale", filename);
+    } else {
+      DumpIndexRange *ranges = malloc(sizeof(DumpIndexRange) * (h.num_ranges ? h.num_ranges : 1));
+      int ok = fread(ranges, sizeof(DumpIndexRange), h.num_ranges, f) == h.num_ranges;
+      for (unsigned int i = 0; ok && i < h.num_ranges; i++) {
+        ok = ranges[i].e_addr >= ranges[i].s_addr && ranges[i].offset <= h.dump_size &&
+          ranges[i].e_addr - ranges[i].s_addr < h.dump_size - ranges[i].offset;
+      }
+      if (ok) {
+        h.release[DUMP_INDEX_RELEASE_LEN - 1] = '\0';
+        index->header = h;
+        index->ranges = ranges;
+        index->valid = 1;
+        STATS_ADD(bytes_read, sizeof(h) + sizeof(DumpIndexRange) * h.num_ranges);
+        _debug("DEBUG: using index %s, %u ranges", filename, h.num_ranges);
+      } else {
+        _debug("DEBUG: %s is corrupt", filename);
+        free(ranges);
+      }
+    }
+    fclose(f);
+  }
+
+  if (!index->valid) {
+    memcpy(index->header.magic, DUMP_INDEX_MAGIC, sizeof(DUMP_INDEX_MAGIC));
+    index->header.version = DUMP_INDEX_VERSION;
+    index->header.dump_size = current.dump_size;
+    index->header.mtime_sec = current.mtime_sec;
+    index->header.mtime_nsec = current.mtime_nsec;
+    index->header.inode = current.inode;
+    index->dirty = 1;
+  }
+  return index;
+}
+
+/**
+ * This function builds the lime header list from a valid index, in the
+ * order get_lime_headers would, without touching the dump
+ * @params index - a valid index
+ * @returns the linked list of headers
+*/
+LHdr_list* dump_index_headers(const DumpIndex *index) {
+  LHdr_list *l = calloc(1, sizeof(LHdr_list));
+  for (unsigned int i = 0; i < index->header.num_ranges; i++) {
+    LHdr *header = calloc(1, sizeof(LHdr));
+    header->magic = LIME_MAGIC;
+    header->version = LIME_VERSION;
+    header->s_addr = index->ranges[i].s_addr;
+    header->e_addr = index->ranges[i].e_addr;
+    l = header_list_add(l, header);
+    l->block_s_offset = index->ranges[i].offset;
+    l->block_e_offset = index->ranges[i].offset + (header->e_addr - header->s_addr + 1);
+  }
+  return l;
+}
+
+/**
+ * This function records the ranges of a dump whose headers were read
+ * @params index - the index of the dump
+ * @params dump - the opened dump
+*/
+void dump_index_set_ranges(DumpIndex *index, const Dump *dump) {
+  free(index->ranges);
+  index->ranges = malloc(sizeof(DumpIndexRange) * (dump->num_ranges ? dump->num_ranges : 1));
+  index->header.num_ranges = dump->num_ranges;
+  for (int i = 0; i < dump->num_ranges; i++) {
+    index->ranges[i].s_addr = dump->ranges[i].s_addr;
+    index->ranges[i].e_addr = dump->ranges[i].e_addr;
+    index->ranges[i].offset = dump->ranges[i].offset;
+  }
+  index->dirty = 1;
+}
+
+/**
+ * This function returns where init_task was found on an earlier run
+ * @params index - the index of the dump
+ * @params key - locate_key() of the parameters it is being looked for with
+ * @params hit - set to init_task and the kernel shift
+ * @returns 1 if the index has a hit for these parameters
+*/
+int dump_index_get_locate(const DumpIndex *index, unsigned long long key, LocateHit *hit) {
+  if (!(index->header.flags & DUMP_INDEX_HAS_LOCATE) || index->header.locate_key != key) {
+    return 0;
+  }
+  hit->paddr = index->header.init_task_paddr;
+  hit->shift = index->header.kernel_shift;
+  return 1;
+}
+
+void dump_index_set_locate(DumpIndex *index, unsigned long long key, const LocateHit *hit) {
+  index->header.flags |= DUMP_INDEX_HAS_LOCATE;
+  index->header.locate_key = key;
+  index->header.init_task_paddr = hit->paddr;
+  index->header.kernel_shift = hit->shift;
+  index->dirty = 1;
+}
+
+/**
+ * This function returns the kernel release found on an earlier run
+ * @returns 1 if the index has it
+*/
+int dump_index_get_release(const DumpIndex *index, char *release, int len) {
+  if (!(index->header.flags & DUMP_INDEX_HAS_RELEASE)) {
+    return 0;
+  }
+  snprintf(release, len, "%s", index->header.release);
+  return 1;
+}
+
+void dump_index_set_release(DumpIndex *index, const char *release) {
+  index->header.flags |= DUMP_INDEX_HAS_RELEASE;
+  snprintf(index->header.release, sizeof(index->header.release), "%s", release);
+  index->dirty = 1;
+}
+
+/**
+ * This function writes the index next to the dump
+ * It is written to a temporary file and renamed over the old one, so a
+ * reader (e.g. another batch worker) never sees half of it
+ * @params index - the index to write
+ * @returns 0 or -1 if it could not be written, e.g. a read-only directory
+*/
+int dump_index_save(DumpIndex *index) {
+  char tmp[4096];
+  snprintf(tmp, sizeof(tmp), "%s.%d", index->filename, getpid());
+  FILE *f = fopen(tmp, "wb");
+  if (!f) {
+    _debug("DEBUG: unable to write index %s", index->filename);
+    return -1;
+  }
+  int ok = fwrite(&index->header, sizeof(DumpIndexHeader), 1, f) == 1 &&
+    fwrite(index->ranges, sizeof(DumpIndexRange), index->header.num_ranges, f) == index->header.num_ranges;
+  ok = fclose(f) == 0 && ok;
+  STATS_ADD(syscalls, 3);
+  if (!ok || rename(tmp, index->filename) == -1) {
+    _debug("DEBUG: unable to write index %s", index->filename);
+    unlink(tmp);
+    return -1;
+  }
+  STATS_ADD(syscalls, 1);
+  index->dirty = 0;
+  return 0;
+}
+
+void dump_index_free(DumpIndex *index) {
+  free(index->filename);
+  free(index->ranges);
+  free(index);
+}
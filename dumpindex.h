@@ -0,0 +1,69 @@
+#ifndef _DUMPINDEX_H
+#define _DUMPINDEX_H
+
+#include <stdint.h>
+
+#include "dump.h"
+#include "locate.h"
+
+#define DUMP_INDEX_MAGIC "MAIDX1"
+#define DUMP_INDEX_VERSION 1
+#define DUMP_INDEX_SUFFIX ".idx"         /* the index of dump.lime is dump.lime.idx */
+#define DUMP_INDEX_RELEASE_LEN 64
+
+/* what the index holds besides the ranges */
+#define DUMP_INDEX_HAS_LOCATE (1U << 0)
+#define DUMP_INDEX_HAS_RELEASE (1U << 1)
+
+/**
+ * These structs are the sidecar index file, all little endian
+ * The file is the header followed by the ranges in file order; it is only
+ * trusted while the dump's size, mtime and inode match the fingerprint
+*/
+
+typedef struct dump_index_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t num_ranges;
+	uint64_t dump_size;        /* fingerprint of the dump */
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint64_t inode;
+	uint32_t flags;            /* DUMP_INDEX_HAS_* */
+	uint32_t pad;
+	uint64_t locate_key;       /* locate_key() of the parameters init_task was found with */
+	uint64_t init_task_paddr;
+	uint64_t kernel_shift;
+	char release[DUMP_INDEX_RELEASE_LEN];
+} __attribute__ ((__packed__)) DumpIndexHeader;
+
+typedef struct dump_index_range {
+	uint64_t s_addr;
+	uint64_t e_addr;           /* inclusive, as in the lime header */
+	uint64_t offset;           /* file offset of s_addr */
+} __attribute__ ((__packed__)) DumpIndexRange;
+
+/**
+ * This struct is the index of an open dump
+ * It is written back when the dump is closed if anything was learned
+*/
+
+typedef struct dump_index {
+	char *filename;
+	DumpIndexHeader header;
+	DumpIndexRange *ranges;
+	int valid;                 /* read from disk and matches the dump */
+	int dirty;                 /* differs from the file on disk */
+} DumpIndex;
+
+DumpIndex* dump_index_load(const char *filename, int dump_fd);
+LHdr_list* dump_index_headers(const DumpIndex *index);
+void dump_index_set_ranges(DumpIndex *index, const Dump *dump);
+int dump_index_get_locate(const DumpIndex *index, unsigned long long key, LocateHit *hit);
+void dump_index_set_locate(DumpIndex *index, unsigned long long key, const LocateHit *hit);
+int dump_index_get_release(const DumpIndex *index, char *release, int len);
+void dump_index_set_release(DumpIndex *index, const char *release);
+int dump_index_save(DumpIndex *index);
+void dump_index_free(DumpIndex *index);
+
+#endif
@@ -0,0 +1,1003 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <elf.h>
+#include <sys/mman.h>
+
+#include "util.h"
+#include "dwarf.h"
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+/* deepest typedef/array/pointer chain followed when printing a member type */
+#define MAX_TYPE_DEPTH 32
+
+#define NO_REF ((unsigned long long) -1)
+
+/**
+ * This struct is one debug section in the mapped ELF file
+*/
+typedef struct section {
+  const unsigned char *data;
+  unsigned long long size;
+} Section;
+
+/**
+ * This struct is a position in a section
+*/
+typedef struct reader {
+  const unsigned char *p;
+  const unsigned char *end;
+} Reader;
+
+/**
+ * This struct is one attribute of an abbreviation
+*/
+typedef struct attr_spec {
+  unsigned int name;
+  unsigned int form;
+  long long implicit;
+} AttrSpec;
+
+/**
+ * This struct is one abbreviation, the shape of a DIE
+*/
+typedef struct abbrev {
+  unsigned long long code;
+  unsigned int tag;
+  int children;
+  int num_attrs;
+  AttrSpec *attrs;
+} Abbrev;
+
+/**
+ * This struct is a decoded attribute value
+ * refs are converted to .debug_info offsets, strings point into the file
+*/
+typedef struct attr_value {
+  unsigned long long u;
+  long long s;
+  const char *str;
+  const unsigned char *block;
+  unsigned long long len;
+  int is_ref;
+  int is_signed;
+} AttrValue;
+
+/**
+ * This struct is one type DIE of the current compile unit
+*/
+typedef struct type_node {
+  unsigned long long off;
+  unsigned int tag;
+  int declaration;
+  int emitted;
+  int encoding;
+  const char *name;
+  long long size;              /* -1 when the DIE has no byte size */
+  unsigned long long type;     /* referenced type or NO_REF */
+  int first_member;            /* struct/union members, linked through next */
+  int last_member;
+  int first_dim;               /* array dimensions */
+  int num_dims;
+} TypeNode;
+
+/**
+ * This struct is one member of a struct or union
+*/
+typedef struct member {
+  unsigned long long off;      /* DIE offset, names anonymous members */
+  const char *name;
+  unsigned long long location;
+  unsigned long long type;
+  long long bit_size;
+  long long bit_offset;        /* DWARF 2/3 style, from the msb */
+  long long data_bit_offset;   /* DWARF 4+ style, from the start of the struct */
+  int next;
+} Member;
+
+/**
+ * This struct is one entry of the DIE parent stack
+*/
+typedef struct parent {
+  unsigned int tag;
+  int node;
+} Parent;
+
+/**
+ * This struct is the state of a conversion
+ * Everything per unit is reset between units, only the set of struct
+ * names already written grows with the input
+*/
+typedef struct dwarf_ctx {
+  Section info, abbrev, str, line_str, str_offsets;
+
+  /* current unit */
+  unsigned long long cu_off;
+  int version;
+  int offsize;
+  int addrsize;
+  unsigned long long str_offsets_base;
+  Abbrev *abbrevs;
+  int num_abbrevs;
+  int cap_abbrevs;
+  Abbrev **by_code;
+  unsigned long long max_code;
+
+  TypeNode *nodes;
+  int num_nodes;
+  int cap_nodes;
+  Member *members;
+  int num_members;
+  int cap_members;
+  long long *dims;
+  int num_dims;
+  int cap_dims;
+  Parent *stack;
+  int cap_stack;
+
+  /* names written so far, open addressing over pointers into the file */
+  const char **names;
+  unsigned int names_mask;
+  unsigned int num_names;
+
+  FILE *out;
+  int first;
+} DwarfCtx;
+
+/**
+ * ****************************************************
+ * READING
+ * ****************************************************
+*/
+
+static void dwarf_fail(const char *what) {
+  _die("dwarf_to_vtypes - Malformed debug info: %s", what);
+}
+
+static inline void need(Reader *r, unsigned long long n) {
+  if ((unsigned long long) (r->end - r->p) < n) {
+    dwarf_fail("read past the end of a section");
+  }
+}
+
+static inline unsigned long long read_n(Reader *r, int n) {
+  need(r, n);
+  unsigned long long v = 0;
+  for (int i = 0; i < n; i++) {
+    v |= (unsigned long long) r->p[i] << (8 * i);
+  }
+  r->p += n;
+  return v;
+}
+
+static inline unsigned long long read_uleb(Reader *r) {
+  unsigned long long v = 0;
+  int shift = 0;
+  for (;;) {
+    need(r, 1);
+    unsigned char b = *r->p++;
+    if (shift < 64) {
+      v |= (unsigned long long) (b & 0x7f) << shift;
+    }
+    shift += 7;
+    if (!(b & 0x80)) {
+      return v;
+    }
+  }
+}
+
+static inline long long read_sleb(Reader *r) {
+  long long v = 0;
+  int shift = 0;
+  unsigned char b;
+  do {
+    need(r, 1);
+    b = *r->p++;
+    if (shift < 64) {
+      v |= (long long) (b & 0x7f) << shift;
+    }
+    shift += 7;
+  } while (b & 0x80);
+  if (shift < 64 && (b & 0x40)) {
+    v |= -(1LL << shift);
+  }
+  return v;
+}
+
+static const char* section_str(const Section *s, unsigned long long off) {
+  if (!s->data || off >= s->size) {
+    return NULL;
+  }
+  return (const char *) s->data + off;
+}
+
+static const char* str_index(DwarfCtx *ctx, unsigned long long idx) {
+  unsigned long long pos = ctx->str_offsets_base + idx * ctx->offsize;
+  if (!ctx->str_offsets.data || pos + ctx->offsize > ctx->str_offsets.size) {
+    return NULL;
+  }
+  Reader r = { ctx->str_offsets.data + pos, ctx->str_offsets.data + ctx->str_offsets.size };
+  return section_str(&ctx->str, read_n(&r, ctx->offsize));
+}
+
+/**
+ * This function decodes one attribute value
+ * @params ctx - the conversion
+ * @params r - positioned at the value
+ * @params spec - the attribute's form
+ * @params v - filled in
+*/
+static void read_attr(DwarfCtx *ctx, Reader *r, const AttrSpec *spec, AttrValue *v) {
+  unsigned int form = spec->form;
+  memset(v, 0, sizeof(*v));
+
+  while (form == DW_FORM_indirect) {
+    form = read_uleb(r);
+  }
+
+  switch (form) {
+    case DW_FORM_addr: v->u = read_n(r, ctx->addrsize); break;
+    case DW_FORM_data1: case DW_FORM_flag: case DW_FORM_ref1: case DW_FORM_strx1: case DW_FORM_addrx1:
+      v->u = read_n(r, 1); break;
+    case DW_FORM_data2: case DW_FORM_ref2: case DW_FORM_strx2: case DW_FORM_addrx2:
+      v->u = read_n(r, 2); break;
+    case DW_FORM_strx3: case DW_FORM_addrx3:
+      v->u = read_n(r, 3); break;
+    case DW_FORM_data4: case DW_FORM_ref4: case DW_FORM_ref_sup4: case DW_FORM_strx4: case DW_FORM_addrx4:
+      v->u = read_n(r, 4); break;
+    case DW_FORM_data8: case DW_FORM_ref8: case DW_FORM_ref_sig8: case DW_FORM_ref_sup8:
+      v->u = read_n(r, 8); break;
+    case DW_FORM_data16: need(r, 16); r->p += 16; break;
+    case DW_FORM_sdata: v->s = read_sleb(r); v->u = v->s; v->is_signed = 1; break;
+    case DW_FORM_udata: case DW_FORM_ref_udata: case DW_FORM_strx: case DW_FORM_addrx:
+    case DW_FORM_loclistx: case DW_FORM_rnglistx: case DW_FORM_GNU_addr_index: case DW_FORM_GNU_str_index:
+      v->u = read_uleb(r); break;
+    case DW_FORM_strp: case DW_FORM_line_strp: case DW_FORM_sec_offset: case DW_FORM_strp_sup:
+    case DW_FORM_GNU_ref_alt: case DW_FORM_GNU_strp_alt:
+      v->u = read_n(r, ctx->offsize); break;
+    case DW_FORM_ref_addr: v->u = read_n(r, ctx->version == 2 ? ctx->addrsize : ctx->offsize); break;
+    case DW_FORM_string:
+      v->str = (const char *) r->p;
+      while (r->p < r->end && *r->p) r->p++;
+      need(r, 1);
+      r->p++;
+      break;
+    case DW_FORM_block1: v->len = read_n(r, 1); goto block;
+    case DW_FORM_block2: v->len = read_n(r, 2); goto block;
+    case DW_FORM_block4: v->len = read_n(r, 4); goto block;
+    case DW_FORM_block: case DW_FORM_exprloc: v->len = read_uleb(r);
+    block:
+      need(r, v->len);
+      v->block = r->p;
+      r->p += v->len;
+      break;
+    case DW_FORM_flag_present: v->u = 1; break;
+    case DW_FORM_implicit_const: v->s = spec->implicit; v->u = v->s; v->is_signed = 1; break;
+    default:
+      _die("dwarf_to_vtypes - Unknown attribute form: %#x", form);
+  }
+
+  switch (form) {
+    case DW_FORM_ref1: case DW_FORM_ref2: case DW_FORM_ref4: case DW_FORM_ref8: case DW_FORM_ref_udata:
+      v->u += ctx->cu_off;
+      v->is_ref = 1;
+      break;
+    case DW_FORM_ref_addr:
+      v->is_ref = 1;
+      break;
+    case DW_FORM_ref_sig8: case DW_FORM_ref_sup4: case DW_FORM_ref_sup8: case DW_FORM_GNU_ref_alt:
+      v->u = NO_REF; // type units and supplementary files are not followed
+      v->is_ref = 1;
+      break;
+    case DW_FORM_strp: v->str = section_str(&ctx->str, v->u); break;
+    case DW_FORM_line_strp: v->str = section_str(&ctx->line_str, v->u); break;
+    case DW_FORM_strx: case DW_FORM_strx1: case DW_FORM_strx2: case DW_FORM_strx3: case DW_FORM_strx4:
+    case DW_FORM_GNU_str_index:
+      v->str = str_index(ctx, v->u);
+      break;
+  }
+}
+
+/**
+ * This function parses the abbreviation table of a unit
+ * Codes are almost always dense, so they are looked up through an array
+*/
+static void read_abbrevs(DwarfCtx *ctx, unsigned long long offset) {
+  for (int i = 0; i < ctx->num_abbrevs; i++) {
+    free(ctx->abbrevs[i].attrs);
+  }
+  ctx->num_abbrevs = 0;
+  ctx->max_code = 0;
+  if (offset >= ctx->abbrev.size) {
+    dwarf_fail("abbrev offset out of range");
+  }
+
+  Reader r = { ctx->abbrev.data + offset, ctx->abbrev.data + ctx->abbrev.size };
+  for (;;) {
+    unsigned long long code = read_uleb(&r);
+    if (!code) {
+      break;
+    }
+    if (ctx->num_abbrevs == ctx->cap_abbrevs) {
+      ctx->cap_abbrevs = ctx->cap_abbrevs ? ctx->cap_abbrevs * 2 : 256;
+      ctx->abbrevs = realloc(ctx->abbrevs, ctx->cap_abbrevs * sizeof(Abbrev));
+    }
+    Abbrev *a = &ctx->abbrevs[ctx->num_abbrevs++];
+    a->code = code;
+    a->tag = read_uleb(&r);
+    a->children = read_n(&r, 1);
+    a->num_attrs = 0;
+    a->attrs = NULL;
+    int cap = 0;
+    for (;;) {
+      unsigned int name = read_uleb(&r);
+      unsigned int form = read_uleb(&r);
+      if (!name && !form) {
+        break;
+      }
+      if (a->num_attrs == cap) {
+        cap = cap ? cap * 2 : 8;
+        a->attrs = realloc(a->attrs, cap * sizeof(AttrSpec));
+      }
+      AttrSpec *spec = &a->attrs[a->num_attrs++];
+      spec->name = name;
+      spec->form = form;
+      spec->implicit = form == DW_FORM_implicit_const ? read_sleb(&r) : 0;
+    }
+    if (code > ctx->max_code) {
+      ctx->max_code = code;
+    }
+  }
+
+  if (ctx->max_code > (unsigned long long) ctx->num_abbrevs * 4 + 1024) {
+    dwarf_fail("abbrev codes too sparse");
+  }
+  free(ctx->by_code);
+  ctx->by_code = calloc(ctx->max_code + 1, sizeof(Abbrev *));
+  for (int i = 0; i < ctx->num_abbrevs; i++) {
+    ctx->by_code[ctx->abbrevs[i].code] = &ctx->abbrevs[i];
+  }
+}
+
+/**
+ * ****************************************************
+ * TYPE TABLE
+ * ****************************************************
+*/
+
+static int is_type_tag(unsigned int tag) {
+  switch (tag) {
+    case DW_TAG_array_type: case DW_TAG_class_type: case DW_TAG_enumeration_type:
+    case DW_TAG_pointer_type: case DW_TAG_reference_type: case DW_TAG_structure_type:
+    case DW_TAG_subroutine_type: case DW_TAG_typedef: case DW_TAG_union_type:
+    case DW_TAG_base_type: case DW_TAG_const_type: case DW_TAG_volatile_type:
+    case DW_TAG_restrict_type: case DW_TAG_atomic_type:
+      return 1;
+  }
+  return 0;
+}
+
+static int is_record(unsigned int tag) {
+  return tag == DW_TAG_structure_type || tag == DW_TAG_union_type || tag == DW_TAG_class_type;
+}
+
+/**
+ * This function finds a type of the current unit by DIE offset
+ * Nodes are appended in DIE order so the table is sorted
+ * @returns the node or NULL for types outside the unit
+*/
+static TypeNode* find_node(DwarfCtx *ctx, unsigned long long off) {
+  int lo = 0, hi = ctx->num_nodes - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (ctx->nodes[mid].off == off) {
+      return &ctx->nodes[mid];
+    }
+    if (ctx->nodes[mid].off < off) {
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return NULL;
+}
+
+static unsigned int name_hash(const char *name) {
+  unsigned int h = FNV_OFFSET;
+  for (; *name; name++) {
+    h ^= (unsigned char) *name;
+    h *= FNV_PRIME;
+  }
+  return h;
+}
+
+/**
+ * This function records a struct name as written
+ * @returns 1 if the name is new, 0 if a struct of that name was written already
+*/
+static int claim_name(DwarfCtx *ctx, const char *name) {
+  if ((ctx->num_names + 1) * 2 > ctx->names_mask + 1) {
+    unsigned int capacity = (ctx->names_mask + 1) * 2;
+    const char **names = calloc(capacity, sizeof(const char *));
+    for (unsigned int i = 0; i <= ctx->names_mask; i++) {
+      if (ctx->names[i]) {
+        unsigned int slot = name_hash(ctx->names[i]) & (capacity - 1);
+        while (names[slot]) {
+          slot = (slot + 1) & (capacity - 1);
+        }
+        names[slot] = ctx->names[i];
+      }
+    }
+    free(ctx->names);
+    ctx->names = names;
+    ctx->names_mask = capacity - 1;
+  }
+
+  unsigned int slot = name_hash(name) & ctx->names_mask;
+  while (ctx->names[slot]) {
+    if (strcmp(ctx->names[slot], name) == 0) {
+      return 0;
+    }
+    slot = (slot + 1) & ctx->names_mask;
+  }
+  ctx->names[slot] = name;
+  ctx->num_names += 1;
+  return 1;
+}
+
+/**
+ * ****************************************************
+ * WRITING
+ * ****************************************************
+*/
+
+/**
+ * This function maps a DWARF base type name to its vtype name, as dwarf.py does
+*/
+static const char* base_type_name(const TypeNode *node, char *buf, int buflen) {
+  static const char *map[][2] = {
+    { "_Bool", "unsigned char" },
+    { "long double", "double" },
+    { "long int", "long" },
+    { "long long int", "long long" },
+    { "long long unsigned int", "unsigned long long" },
+    { "long unsigned int", "unsigned long" },
+    { "short int", "short" },
+    { "short unsigned int", "unsigned short" },
+    { "sizetype", "unsigned long" },
+  };
+  if (node->name) {
+    for (unsigned int i = 0; i < sizeof(map) / sizeof(map[0]); i++) {
+      if (strcmp(node->name, map[i][0]) == 0) {
+        return map[i][1];
+      }
+    }
+    return node->name;
+  }
+
+  const char *sz = node->size == 8 ? "long long" : node->size == 4 ? "int" :
+    node->size == 2 ? "short" : "char";
+  int is_unsigned = node->encoding == DW_ATE_unsigned || node->encoding == DW_ATE_unsigned_char;
+  snprintf(buf, buflen, "%s%s", is_unsigned ? "unsigned " : "", sz);
+  return buf;
+}
+
+static void write_name(DwarfCtx *ctx, const TypeNode *node) {
+  if (node->name) {
+    fprintf(ctx->out, "\"%s\"", node->name);
+  } else {
+    fprintf(ctx->out, "\"__unnamed_%#llx\"", node->off);
+  }
+}
+
+static void write_struct(DwarfCtx *ctx, TypeNode *node);
+
+/**
+ * This function writes the vtype of a referenced type
+ * Qualifiers and typedefs are looked through, anonymous records the
+ * type refers to are queued to be written after the current struct
+*/
+static void write_type(DwarfCtx *ctx, unsigned long long off, int depth, int *pending, int *num_pending) {
+  TypeNode *node = off == NO_REF ? NULL : find_node(ctx, off);
+  if (!node || depth > MAX_TYPE_DEPTH) {
+    fputs("[\"void\"]", ctx->out);
+    return;
+  }
+
+  char buf[32];
+  switch (node->tag) {
+    case DW_TAG_base_type:
+      fprintf(ctx->out, "[\"%s\"]", base_type_name(node, buf, sizeof(buf)));
+      break;
+    case DW_TAG_pointer_type:
+    case DW_TAG_reference_type:
+      fputs("[\"pointer\", ", ctx->out);
+      write_type(ctx, node->type, depth + 1, pending, num_pending);
+      fputc(']', ctx->out);
+      break;
+    case DW_TAG_array_type:
+      for (int i = 0; i < node->num_dims; i++) {
+        fprintf(ctx->out, "[\"array\", %lld, ", ctx->dims[node->first_dim + i]);
+      }
+      write_type(ctx, node->type, depth + 1, pending, num_pending);
+      for (int i = 0; i < node->num_dims; i++) {
+        fputc(']', ctx->out);
+      }
+      break;
+    case DW_TAG_structure_type:
+    case DW_TAG_union_type:
+    case DW_TAG_class_type:
+      if (!node->name && !node->declaration && !node->emitted) {
+        node->emitted = 1;
+        pending[(*num_pending)++] = node - ctx->nodes;
+      }
+      /* fall through */
+    case DW_TAG_enumeration_type:
+      fputc('[', ctx->out);
+      write_name(ctx, node);
+      fputc(']', ctx->out);
+      break;
+    case DW_TAG_subroutine_type:
+      fputs("[\"void\"]", ctx->out);
+      break;
+    default: // typedef and qualifiers
+      write_type(ctx, node->type, depth + 1, pending, num_pending);
+      break;
+  }
+}
+
+/**
+ * This function returns the byte size of a type, looking through typedefs
+ * @returns the size or 0 if it is not known
+*/
+static long long type_size(DwarfCtx *ctx, unsigned long long off) {
+  for (int depth = 0; off != NO_REF && depth < MAX_TYPE_DEPTH; depth++) {
+    TypeNode *node = find_node(ctx, off);
+    if (!node) {
+      return 0;
+    }
+    if (node->size >= 0) {
+      return node->size;
+    }
+    off = node->type;
+  }
+  return 0;
+}
+
+/**
+ * This function writes one member, [offset, type]
+ * Bitfields are written as dwarf.py does, relative to their storage unit
+*/
+static void write_member(DwarfCtx *ctx, TypeNode *owner, Member *m, int *pending, int *num_pending) {
+  unsigned long long location = owner->tag == DW_TAG_union_type ? 0 : m->location;
+  if (m->name) {
+    fprintf(ctx->out, "\"%s\": ", m->name);
+  } else {
+    fprintf(ctx->out, "\"__unnamed_%#llx\": ", m->off);
+  }
+
+  if (m->bit_size > 0 && (m->bit_offset >= 0 || m->data_bit_offset >= 0)) {
+    long long unit = type_size(ctx, m->type);
+    long long start, end;
+    if (m->data_bit_offset >= 0) {
+      if (unit > 0) {
+        location = (m->data_bit_offset / (unit * 8)) * unit;
+      } else {
+        location = m->data_bit_offset / 8;
+      }
+      start = m->data_bit_offset - location * 8;
+    } else {
+      start = (unit ? unit : 1) * 8 - m->bit_offset - m->bit_size;
+    }
+    end = start + m->bit_size;
+    fprintf(ctx->out, "[%llu, [\"BitField\", {\"start_bit\": %lld, \"end_bit\": %lld}]]", location, start, end);
+    return;
+  }
+
+  fprintf(ctx->out, "[%llu, ", location);
+  write_type(ctx, m->type, 0, pending, num_pending);
+  fputc(']', ctx->out);
+}
+
+/**
+ * This function writes a struct and any anonymous records it refers to
+*/
+static void write_struct(DwarfCtx *ctx, TypeNode *node) {
+  int cap = 16;
+  int *pending = malloc(cap * sizeof(int));
+  int num_pending = 0;
+  pending[num_pending++] = node - ctx->nodes;
+
+  for (int i = 0; i < num_pending; i++) {
+    TypeNode *st = &ctx->nodes[pending[i]];
+    fputs(ctx->first ? "\n  " : ",\n  ", ctx->out);
+    ctx->first = 0;
+    write_name(ctx, st);
+    fprintf(ctx->out, ": [%lld, {", st->size);
+
+    for (int m = st->first_member; m != -1; m = ctx->members[m].next) {
+      // each member can queue at most one anonymous record per array level
+      if (num_pending + MAX_TYPE_DEPTH + 1 > cap) {
+        cap = cap * 2 + MAX_TYPE_DEPTH;
+        pending = realloc(pending, cap * sizeof(int));
+      }
+      write_member(ctx, st, &ctx->members[m], pending, &num_pending);
+      if (ctx->members[m].next != -1) {
+        fputs(", ", ctx->out);
+      }
+    }
+    fputs("}]", ctx->out);
+  }
+  free(pending);
+}
+
+/**
+ * This function writes every named struct of the unit that has not been
+ * written by an earlier unit
+*/
+static void flush_unit(DwarfCtx *ctx) {
+  for (int i = 0; i < ctx->num_nodes; i++) {
+    TypeNode *node = &ctx->nodes[i];
+    if (is_record(node->tag) && node->name && !node->declaration && !node->emitted &&
+        node->size >= 0 && claim_name(ctx, node->name)) {
+      node->emitted = 1;
+      write_struct(ctx, node);
+    }
+  }
+}
+
+/**
+ * ****************************************************
+ * UNITS
+ * ****************************************************
+*/
+
+static TypeNode* add_node(DwarfCtx *ctx) {
+  if (ctx->num_nodes == ctx->cap_nodes) {
+    ctx->cap_nodes = ctx->cap_nodes ? ctx->cap_nodes * 2 : 4096;
+    ctx->nodes = realloc(ctx->nodes, ctx->cap_nodes * sizeof(TypeNode));
+  }
+  TypeNode *node = &ctx->nodes[ctx->num_nodes++];
+  memset(node, 0, sizeof(*node));
+  node->size = -1;
+  node->type = NO_REF;
+  node->first_member = -1;
+  node->last_member = -1;
+  return node;
+}
+
+static Member* add_member(DwarfCtx *ctx, TypeNode *owner) {
+  if (ctx->num_members == ctx->cap_members) {
+    ctx->cap_members = ctx->cap_members ? ctx->cap_members * 2 : 4096;
+    ctx->members = realloc(ctx->members, ctx->cap_members * sizeof(Member));
+  }
+  int idx = ctx->num_members++;
+  Member *m = &ctx->members[idx];
+  memset(m, 0, sizeof(*m));
+  m->type = NO_REF;
+  m->bit_offset = -1;
+  m->data_bit_offset = -1;
+  m->next = -1;
+  if (owner->last_member == -1) {
+    owner->first_member = idx;
+  } else {
+    ctx->members[owner->last_member].next = idx;
+  }
+  owner->last_member = idx;
+  return m;
+}
+
+static void add_dim(DwarfCtx *ctx, TypeNode *array, long long count) {
+  if (ctx->num_dims == ctx->cap_dims) {
+    ctx->cap_dims = ctx->cap_dims ? ctx->cap_dims * 2 : 1024;
+    ctx->dims = realloc(ctx->dims, ctx->cap_dims * sizeof(long long));
+  }
+  if (!array->num_dims) {
+    array->first_dim = ctx->num_dims;
+  }
+  ctx->dims[ctx->num_dims++] = count;
+  array->num_dims += 1;
+}
+
+/**
+ * This function reads a data_member_location, either a constant or a
+ * DW_OP_plus_uconst expression
+*/
+static unsigned long long member_location(const AttrValue *v) {
+  if (!v->block) {
+    return v->u;
+  }
+  Reader r = { v->block, v->block + v->len };
+  if (v->len && *r.p == DW_OP_plus_uconst) {
+    r.p++;
+    return read_uleb(&r);
+  }
+  return 0;
+}
+
+/**
+ * This function reads every DIE of one unit into the type table
+ * Only types, their members and array bounds are kept
+ * @params ctx - the conversion
+ * @params r - positioned at the first DIE of the unit
+*/
+static void read_dies(DwarfCtx *ctx, Reader *r) {
+  int depth = 0;
+  while (r->p < r->end) {
+    unsigned long long die_off = r->p - ctx->info.data;
+    unsigned long long code = read_uleb(r);
+    if (!code) {
+      if (--depth < 0) {
+        depth = 0; // padding after the unit's last DIE
+      }
+      continue;
+    }
+    if (code > ctx->max_code || !ctx->by_code[code]) {
+      dwarf_fail("unknown abbrev code");
+    }
+    Abbrev *a = ctx->by_code[code];
+
+    Parent *parent = depth ? &ctx->stack[depth - 1] : NULL;
+    TypeNode *node = NULL;
+    Member *member = NULL;
+    int subrange = 0;
+    long long count = 0;
+    int has_count = 0;
+    if (is_type_tag(a->tag)) {
+      node = add_node(ctx);
+      node->off = die_off;
+      node->tag = a->tag;
+    } else if (a->tag == DW_TAG_member && parent && parent->node != -1 &&
+               is_record(ctx->nodes[parent->node].tag)) {
+      member = add_member(ctx, &ctx->nodes[parent->node]);
+      member->off = die_off;
+    } else if (a->tag == DW_TAG_subrange_type && parent && parent->node != -1 &&
+               ctx->nodes[parent->node].tag == DW_TAG_array_type) {
+      subrange = 1;
+    }
+
+    for (int i = 0; i < a->num_attrs; i++) {
+      AttrValue v;
+      read_attr(ctx, r, &a->attrs[i], &v);
+      if (node) {
+        switch (a->attrs[i].name) {
+          case DW_AT_name: node->name = v.str; break;
+          case DW_AT_byte_size: if (!v.block) node->size = v.u; break;
+          case DW_AT_type: node->type = v.u; break;
+          case DW_AT_declaration: node->declaration = v.u != 0; break;
+          case DW_AT_encoding: node->encoding = v.u; break;
+        }
+      } else if (member) {
+        switch (a->attrs[i].name) {
+          case DW_AT_name: member->name = v.str; break;
+          case DW_AT_type: member->type = v.u; break;
+          case DW_AT_data_member_location: member->location = member_location(&v); break;
+          case DW_AT_bit_size: member->bit_size = v.u; break;
+          case DW_AT_bit_offset: member->bit_offset = v.u; break;
+          case DW_AT_data_bit_offset: member->data_bit_offset = v.u; break;
+        }
+      } else if (subrange) {
+        switch (a->attrs[i].name) {
+          case DW_AT_count:
+            if (!v.block && !v.is_ref) { count = v.u; has_count = 1; }
+            break;
+          case DW_AT_upper_bound:
+            if (!v.block && !v.is_ref && !has_count) {
+              count = (v.is_signed && v.s < 0) ? 0 : (long long) v.u + 1;
+              has_count = 1;
+            }
+            break;
+        }
+      } else if ((a->tag == DW_TAG_compile_unit || a->tag == DW_TAG_partial_unit) &&
+                 a->attrs[i].name == DW_AT_str_offsets_base) {
+        ctx->str_offsets_base = v.u;
+      }
+    }
+
+    if (subrange) {
+      add_dim(ctx, &ctx->nodes[parent->node], has_count ? count : 0);
+    }
+
+    if (a->children) {
+      if (depth == ctx->cap_stack) {
+        ctx->cap_stack = ctx->cap_stack ? ctx->cap_stack * 2 : 64;
+        ctx->stack = realloc(ctx->stack, ctx->cap_stack * sizeof(Parent));
+      }
+      ctx->stack[depth].tag = a->tag;
+      ctx->stack[depth].node = node ? node - ctx->nodes : -1;
+      depth += 1;
+    }
+  }
+}
+
+/**
+ * This function converts every unit of .debug_info, one at a time
+*/
+static void read_units(DwarfCtx *ctx) {
+  Reader r = { ctx->info.data, ctx->info.data + ctx->info.size };
+  while (r.p < r.end) {
+    ctx->cu_off = r.p - ctx->info.data;
+    unsigned long long length = read_n(&r, 4);
+    ctx->offsize = 4;
+    if (length == 0xffffffff) {
+      length = read_n(&r, 8);
+      ctx->offsize = 8;
+    }
+    need(&r, length);
+    const unsigned char *unit_end = r.p + length;
+    Reader unit = { r.p, unit_end };
+    r.p = unit_end;
+
+    ctx->version = read_n(&unit, 2);
+    unsigned long long abbrev_off;
+    if (ctx->version >= 5) {
+      int unit_type = read_n(&unit, 1);
+      ctx->addrsize = read_n(&unit, 1);
+      abbrev_off = read_n(&unit, ctx->offsize);
+      if (unit_type != DW_UT_compile && unit_type != DW_UT_partial) {
+        continue; // type and split units
+      }
+    } else if (ctx->version >= 2) {
+      abbrev_off = read_n(&unit, ctx->offsize);
+      ctx->addrsize = read_n(&unit, 1);
+    } else {
+      _die("dwarf_to_vtypes - Unsupported DWARF version %d", ctx->version);
+    }
+
+    ctx->str_offsets_base = ctx->offsize == 8 ? 16 : 8;
+    ctx->num_nodes = 0;
+    ctx->num_members = 0;
+    ctx->num_dims = 0;
+    read_abbrevs(ctx, abbrev_off);
+    read_dies(ctx, &unit);
+    flush_unit(ctx);
+  }
+}
+
+/**
+ * ****************************************************
+ * ELF
+ * ****************************************************
+*/
+
+/**
+ * This function applies the RELA relocations of a debug section in a
+ * relocatable object (kernel modules), section offsets are resolved against
+ * section symbols whose value is 0
+*/
+static void apply_relocations(unsigned char *base, const Elf64_Shdr *shdrs, const Elf64_Shdr *rela, unsigned char *target, unsigned long long target_size) {
+  const Elf64_Shdr *symtab = &shdrs[rela->sh_link];
+  const Elf64_Sym *syms = (const Elf64_Sym *) (base + symtab->sh_offset);
+  unsigned long long num_syms = symtab->sh_size / sizeof(Elf64_Sym);
+  const Elf64_Rela *rels = (const Elf64_Rela *) (base + rela->sh_offset);
+  unsigned long long count = rela->sh_size / sizeof(Elf64_Rela);
+
+  for (unsigned long long i = 0; i < count; i++) {
+    unsigned long long sym = ELF64_R_SYM(rels[i].r_info);
+    unsigned long long value = (sym < num_syms ? syms[sym].st_value : 0) + rels[i].r_addend;
+    unsigned long long off = rels[i].r_offset;
+    switch (ELF64_R_TYPE(rels[i].r_info)) {
+      case R_X86_64_32:
+      case R_X86_64_32S:
+        if (off + 4 <= target_size) {
+          unsigned int v = value;
+          memcpy(target + off, &v, 4);
+        }
+        break;
+      case R_X86_64_64:
+        if (off + 8 <= target_size) {
+          memcpy(target + off, &value, 8);
+        }
+        break;
+    }
+  }
+}
+
+/**
+ * This function finds the debug sections of an ELF file
+ * The file is mapped copy on write so module relocations can be applied in place
+*/
+static void read_elf(DwarfCtx *ctx, unsigned char *base, unsigned long long size) {
+  if (size < sizeof(Elf64_Ehdr) || memcmp(base, ELFMAG, SELFMAG) != 0) {
+    _die("dwarf_to_vtypes - Not an ELF file");
+  }
+  const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *) base;
+  if (ehdr->e_ident[EI_CLASS] != ELFCLASS64 || ehdr->e_ident[EI_DATA] != ELFDATA2LSB) {
+    _die("dwarf_to_vtypes - Only little endian ELF64 is supported");
+  }
+  if (ehdr->e_shoff + (unsigned long long) ehdr->e_shnum * sizeof(Elf64_Shdr) > size) {
+    _die("dwarf_to_vtypes - Truncated section headers");
+  }
+
+  const Elf64_Shdr *shdrs = (const Elf64_Shdr *) (base + ehdr->e_shoff);
+  const char *names = (const char *) base + shdrs[ehdr->e_shstrndx].sh_offset;
+  struct { const char *name; Section *section; } wanted[] = {
+    { ".debug_info", &ctx->info },
+    { ".debug_abbrev", &ctx->abbrev },
+    { ".debug_str", &ctx->str },
+    { ".debug_line_str", &ctx->line_str },
+    { ".debug_str_offsets", &ctx->str_offsets },
+  };
+
+  for (int i = 0; i < ehdr->e_shnum; i++) {
+    for (unsigned int w = 0; w < sizeof(wanted) / sizeof(wanted[0]); w++) {
+      if (strcmp(names + shdrs[i].sh_name, wanted[w].name) != 0) {
+        continue;
+      }
+      if (shdrs[i].sh_flags & SHF_COMPRESSED) {
+        _die("dwarf_to_vtypes - %s is compressed, run objcopy --decompress-debug-sections first", wanted[w].name);
+      }
+      if (shdrs[i].sh_offset + shdrs[i].sh_size > size) {
+        _die("dwarf_to_vtypes - Truncated section %s", wanted[w].name);
+      }
+      wanted[w].section->data = base + shdrs[i].sh_offset;
+      wanted[w].section->size = shdrs[i].sh_size;
+    }
+  }
+
+  if (ehdr->e_type == ET_REL) {
+    for (int i = 0; i < ehdr->e_shnum; i++) {
+      if (shdrs[i].sh_type != SHT_RELA || shdrs[i].sh_info >= ehdr->e_shnum) {
+        continue;
+      }
+      const Elf64_Shdr *target = &shdrs[shdrs[i].sh_info];
+      const char *target_name = names + target->sh_name;
+      if (strcmp(target_name, ".debug_info") == 0 || strcmp(target_name, ".debug_str_offsets") == 0) {
+        apply_relocations(base, shdrs, &shdrs[i], base + target->sh_offset, target->sh_size);
+      }
+    }
+  }
+
+  if (!ctx->info.data || !ctx->abbrev.data) {
+    _die("dwarf_to_vtypes - No DWARF debug info, was the kernel built with CONFIG_DEBUG_INFO?");
+  }
+}
+
+/**
+ * This function converts the DWARF of a vmlinux or module to vtypes json
+ * Units are streamed one at a time, only the types of the current unit are
+ * held in memory, and a struct is written the first time its name is seen
+ * The output has the "all_vtypes" layout dwarf.py produces
+ * @params filename - the ELF file with debug info
+ * @params out - where the json is written
+ * @returns the number of structs written
+*/
+int dwarf_to_vtypes(const char *filename, FILE *out) {
+  DwarfCtx ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.out = out;
+  ctx.first = 1;
+  ctx.names_mask = 1023;
+  ctx.names = calloc(ctx.names_mask + 1, sizeof(const char *));
+
+  int fd = open_file(filename);
+  unsigned long long size = get_file_length(fd);
+  unsigned char *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (base == MAP_FAILED) {
+    _die("dwarf_to_vtypes - Unable to map %s", filename);
+  }
+  close(fd);
+  madvise(base, size, MADV_SEQUENTIAL);
+
+  read_elf(&ctx, base, size);
+  fputs("{\"all_vtypes\": {", out);
+  read_units(&ctx);
+  fputs("\n}}\n", out);
+
+  for (int i = 0; i < ctx.num_abbrevs; i++) {
+    free(ctx.abbrevs[i].attrs);
+  }
+  free(ctx.abbrevs);
+  free(ctx.by_code);
+  free(ctx.nodes);
+  free(ctx.members);
+  free(ctx.dims);
+  free(ctx.stack);
+  free(ctx.names);
+  munmap(base, size);
+  _debug("DEBUG: wrote %u structs", ctx.num_names);
+  return ctx.num_names;
+}
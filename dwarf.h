@@ -0,0 +1,101 @@
+#ifndef _DWARF_H
+#define _DWARF_H
+
+#include <stdio.h>
+
+/* DWARF tags the converter understands */
+#define DW_TAG_array_type        0x01
+#define DW_TAG_class_type        0x02
+#define DW_TAG_enumeration_type  0x04
+#define DW_TAG_member            0x0d
+#define DW_TAG_pointer_type      0x0f
+#define DW_TAG_reference_type    0x10
+#define DW_TAG_compile_unit      0x11
+#define DW_TAG_structure_type    0x13
+#define DW_TAG_subroutine_type   0x15
+#define DW_TAG_typedef           0x16
+#define DW_TAG_union_type        0x17
+#define DW_TAG_subrange_type     0x21
+#define DW_TAG_base_type         0x24
+#define DW_TAG_const_type        0x26
+#define DW_TAG_volatile_type     0x35
+#define DW_TAG_restrict_type     0x37
+#define DW_TAG_partial_unit      0x3c
+#define DW_TAG_atomic_type       0x47
+
+/* DWARF attributes the converter reads */
+#define DW_AT_name                  0x03
+#define DW_AT_byte_size             0x0b
+#define DW_AT_bit_offset            0x0c
+#define DW_AT_bit_size              0x0d
+#define DW_AT_upper_bound           0x2f
+#define DW_AT_count                 0x37
+#define DW_AT_data_member_location  0x38
+#define DW_AT_declaration           0x3c
+#define DW_AT_encoding              0x3e
+#define DW_AT_type                  0x49
+#define DW_AT_data_bit_offset       0x6b
+#define DW_AT_str_offsets_base      0x72
+
+/* DWARF attribute forms */
+#define DW_FORM_addr            0x01
+#define DW_FORM_block2          0x03
+#define DW_FORM_block4          0x04
+#define DW_FORM_data2           0x05
+#define DW_FORM_data4           0x06
+#define DW_FORM_data8           0x07
+#define DW_FORM_string          0x08
+#define DW_FORM_block           0x09
+#define DW_FORM_block1          0x0a
+#define DW_FORM_data1           0x0b
+#define DW_FORM_flag            0x0c
+#define DW_FORM_sdata           0x0d
+#define DW_FORM_strp            0x0e
+#define DW_FORM_udata           0x0f
+#define DW_FORM_ref_addr        0x10
+#define DW_FORM_ref1            0x11
+#define DW_FORM_ref2            0x12
+#define DW_FORM_ref4            0x13
+#define DW_FORM_ref8            0x14
+#define DW_FORM_ref_udata       0x15
+#define DW_FORM_indirect        0x16
+#define DW_FORM_sec_offset      0x17
+#define DW_FORM_exprloc         0x18
+#define DW_FORM_flag_present    0x19
+#define DW_FORM_strx            0x1a
+#define DW_FORM_addrx           0x1b
+#define DW_FORM_ref_sup4        0x1c
+#define DW_FORM_strp_sup        0x1d
+#define DW_FORM_data16          0x1e
+#define DW_FORM_line_strp       0x1f
+#define DW_FORM_ref_sig8        0x20
+#define DW_FORM_implicit_const  0x21
+#define DW_FORM_loclistx        0x22
+#define DW_FORM_rnglistx        0x23
+#define DW_FORM_ref_sup8        0x24
+#define DW_FORM_strx1           0x25
+#define DW_FORM_strx2           0x26
+#define DW_FORM_strx3           0x27
+#define DW_FORM_strx4           0x28
+#define DW_FORM_addrx1          0x29
+#define DW_FORM_addrx2          0x2a
+#define DW_FORM_addrx3          0x2b
+#define DW_FORM_addrx4          0x2c
+#define DW_FORM_GNU_addr_index  0x1f01
+#define DW_FORM_GNU_str_index   0x1f02
+#define DW_FORM_GNU_ref_alt     0x1f20
+#define DW_FORM_GNU_strp_alt    0x1f21
+
+#define DW_ATE_signed         0x05
+#define DW_ATE_signed_char    0x06
+#define DW_ATE_unsigned       0x07
+#define DW_ATE_unsigned_char  0x08
+
+#define DW_OP_plus_uconst 0x23
+
+#define DW_UT_compile  0x01
+#define DW_UT_partial  0x03
+
+int dwarf_to_vtypes(const char *filename, FILE *out);
+
+#endif
@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "util.h"
+#include "dwarf.h"
+
+/* output is written in large blocks, the json for a kernel is tens of MB */
+#define OUT_BUFFER_SIZE (1 << 20)
+
+/**
+ * This program converts the DWARF of a vmlinux or module into the vtypes
+ * json the analyser loads with -p
+ *
+ * usage:
+ *   ./dwarf2json -i /PathTo/vmlinux [-o profile.json]
+*/
+int main(int argc, char** argv) {
+  char* in_filename = NULL;
+  char* out_filename = NULL;
+  int opt = 0;
+
+  while((opt = getopt (argc, argv, "i:o:"))!= -1) {
+    switch(opt) {
+      case 'i':
+        in_filename = optarg;
+        break;
+      case 'o':
+        out_filename = optarg;
+        break;
+      case ':': /* Fall through is intentional */
+      case '?': /* Fall through is intentional */
+      default:
+        printf("Invalid options or missing argument: '-%c'.\n",
+            opt);
+        break;
+    }
+  }
+
+  if (!in_filename) {
+    _die("Did not pass an ELF file\nUsage: ./dwarf2json -i /path/to/vmlinux [-o profile.json]\n");
+  }
+
+  FILE *out = stdout;
+  if (out_filename) {
+    out = fopen(out_filename, "w");
+    if (!out) {
+      _die("Could not open file: %s", out_filename);
+    }
+  }
+  char *buf = malloc(OUT_BUFFER_SIZE);
+  setvbuf(out, buf, _IOFBF, OUT_BUFFER_SIZE);
+
+  dwarf_to_vtypes(in_filename, out);
+
+  if (fclose(out) != 0) {
+    _die("Could not write profile");
+  }
+  free(buf);
+  return 0;
+}
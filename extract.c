@@ -0,0 +1,352 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <elf.h>
+#include <sys/sendfile.h>
+
+#include "util.h"
+#include "dump.h"
+#include "vtop.h"
+#include "vma.h"
+#include "extract.h"
+#include "stats.h"
+
+/* how far the in kernel copies got, shared by every extraction */
+#define COPY_RANGE 0
+#define COPY_SENDFILE 1
+#define COPY_USER 2
+static int copy_mode = COPY_RANGE;
+
+/**
+ * This function adds a run of resident pages to the extents, growing the
+ * last one when the run continues it in the process and in the dump file
+ * @params end_offset - file offset just past the last extent, updated
+*/
+static void add_extent(ExtractExtent **extents, int *count, int *capacity, long long *end_offset, int vma,
+    unsigned long long vaddr, unsigned long long paddr, unsigned long long len, long long offset) {
+  ExtractExtent *last = *count ? &(*extents)[*count - 1] : NULL;
+  if (last && last->vma == vma && last->vaddr + last->len == vaddr &&
+      last->paddr + last->len == paddr && *end_offset == offset) {
+    last->len += len;
+  } else {
+    if (*count == *capacity) {
+      *capacity = *capacity ? *capacity * 2 : 256;
+      *extents = realloc(*extents, sizeof(ExtractExtent) * *capacity);
+      if (!*extents) {
+        _die("extract - Unable to grow extents to %d entries", *capacity);
+      }
+    }
+    ExtractExtent *e = &(*extents)[*count];
+    e->vaddr = vaddr;
+    e->paddr = paddr;
+    e->len = len;
+    e->vma = vma;
+    *count += 1;
+  }
+  *end_offset = offset + len;
+}
+
+/**
+ * This function finds the resident pages of a process
+ * Each VMA is stepped through in address order by what the translator says
+ * the answer holds for: an absent PGD, PUD or PMD entry skips everything it
+ * would have mapped, so reserved but untouched memory costs one walk per
+ * absent entry, and a 2 MB or 1 GB page is taken whole
+ * @params dump - the opened dump
+ * @params map - the process's memory map
+ * @params la57 - walk 5-level page tables
+ * @params count - set to the number of extents
+ * @returns the extents in address order, NULL if there are none
+*/
+static ExtractExtent* find_extents(Dump *dump, MmMap *map, int la57, int *count) {
+  Translator *t = vtop_create(dump, map->pgd, la57);
+  ExtractExtent *extents = NULL;
+  int capacity = 0;
+  *count = 0;
+
+  for (int i = 0; i < map->count; i++) {
+    Vma *v = &map->vmas[i];
+    long long end_offset = -1;
+    unsigned long long next;
+    for (unsigned long long vaddr = v->start; vaddr < v->end; vaddr = next) {
+      unsigned long long paddr, flags, span;
+      int err = vtop_translate_span(t, vaddr, &paddr, &flags, &span);
+      next = (vaddr & ~(span - 1)) + span;
+      if (next > v->end || next <= vaddr) {
+        next = v->end;
+      }
+      if (err != VTOP_OK) {
+        continue;
+      }
+
+      /* the whole page in one go while it is in one block of the dump */
+      unsigned long long len = next - vaddr;
+      long long offset = dump_paddr_to_offset(dump, paddr);
+      if (offset != -1 && dump_paddr_to_offset(dump, paddr + len - 1) == offset + (long long) len - 1) {
+        add_extent(&extents, count, &capacity, &end_offset, i, vaddr, paddr, len, offset);
+        continue;
+      }
+      for (unsigned long long p = 0; p < len; p += PAGE_SIZE) {
+        offset = dump_paddr_to_offset(dump, paddr + p);
+        if (offset == -1) {
+          continue; // resident, but not captured
+        }
+        add_extent(&extents, count, &capacity, &end_offset, i, vaddr + p, paddr + p, PAGE_SIZE, offset);
+      }
+    }
+  }
+  vtop_free(t);
+  return extents;
+}
+
+/**
+ * This function tells whether an extent starts a new segment, i.e. does not
+ * continue the previous one in the process
+*/
+static int starts_segment(ExtractExtent *extents, int i) {
+  return !i || extents[i - 1].vma != extents[i].vma || extents[i - 1].vaddr + extents[i - 1].len != extents[i].vaddr;
+}
+
+/**
+ * This function copies part of the dump to the output
+ * The copy stays in the kernel through copy_file_range, or sendfile where
+ * the two files are on different filesystems; pages only go through a
+ * buffer if neither works or the dump is compressed
+ * @params dump - the opened dump
+ * @params out - the output file
+ * @params paddr - physical address of the first byte, all in one lime block
+ * @params length - number of bytes
+ * @params out_offset - where to write them
+ * @params buf - EXTRACT_COPY_BUF bytes of scratch space
+*/
+static void copy_extent(Dump *dump, int out, unsigned long long paddr, unsigned long long length,
+  unsigned long long out_offset, unsigned char *buf) {
+  STATS_ADD(dump_bytes, length);
+  STATS_ADD(bytes_written, length);
+  loff_t in_off = dump->cdump ? 0 : dump_paddr_to_offset(dump, paddr);
+  loff_t out_off = out_offset;
+
+  while (length && !dump->cdump && copy_mode == COPY_RANGE) {
+    ssize_t n = copy_file_range(dump->fd, &in_off, out, &out_off, length, 0);
+    STATS_ADD(syscalls, 1);
+    if (n > 0) {
+      length -= n;
+    } else if (n == -1 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+      _debug("DEBUG: copy_file_range unavailable (%s), using sendfile", strerror(errno));
+      copy_mode = COPY_SENDFILE;
+    } else {
+      _die("extract - copy_file_range failed at offset %lld", (long long) in_off);
+    }
+  }
+
+  if (length && !dump->cdump && copy_mode == COPY_SENDFILE) {
+    if (lseek(out, out_off, SEEK_SET) == -1) {
+      _die("extract - Unable to seek output to %lld", (long long) out_off);
+    }
+    STATS_ADD(syscalls, 1);
+    while (length) {
+      ssize_t n = sendfile(out, dump->fd, &in_off, length);
+      STATS_ADD(syscalls, 1);
+      if (n > 0) {
+        length -= n;
+        out_off += n;
+      } else if (n == -1 && (errno == EINVAL || errno == ENOSYS)) {
+        _debug("DEBUG: sendfile unavailable (%s), copying through a buffer", strerror(errno));
+        copy_mode = COPY_USER;
+        break;
+      } else {
+        _die("extract - sendfile failed at offset %lld", (long long) in_off);
+      }
+    }
+  }
+
+  paddr += out_off - out_offset;
+  while (length) {
+    unsigned long long n = length < EXTRACT_COPY_BUF ? length : EXTRACT_COPY_BUF;
+    if (dump_read(dump, paddr, buf, n) == -1) {
+      _die("extract - Unable to read %llu bytes at %llx", n, paddr);
+    }
+    if (pwrite(out, buf, n, out_off) != (ssize_t) n) {
+      _die("extract - Unable to write %llu bytes at %lld", n, (long long) out_off);
+    }
+    STATS_ADD(syscalls, 1);
+    paddr += n;
+    out_off += n;
+    length -= n;
+  }
+}
+
+/**
+ * This function writes the ELF headers of the core
+ * @returns the offset the page data starts at
+*/
+static unsigned long long write_elf_headers(int out, MmMap *map, ExtractExtent *extents, int count,
+  int segments, int pid, const char *comm) {
+  int phnum = segments + 1; // the PT_NOTE first
+  unsigned long long note_size = sizeof(Elf64_Nhdr) + 8 + sizeof(ExtractPrpsinfo);
+  unsigned long long headers = sizeof(Elf64_Ehdr) + sizeof(Elf64_Shdr) + phnum * sizeof(Elf64_Phdr) + note_size;
+  unsigned long long data = (headers + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+  unsigned char *hdr = calloc(1, headers);
+
+  Elf64_Ehdr *eh = (Elf64_Ehdr *) hdr;
+  memcpy(eh->e_ident, ELFMAG, SELFMAG);
+  eh->e_ident[EI_CLASS] = ELFCLASS64;
+  eh->e_ident[EI_DATA] = ELFDATA2LSB;
+  eh->e_ident[EI_VERSION] = EV_CURRENT;
+  eh->e_ident[EI_OSABI] = ELFOSABI_NONE;
+  eh->e_type = ET_CORE;
+  eh->e_machine = EM_X86_64;
+  eh->e_version = EV_CURRENT;
+  eh->e_ehsize = sizeof(Elf64_Ehdr);
+  eh->e_phentsize = sizeof(Elf64_Phdr);
+  eh->e_phoff = sizeof(Elf64_Ehdr) + sizeof(Elf64_Shdr);
+  eh->e_phnum = phnum < PN_XNUM ? phnum : PN_XNUM;
+  if (phnum >= PN_XNUM) {
+    // the real count goes in the first section header, as the kernel's cores do
+    Elf64_Shdr *sh = (Elf64_Shdr *) (hdr + sizeof(Elf64_Ehdr));
+    eh->e_shoff = sizeof(Elf64_Ehdr);
+    eh->e_shentsize = sizeof(Elf64_Shdr);
+    eh->e_shnum = 1;
+    sh->sh_info = phnum;
+  }
+
+  Elf64_Phdr *ph = (Elf64_Phdr *) (hdr + eh->e_phoff);
+  unsigned long long note_offset = eh->e_phoff + phnum * sizeof(Elf64_Phdr);
+  ph->p_type = PT_NOTE;
+  ph->p_offset = note_offset;
+  ph->p_filesz = note_size;
+  ph->p_align = 4;
+
+  Elf64_Nhdr *nh = (Elf64_Nhdr *) (hdr + note_offset);
+  nh->n_namesz = 5;
+  nh->n_descsz = sizeof(ExtractPrpsinfo);
+  nh->n_type = NT_PRPSINFO;
+  memcpy(hdr + note_offset + sizeof(Elf64_Nhdr), "CORE", 5);
+  ExtractPrpsinfo *info = (ExtractPrpsinfo *) (hdr + note_offset + sizeof(Elf64_Nhdr) + 8);
+  info->sname = 'R';
+  info->pid = pid;
+  snprintf(info->fname, sizeof(info->fname), "%s", comm);
+  snprintf(info->psargs, sizeof(info->psargs), "%s", comm);
+
+  unsigned long long offset = data;
+  for (int i = 0; i < count; i++) {
+    if (starts_segment(extents, i)) {
+      Vma *v = &map->vmas[extents[i].vma];
+      ph += 1;
+      ph->p_type = PT_LOAD;
+      ph->p_flags = (v->flags & VMA_READ ? PF_R : 0) | (v->flags & VMA_WRITE ? PF_W : 0) | (v->flags & VMA_EXEC ? PF_X : 0);
+      ph->p_offset = offset;
+      ph->p_vaddr = extents[i].vaddr;
+      ph->p_align = PAGE_SIZE;
+    }
+    ph->p_filesz += extents[i].len;
+    ph->p_memsz += extents[i].len;
+    offset += extents[i].len;
+  }
+
+  if (pwrite(out, hdr, headers, 0) != (ssize_t) headers) {
+    _die("extract - Unable to write the ELF headers");
+  }
+  STATS_ADD(syscalls, 1);
+  STATS_ADD(bytes_written, headers);
+  free(hdr);
+  return data;
+}
+
+/**
+ * This function writes <filename>.map, one line per segment of the raw output
+ * @returns 0 or -1 if the map cannot be written
+*/
+static int write_raw_map(const char *filename, VmaMaps *maps, MmMap *map, ExtractExtent *extents, int count) {
+  char map_filename[4096];
+  snprintf(map_filename, sizeof(map_filename), "%s.map", filename);
+  FILE *f = fopen(map_filename, "w");
+  if (!f) {
+    return -1;
+  }
+  fprintf(f, "# start-end perms offset pgoff name, offset is where the pages are in %s\n", filename);
+  unsigned long long offset = 0;
+  for (int i = 0; i < count; i++) {
+    int end = i + 1;
+    unsigned long long len = extents[i].len;
+    while (end < count && !starts_segment(extents, end)) {
+      len += extents[end++].len;
+    }
+    Vma *v = &map->vmas[extents[i].vma];
+    char flags[5];
+    vma_flags_string(v->flags, flags);
+    fprintf(f, "%016llx-%016llx %s %012llx %08llx %s\n", extents[i].vaddr, extents[i].vaddr + len, flags, offset,
+      (v->pgoff << PAGE_SHIFT) + extents[i].vaddr - v->start, v->name == -1 ? "" : maps->names[v->name]);
+    offset += len;
+    i = end - 1;
+  }
+  STATS_ADD(syscalls, 3);
+  return fclose(f);
+}
+
+/**
+ * This function writes the resident pages of one process to a file
+ * Pages that are swapped out, never touched or outside the dump are left
+ * out, the ELF segments (or map lines) say where the written ones go
+ * @params dump - the opened dump
+ * @params maps - the collected memory maps, for backing file names
+ * @params map - the memory map of the process, map->pgd must be known
+ * @params la57 - walk 5-level page tables
+ * @params pid - recorded in the core
+ * @params comm - recorded in the core
+ * @params format - EXTRACT_ELF or EXTRACT_RAW
+ * @params filename - the output file, created or truncated
+ * @params result - filled with what was written
+ * @returns 0 or -1 if the output cannot be created
+*/
+int extract_process(Dump *dump, VmaMaps *maps, MmMap *map, int la57, int pid, const char *comm,
+  int format, const char *filename, ExtractResult *result) {
+  memset(result, 0, sizeof(ExtractResult));
+  if (!map->pgd) {
+    _debug("DEBUG: page tables of mm %llx unknown", map->mm);
+    return -1;
+  }
+
+  int count;
+  ExtractExtent *extents = find_extents(dump, map, la57, &count);
+  for (int i = 0; i < count; i++) {
+    result->segments += starts_segment(extents, i);
+    result->pages += extents[i].len >> PAGE_SHIFT;
+  }
+  result->extents = count;
+
+  int out = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  STATS_ADD(syscalls, 1);
+  if (out == -1) {
+    free(extents);
+    return -1;
+  }
+  if (format == EXTRACT_RAW && write_raw_map(filename, maps, map, extents, count) == -1) {
+    close(out);
+    free(extents);
+    return -1;
+  }
+
+  unsigned long long offset = 0;
+  if (format == EXTRACT_ELF) {
+    offset = write_elf_headers(out, map, extents, count, result->segments, pid, comm);
+  }
+  unsigned char *buf = malloc(EXTRACT_COPY_BUF);
+  for (int i = 0; i < count; i++) {
+    copy_extent(dump, out, extents[i].paddr, extents[i].len, offset, buf);
+    offset += extents[i].len;
+  }
+  if (ftruncate(out, offset) == -1) { // a core with no pages still has its headers' page
+    _die("extract - Unable to size %s", filename);
+  }
+  close(out);
+  STATS_ADD(syscalls, 2);
+  result->bytes = offset;
+  free(buf);
+  free(extents);
+  return 0;
+}
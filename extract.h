@@ -0,0 +1,60 @@
+#ifndef _EXTRACT_H
+#define _EXTRACT_H
+
+#include "dump.h"
+#include "vma.h"
+
+/* output formats */
+#define EXTRACT_ELF 0  /* ELF core, a PT_LOAD per run of resident pages */
+#define EXTRACT_RAW 1  /* the pages back to back, and <file>.map listing where each run is */
+
+#define EXTRACT_COPY_BUF (1ULL << 20) /* bounce buffer when the pages cannot be copied in kernel */
+
+/**
+ * This struct is the NT_PRPSINFO note of an x86_64 core (elf_prpsinfo),
+ * spelled out since <sys/procfs.h> brings its own PAGE_SIZE
+*/
+
+typedef struct extract_prpsinfo {
+	char state;
+	char sname;
+	char zomb;
+	char nice;
+	unsigned long long flag;
+	unsigned int uid;
+	unsigned int gid;
+	int pid;
+	int ppid;
+	int pgrp;
+	int sid;
+	char fname[16];
+	char psargs[80];
+} ExtractPrpsinfo;
+
+/**
+ * This struct is a run of resident pages that is contiguous both in the
+ * process and in the dump file, so it is copied with one call
+*/
+
+typedef struct extract_extent {
+	unsigned long long vaddr;
+	unsigned long long paddr;
+	unsigned long long len;
+	int vma;                   /* index into the MmMap's VMAs */
+} ExtractExtent;
+
+/**
+ * This struct is what was written
+*/
+
+typedef struct extract_result {
+	unsigned long long pages;      /* resident pages written */
+	unsigned long long bytes;      /* size of the output file */
+	int segments;                  /* virtually contiguous runs */
+	int extents;                   /* copies made */
+} ExtractResult;
+
+int extract_process(Dump *dump, VmaMaps *maps, MmMap *map, int la57, int pid, const char *comm,
+  int format, const char *filename, ExtractResult *result);
+
+#endif
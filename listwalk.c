@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "util.h"
+#include "dump.h"
+#include "vtop.h"
+#include "locate.h"
+#include "listwalk.h"
+#include "stats.h"
+
+/**
+ * This function translates a kernel address: the text mapping is a fixed
+ * shift, anything else goes through the kernel page tables, falling back to
+ * the default direct map where they are missing from the dump
+ * @returns the physical address or -1
+*/
+static unsigned long long resolve(ListWalker *w, unsigned long long vaddr) {
+  unsigned long long paddr;
+  if (w->params.kernel_shift && vaddr > w->params.kernel_shift) {
+    return vaddr - w->params.kernel_shift;
+  }
+  if (vtop_translate(w->kernel, vaddr, &paddr, NULL) == VTOP_OK) {
+    return paddr;
+  }
+  if (w->params.direct_map && vaddr >= w->params.direct_map) {
+    return vaddr - w->params.direct_map; // tables missing from the dump, assume the default direct map
+  }
+  return -1;
+}
+
+/**
+ * This function starts a walk
+ * Only the head is read, the entries are chased by list_walk_next
+ * @params dump - the opened dump
+ * @params kernel - the kernel address space
+ * @params params - the list
+ * @returns the walker
+*/
+ListWalker* list_walk_create(Dump *dump, Translator *kernel, const ListParams *params) {
+  ListWalker *w = calloc(1, sizeof(ListWalker));
+  w->dump = dump;
+  w->kernel = kernel;
+  w->params = *params;
+  if (w->params.ahead <= 0) {
+    w->params.ahead = LIST_WALK_AHEAD;
+  }
+  if (w->params.max <= 0) {
+    w->params.max = LIST_WALK_MAX;
+  }
+  w->slots = calloc(w->params.ahead, sizeof(ListSlot));
+  for (int i = 0; i < w->params.ahead; i++) {
+    w->slots[i].buf = malloc(w->params.entry_size ? w->params.entry_size : 1);
+  }
+  w->status = LIST_WALK_ENTRY;
+  w->prefetch = 1;
+  w->prev = params->head;
+  w->seen_mask = 1023;
+  w->seen = calloc(w->seen_mask + 1, sizeof(unsigned long long));
+
+  /* the head's next is where the entries start */
+  unsigned long long paddr = resolve(w, params->head);
+  if (paddr == (unsigned long long) -1 || dump_read(dump, paddr, &w->next, sizeof(w->next)) == -1) {
+    w->status = LIST_WALK_BROKEN;
+  }
+  return w;
+}
+
+/**
+ * This function adds a list_head to the seen set
+ * @returns 0, or -1 if it was already there
+*/
+static int seen_add(ListWalker *w, unsigned long long node) {
+  if ((unsigned int) w->num_seen * 2 >= w->seen_mask) {
+    unsigned long long *old = w->seen;
+    unsigned int old_mask = w->seen_mask;
+    w->seen_mask = w->seen_mask * 2 + 1;
+    w->seen = calloc(w->seen_mask + 1, sizeof(unsigned long long));
+    for (unsigned int i = 0; i <= old_mask; i++) {
+      if (old[i]) {
+        unsigned int h = (old[i] * 0x9e3779b97f4a7c15ULL) >> 32 & w->seen_mask;
+        while (w->seen[h]) {
+          h = (h + 1) & w->seen_mask;
+        }
+        w->seen[h] = old[i];
+      }
+    }
+    free(old);
+  }
+  unsigned int h = (node * 0x9e3779b97f4a7c15ULL) >> 32 & w->seen_mask;
+  while (w->seen[h]) {
+    if (w->seen[h] == node) {
+      return -1;
+    }
+    h = (h + 1) & w->seen_mask;
+  }
+  w->seen[h] = node;
+  w->num_seen += 1;
+  return 0;
+}
+
+/**
+ * This function has the kernel read an entry in unless it already is
+ * @params entry - physical address of the entry, in a mapped block
+*/
+static void prefetch(ListWalker *w, unsigned long long entry) {
+  if (!w->prefetch && w->entries % LIST_WALK_PROBE) {
+    return;
+  }
+  if (dump_resident(w->dump, entry, w->params.entry_size)) {
+    w->warm += 1;
+    if (w->warm >= LIST_WALK_PROBE) {
+      w->prefetch = 0; // the list is in the page cache
+    }
+    return;
+  }
+  w->warm = 0;
+  w->prefetch = 1;
+  dump_prefetch(w->dump, entry, w->params.entry_size);
+}
+
+/**
+ * This function follows one next pointer and prefetches its entry
+ * @returns 1, or 0 once the chase has stopped (w->status says why)
+*/
+static int chase(ListWalker *w) {
+  if (w->status != LIST_WALK_ENTRY) {
+    return 0;
+  }
+  unsigned long long node = w->next;
+  unsigned long long kernel_start = w->params.la57 ? KERNEL_SPACE_START_LA57 : KERNEL_SPACE_START;
+  if (node == w->params.head) {
+    w->status = LIST_WALK_END;
+    return 0;
+  }
+  if (w->entries >= w->params.max) {
+    w->status = LIST_WALK_TOO_LONG;
+    return 0;
+  }
+  if (node < kernel_start || (node & 7)) {
+    w->status = LIST_WALK_BROKEN;
+    return 0;
+  }
+  if (seen_add(w, node) == -1) {
+    w->status = LIST_WALK_CYCLE;
+    return 0;
+  }
+
+  unsigned long long paddr = resolve(w, node);
+  unsigned long long head[2];
+  if (paddr == (unsigned long long) -1 || dump_read(w->dump, paddr, head, sizeof(head)) == -1) {
+    w->status = LIST_WALK_BROKEN;
+    return 0;
+  }
+  if (head[1] != w->prev) {
+    w->bad_prev += 1;
+    _debug("DEBUG: list corruption, %llx->prev is %llx, should be %llx", node, head[1], w->prev);
+  }
+
+  ListSlot *slot = &w->slots[(w->first + w->count) % w->params.ahead];
+  unsigned long long entry = paddr - w->params.member_offset;
+  slot->vaddr = node - w->params.member_offset;
+  slot->entry = w->dump->cdump ? NULL : dump_ptr(w->dump, entry, w->params.entry_size);
+  if (slot->entry) {
+    prefetch(w, entry);
+  } else if (dump_read(w->dump, entry, slot->buf, w->params.entry_size) == 0) {
+    slot->entry = slot->buf; // compressed, or across two blocks
+  }
+  w->count += 1;
+  w->entries += 1;
+  w->prev = node;
+  w->next = head[0];
+  return 1;
+}
+
+/**
+ * This function hands out the next entry of the list
+ * Before it does, the chase is run up to ahead entries past it
+ * @params w - the walker
+ * @params vaddr - set to the address of the entry
+ * @params entry - set to its entry_size bytes, valid until the next call
+ * @returns LIST_WALK_ENTRY, or once every entry was handed out LIST_WALK_END
+ * or the reason the list could not be followed further
+*/
+int list_walk_next(ListWalker *w, unsigned long long *vaddr, const unsigned char **entry) {
+  while (w->count < w->params.ahead && chase(w)) {
+  }
+  if (!w->count) {
+    return w->status;
+  }
+
+  ListSlot *slot = &w->slots[w->first];
+  w->first = (w->first + 1) % w->params.ahead;
+  w->count -= 1;
+  if (!slot->entry) {
+    _debug("DEBUG: list entry %llx not in dump", slot->vaddr);
+    w->status = LIST_WALK_BROKEN;
+    w->count = 0; // the rest is behind a hole, drop it
+    return w->status;
+  }
+  *vaddr = slot->vaddr;
+  *entry = slot->entry;
+  return LIST_WALK_ENTRY;
+}
+
+/**
+ * This function names how a walk ended
+*/
+const char* list_walk_error(int status) {
+  switch (status) {
+    case LIST_WALK_END:
+      return "complete";
+    case LIST_WALK_BROKEN:
+      return "broken";
+    case LIST_WALK_CYCLE:
+      return "cyclic";
+    case LIST_WALK_TOO_LONG:
+      return "too long";
+  }
+  return "unfinished";
+}
+
+void list_walk_free(ListWalker *w) {
+  for (int i = 0; i < w->params.ahead; i++) {
+    free(w->slots[i].buf);
+  }
+  free(w->slots);
+  free(w->seen);
+  free(w);
+}
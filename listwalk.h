@@ -0,0 +1,80 @@
+#ifndef _LISTWALK_H
+#define _LISTWALK_H
+
+#include "dump.h"
+#include "vtop.h"
+
+#define LIST_WALK_AHEAD 16       /* default entries prefetched ahead of the consumer */
+#define LIST_WALK_MAX 4194304    /* default longest list, PID_MAX_LIMIT */
+#define LIST_WALK_PROBE 64       /* resident entries in a row that turn prefetching off */
+
+/* list_walk_next results, and ListWalker.status once the chase stops */
+#define LIST_WALK_ENTRY 1        /* an entry was handed out */
+#define LIST_WALK_END 0          /* back at the head */
+#define LIST_WALK_BROKEN -1      /* a pointer is not a kernel address or not in the dump */
+#define LIST_WALK_CYCLE -2       /* an entry came round again without passing the head */
+#define LIST_WALK_TOO_LONG -3    /* more than max entries */
+
+/**
+ * This struct says which list to walk, as list_for_each_entry(pos, head, member)
+*/
+
+typedef struct list_params {
+	unsigned long long head;           /* address of the list_head the list hangs off, not an entry */
+	unsigned long long member_offset;  /* offsetof(entry type, member) */
+	unsigned long long entry_size;     /* bytes of each entry handed out */
+	unsigned long long kernel_shift;   /* kernel text vaddr - paddr */
+	unsigned long long direct_map;     /* assumed direct map when a table is missing */
+	int la57;                          /* kernel pointers start lower with 5-level paging */
+	int ahead;                         /* entries prefetched ahead, 0 for LIST_WALK_AHEAD */
+	int max;                           /* longest list, 0 for LIST_WALK_MAX */
+} ListParams;
+
+/**
+ * This struct is an entry chased ahead of the consumer
+*/
+
+typedef struct list_slot {
+	unsigned long long vaddr;   /* address of the entry, not of its list_head */
+	const unsigned char *entry; /* in the dump mapping, or buf; NULL if not in the dump */
+	unsigned char *buf;         /* entry_size bytes for a copy */
+} ListSlot;
+
+/**
+ * This struct is a walk in progress
+ * The chase follows next pointers ahead of the consumer, reading only the
+ * list_heads, and has the kernel start reading each entry in as it passes
+ * (dump_prefetch); once LIST_WALK_PROBE entries in a row were already in the
+ * page cache only every LIST_WALK_PROBE-th one is checked, until one is not,
+ * so a cached dump is not slowed down by the advice; entries are handed out
+ * in list order from a ring of ahead
+ * slots, in place in the mapping of a lime dump and copied out of a
+ * compressed one, whose chunk cache would not keep them
+*/
+
+typedef struct list_walker {
+	Dump *dump;
+	Translator *kernel;
+	ListParams params;
+	ListSlot *slots;
+	int first;                  /* oldest slot */
+	int count;                  /* slots read ahead */
+	unsigned long long next;    /* list_head the chase reads next */
+	unsigned long long prev;    /* list_head its prev should point at */
+	int status;                 /* LIST_WALK_ENTRY while the chase goes on */
+	int entries;                /* chased so far */
+	int bad_prev;               /* entries whose prev did not point back, as CONFIG_DEBUG_LIST checks */
+	int prefetch;               /* every entry is checked, and prefetched if not resident */
+	int warm;                   /* entries checked in a row that were resident */
+	/* list_heads seen, to catch cycles */
+	unsigned long long *seen;
+	unsigned int seen_mask;
+	int num_seen;
+} ListWalker;
+
+ListWalker* list_walk_create(Dump *dump, Translator *kernel, const ListParams *params);
+int list_walk_next(ListWalker *w, unsigned long long *vaddr, const unsigned char **entry);
+const char* list_walk_error(int status);
+void list_walk_free(ListWalker *w);
+
+#endif
@@ -0,0 +1,364 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "util.h"
+#include "dump.h"
+#include "vtop.h"
+#include "locate.h"
+#include "stats.h"
+
+/**
+ * This struct is one piece of a lime block handed to a worker
+ * start and end are byte offsets into the range's data
+*/
+typedef struct locate_work {
+  const DumpRange *range;
+  unsigned long long start;
+  unsigned long long end;
+} LocateWork;
+
+/**
+ * This struct is the state shared by the scanning threads
+ * Work is handed out in ascending physical order, found is the lowest work
+ * item with a hit so far and nothing above it needs to be scanned
+*/
+typedef struct locate_ctx {
+  Dump *dump;
+  const LocateParams *params;
+  LocateWork *work;
+  LocateHit *hits;
+  int num_work;
+  int next;
+  int found;
+  unsigned int sig_len;    /* signature length including the NUL */
+  unsigned int anchor;     /* index of the byte memchr looks for */
+} LocateCtx;
+
+/**
+ * This function reads a little endian pointer out of the dump
+ * @returns 0 or -1 if it is not in the dump
+*/
+static int read_ptr(Dump *dump, unsigned long long paddr, unsigned long long *val) {
+  return dump_read(dump, paddr, val, sizeof(unsigned long long));
+}
+
+static inline unsigned long long fnv1a(unsigned long long h, const void *data, unsigned long long len) {
+  const unsigned char *p = data;
+  for (unsigned long long i = 0; i < len; i++) {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+/**
+ * This function hashes the parameters that decide where init_task is found
+ * A hit remembered under one key (e.g. in a dump's index) is only reused
+ * with the same offsets, System.map addresses and paging mode
+ * @params params - the locate parameters, threads are ignored
+ * @returns the key
+*/
+unsigned long long locate_key(const LocateParams *params) {
+  unsigned long long fields[] = {
+    params->comm_offset, params->tasks_offset, params->parent_offset, params->task_size,
+    params->init_task_vaddr, params->pgt_vaddr, params->direct_map, params->la57,
+  };
+  unsigned long long h = fnv1a(14695981039346656037ULL, params->comm, strlen(params->comm) + 1);
+  return fnv1a(h, fields, sizeof(fields));
+}
+
+static inline int is_kernel_ptr(const LocateParams *params, unsigned long long vaddr) {
+  return vaddr >= (params->la57 ? KERNEL_SPACE_START_LA57 : KERNEL_SPACE_START) && !(vaddr & 7);
+}
+
+/**
+ * This function resolves a kernel pointer found while validating a candidate
+ * Kernel image addresses are the candidate shift away, anything else goes
+ * through the page tables and then the fallback direct map base
+ * @returns the physical address or -1
+*/
+static unsigned long long resolve(const LocateParams *params, Translator *t, unsigned long long shift, unsigned long long vaddr) {
+  unsigned long long paddr;
+  if (vaddr >= shift) {
+    return vaddr - shift;
+  }
+  if (t && vtop_translate(t, vaddr, &paddr, NULL) == VTOP_OK) {
+    return paddr;
+  }
+  if (params->direct_map && vaddr >= params->direct_map) {
+    return vaddr - params->direct_map;
+  }
+  return -1;
+}
+
+/**
+ * This function finds the page tables of a candidate init_task
+ * System.map addresses are link time ones, but KASLR moves the kernel image
+ * as a whole, so init_pgt keeps its distance from init_task
+ * @params params - offsets and hints
+ * @params paddr - physical address of init_task
+ * @params shift - kernel text shift
+ * @returns the physical address of init_pgt or -1 if it is unknown
+*/
+unsigned long long locate_pgt_paddr(const LocateParams *params, unsigned long long paddr, unsigned long long shift) {
+  if (!params->pgt_vaddr) {
+    return -1;
+  }
+  if (params->init_task_vaddr) {
+    return paddr + params->pgt_vaddr - params->init_task_vaddr;
+  }
+  if (params->pgt_vaddr > shift) {
+    return params->pgt_vaddr - shift;
+  }
+  return -1;
+}
+
+/**
+ * This function checks that a physical address holds init_task
+ * init_task is its own parent, which gives the kernel shift, and its tasks
+ * list_head must be linked both ways with its neighbours
+ * @params dump - the opened dump
+ * @params params - offsets and hints
+ * @params paddr - candidate physical address of the task_struct
+ * @params hit - filled in when the candidate is valid
+ * @returns 1 if the candidate is init_task, 0 otherwise
+*/
+int locate_validate(Dump *dump, const LocateParams *params, unsigned long long paddr, LocateHit *hit) {
+  unsigned int sig_len = strlen(params->comm) + 1;
+  char comm[sig_len];
+  if (dump_read(dump, paddr + params->comm_offset, comm, sig_len) == -1 ||
+      memcmp(comm, params->comm, sig_len) != 0) {
+    return 0;
+  }
+
+  unsigned long long parent, next, prev;
+  if (read_ptr(dump, paddr + params->parent_offset, &parent) == -1 ||
+      read_ptr(dump, paddr + params->tasks_offset, &next) == -1 ||
+      read_ptr(dump, paddr + params->tasks_offset + sizeof(unsigned long long), &prev) == -1) {
+    return 0;
+  }
+  if (!is_kernel_ptr(params, parent) || !is_kernel_ptr(params, next) || !is_kernel_ptr(params, prev) || parent <= paddr) {
+    return 0;
+  }
+
+  unsigned long long shift = parent - paddr;
+  if (shift & (PAGE_SIZE - 1)) {
+    return 0;
+  }
+
+  unsigned long long self = paddr + shift + params->tasks_offset;
+  if (next != self || prev != self) {
+    Translator *t = NULL;
+    unsigned long long pgt_paddr = locate_pgt_paddr(params, paddr, shift);
+    if (pgt_paddr != (unsigned long long) -1) {
+      t = vtop_create(dump, pgt_paddr, params->la57);
+    }
+    unsigned long long next_paddr = resolve(params, t, shift, next);
+    unsigned long long prev_paddr = resolve(params, t, shift, prev);
+    unsigned long long back = 0, forward = 0;
+    int linked = next_paddr != (unsigned long long) -1 && prev_paddr != (unsigned long long) -1 &&
+      read_ptr(dump, next_paddr + sizeof(unsigned long long), &back) == 0 &&
+      read_ptr(dump, prev_paddr, &forward) == 0 &&
+      back == self && forward == self;
+    if (t) {
+      vtop_free(t);
+    }
+    if (!linked) {
+      _debug("DEBUG: candidate at %llx has a broken tasks list", paddr);
+      return 0;
+    }
+  }
+
+  hit->paddr = paddr;
+  hit->shift = shift;
+  return 1;
+}
+
+/**
+ * This function lowers ctx->found to w unless a lower item already has a hit
+*/
+static void found_min(LocateCtx *ctx, int w) {
+  int cur = __atomic_load_n(&ctx->found, __ATOMIC_ACQUIRE);
+  while (w < cur && !__atomic_compare_exchange_n(&ctx->found, &cur, w, 0,
+      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+  }
+}
+
+/**
+ * This function scans one work item for the signature
+ * memchr finds the anchor byte (vectorised in libc), the rest is a memcmp
+ * Only hits whose task_struct would be 8 byte aligned are validated
+ * The item is looked at DUMP_WINDOW_SIZE bytes at a time, each window
+ * running sig_len - 1 bytes into the next so no signature is split
+ * @params buf - window buffer for a compressed dump, NULL otherwise
+ * @returns 1 if init_task was found in the item
+*/
+static int scan_work(LocateCtx *ctx, int w, unsigned char *buf) {
+  const LocateParams *params = ctx->params;
+  const LocateWork *work = &ctx->work[w];
+  STATS_ADD(scan_bytes, work->end - work->start);
+  const DumpRange *range = work->range;
+  unsigned long long block_len = range->e_addr - range->s_addr + 1;
+  if (block_len < ctx->sig_len) {
+    return 0;
+  }
+
+  unsigned long long last = work->end;
+  if (last > block_len - ctx->sig_len + 1) {
+    last = block_len - ctx->sig_len + 1;
+  }
+  unsigned char anchor = params->comm[ctx->anchor];
+
+  for (unsigned long long pos = work->start; pos < last; pos += DUMP_WINDOW_SIZE) {
+    unsigned long long stop = pos + DUMP_WINDOW_SIZE < last ? pos + DUMP_WINDOW_SIZE : last;
+    const unsigned char *base = dump_range_bytes(ctx->dump, range, pos, stop - pos + ctx->sig_len - 1, buf);
+    const unsigned char *p = base + ctx->anchor;
+    const unsigned char *end = base + (stop - pos) + ctx->anchor;
+
+    while (p < end && (p = memchr(p, anchor, end - p))) {
+      const unsigned char *sig = p - ctx->anchor;
+      p++;
+      if (memcmp(sig, params->comm, ctx->sig_len) != 0) {
+        continue;
+      }
+      unsigned long long sig_paddr = range->s_addr + pos + (sig - base);
+      if (sig_paddr < params->comm_offset || (sig_paddr - params->comm_offset) & 7) {
+        continue;
+      }
+      if (locate_validate(ctx->dump, params, sig_paddr - params->comm_offset, &ctx->hits[w])) {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+static void* locate_worker(void *arg) {
+  LocateCtx *ctx = arg;
+  unsigned char *buf = ctx->dump->cdump ? malloc(DUMP_WINDOW_SIZE + ctx->sig_len) : NULL;
+  for (;;) {
+    int w = __atomic_fetch_add(&ctx->next, 1, __ATOMIC_RELAXED);
+    if (w >= ctx->num_work || w > __atomic_load_n(&ctx->found, __ATOMIC_ACQUIRE)) {
+      break;
+    }
+    if (scan_work(ctx, w, buf)) {
+      found_min(ctx, w);
+    }
+  }
+  free(buf);
+  return NULL;
+}
+
+/**
+ * This function scans every lime block for init_task
+ * Blocks are cut into LOCATE_CHUNK_SIZE pieces that the threads take in
+ * ascending order, so one large block is shared by every thread
+ * The hit with the lowest physical address wins
+ * @params dump - the opened dump
+ * @params params - signature, offsets and hints
+ * @params hit - set to init_task's physical address and the kernel shift
+ * @returns 0 or -1 if no valid candidate was found
+*/
+int locate_init_task(Dump *dump, const LocateParams *params, LocateHit *hit) {
+  LocateCtx ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.dump = dump;
+  ctx.params = params;
+  ctx.sig_len = strlen(params->comm) + 1;
+  const char *slash = strchr(params->comm, '/');
+  ctx.anchor = slash ? slash - params->comm : 0; // '/' is rarer than the leading letter
+
+  for (int i = 0; i < dump->num_ranges; i++) {
+    unsigned long long len = dump->ranges[i].e_addr - dump->ranges[i].s_addr + 1;
+    ctx.num_work += (len + LOCATE_CHUNK_SIZE - 1) / LOCATE_CHUNK_SIZE;
+  }
+  ctx.work = malloc(sizeof(LocateWork) * (ctx.num_work ? ctx.num_work : 1));
+  ctx.hits = malloc(sizeof(LocateHit) * (ctx.num_work ? ctx.num_work : 1));
+  ctx.found = ctx.num_work;
+
+  int w = 0;
+  for (int i = 0; i < dump->num_ranges; i++) {
+    unsigned long long len = dump->ranges[i].e_addr - dump->ranges[i].s_addr + 1;
+    for (unsigned long long start = 0; start < len; start += LOCATE_CHUNK_SIZE) {
+      ctx.work[w].range = &dump->ranges[i];
+      ctx.work[w].start = start;
+      ctx.work[w].end = start + LOCATE_CHUNK_SIZE < len ? start + LOCATE_CHUNK_SIZE : len;
+      w += 1;
+    }
+  }
+
+  int threads = params->threads > 0 ? params->threads : 1;
+  pthread_t *tids = malloc(sizeof(pthread_t) * threads);
+  int started = 0;
+  for (int i = 1; i < threads; i++) {
+    if (pthread_create(&tids[started], NULL, locate_worker, &ctx) != 0) {
+      _debug("DEBUG: unable to start locate thread %d", i);
+      break;
+    }
+    started += 1;
+  }
+  locate_worker(&ctx);
+  for (int i = 0; i < started; i++) {
+    pthread_join(tids[i], NULL);
+  }
+  free(tids);
+
+  int ret = -1;
+  if (ctx.found < ctx.num_work) {
+    *hit = ctx.hits[ctx.found];
+    ret = 0;
+    _debug("DEBUG: init_task at %llx, kernel shift %llx", hit->paddr, hit->shift);
+    if (params->init_task_vaddr && params->init_task_vaddr != hit->paddr + hit->shift) {
+      _debug("DEBUG: System.map init_task %llx does not match the dump", params->init_task_vaddr);
+    }
+  }
+  free(ctx.work);
+  free(ctx.hits);
+  return ret;
+}
+
+/**
+ * This function finds the kernel release in the dump's linux_banner
+ * The first "Linux version <release> (" in physical order is used
+ * @params dump - the opened dump
+ * @params release - set to the release, e.g. 4.15.0-29-generic
+ * @params len - size of release
+ * @returns 0 or -1 if no banner was found
+*/
+int locate_kernel_release(Dump *dump, char *release, int len) {
+  unsigned int banner_len = strlen(LINUX_BANNER);
+  unsigned long long overlap = banner_len + len + 1; // the longest banner we accept, with " ("
+  unsigned char *buf = dump->cdump ? malloc(DUMP_WINDOW_SIZE + overlap) : NULL;
+  for (int i = 0; i < dump->num_ranges; i++) {
+    unsigned long long block_len = dump->ranges[i].e_addr - dump->ranges[i].s_addr + 1;
+    for (unsigned long long pos = 0; pos < block_len; pos += DUMP_WINDOW_SIZE) {
+      unsigned long long size = block_len - pos < DUMP_WINDOW_SIZE + overlap ? block_len - pos : DUMP_WINDOW_SIZE + overlap;
+      const unsigned char *base = dump_range_bytes(dump, &dump->ranges[i], pos, size, buf);
+      const unsigned char *p = base;
+      const unsigned char *end = base + size;
+      const unsigned char *last = base + (size < DUMP_WINDOW_SIZE ? size : DUMP_WINDOW_SIZE); // later banners are in the next window
+      while (p < last && (p = memmem(p, end - p, LINUX_BANNER, banner_len)) && p < last) {
+        const unsigned char *r = p + banner_len;
+        int n = 0;
+        while (r + n < end && n < len - 1 && r[n] > ' ' && r[n] < 0x7f) {
+          n++;
+        }
+        p += 1;
+        if (n == 0 || r + n + 1 >= end || r[n] != ' ' || r[n + 1] != '(') {
+          continue;
+        }
+        memcpy(release, r, n);
+        release[n] = '\0';
+        _debug("DEBUG: kernel release %s at %llx", release, dump->ranges[i].s_addr + pos + (r - base));
+        free(buf);
+        return 0;
+      }
+    }
+  }
+  free(buf);
+  return -1;
+}
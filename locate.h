@@ -0,0 +1,49 @@
+#ifndef _LOCATE_H
+#define _LOCATE_H
+
+#include "dump.h"
+
+/* lowest canonical kernel virtual address on x86_64, 4 and 5-level paging */
+#define KERNEL_SPACE_START 0xffff800000000000ULL
+#define KERNEL_SPACE_START_LA57 0xff00000000000000ULL
+
+/* start of linux_banner, the release follows it */
+#define LINUX_BANNER "Linux version "
+
+/* each worker takes this much of a lime block at a time */
+#define LOCATE_CHUNK_SIZE (64ULL << 20)
+
+/**
+ * This struct describes what the locator looks for
+ * Offsets are those of the kernel's task_struct, vaddrs are 0 when unknown
+*/
+
+typedef struct locate_params {
+	const char *comm;                   /* signature, compared with its NUL */
+	unsigned long long comm_offset;
+	unsigned long long tasks_offset;
+	unsigned long long parent_offset;
+	unsigned long long task_size;
+	unsigned long long init_task_vaddr; /* System.map init_task */
+	unsigned long long pgt_vaddr;       /* System.map init_pgt, used to follow tasks.next */
+	unsigned long long direct_map;      /* fallback base of the direct map */
+	int la57;
+	int threads;
+} LocateParams;
+
+/**
+ * This struct is a validated init_task
+*/
+
+typedef struct locate_hit {
+	unsigned long long paddr;  /* physical address of init_task */
+	unsigned long long shift;  /* kernel text shift, vaddr - paddr */
+} LocateHit;
+
+unsigned long long locate_key(const LocateParams *params);
+unsigned long long locate_pgt_paddr(const LocateParams *params, unsigned long long paddr, unsigned long long shift);
+int locate_validate(Dump *dump, const LocateParams *params, unsigned long long paddr, LocateHit *hit);
+int locate_kernel_release(Dump *dump, char *release, int len);
+int locate_init_task(Dump *dump, const LocateParams *params, LocateHit *hit);
+
+#endif
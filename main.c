@@ -14,21 +14,32 @@
 #include <linux/version.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <sys/types.h>
 #include <linux/sched.h>
 
+#include "util.h"
+#include "dump.h"
+#include "symbols.h"
+#include "vtop.h"
+#include "locate.h"
+#include "carve.h"
+#include "profile.h"
+#include "proctree.h"
+#include "batch.h"
+#include "stats.h"
+#include "dumpindex.h"
+#include "aread.h"
+#include "vma.h"
+#include "extract.h"
+#include "rmap.h"
+#include "listwalk.h"
+#include "scan.h"
+#include "output.h"
 #include "main.h"
 
-#define SYMBOL_SIZE 64
-#define SYSTEM_MAP_SIZE 100000
 #define NUM_Shifts 4
 
-#define PAGE_MAP_MASK 0x0000FF8000000000
-#define PDPT_MASK     0x0000007FC0000000
-#define PDE_MASK      0x000000003FE00000
-#define PTE_MASK      0x00000000001FF000
-#define PAGE_OFF_MASK 0x0000000000000FFF
-
 
 // move this to header so can do defines on kerenl version
 #if LINUX_VERSION_CODE <= KERNEL_VERSION(4, 13, 0)
@@ -39,13 +50,26 @@ const char* INIT_PGT = "init_pgt";
 
 #define INIT_TASK "init_task"
 #define INIT_TASK_COMM "swapper/0"
-
-/* DEBUG FLAG */
-static int debug = 0;
+#define STATIC_SHIFT_LA57 0xff11000000000000ULL /* the direct map with 5-level paging */
 
 unsigned long long KERNEL_MAP_SHIFT = 0;
 unsigned long long STATIC_SHIFT = 0xffff880000000000;
 unsigned long long PGT_PADDR = 0;
+Translator *kernel_vtop = NULL; /* kernel address space rooted at PGT_PADDR */
+int LA57 = 0; /* walk 5-level page tables */
+int NUM_THREADS = 0; /* scanning threads, 0 means one per online cpu */
+int CARVE = 0; /* carve task_structs out of the whole dump instead of walking the list */
+const char *PROFILE_DIR = NULL; /* profiles named <release>.prof or <release>.json */
+int TREE = 0; /* print the process tree after the list */
+const char *STATS_FILE = NULL; /* --stats appends the counters here at exit, "-" is stderr */
+const char *STATS_INPUT = NULL; /* the dump or manifest the counters are for */
+int USE_INDEX = 1; /* keep a <dump>.idx sidecar index, --no-index turns it off */
+int MAPS = 0; /* print the memory map of every process */
+int EXTRACT_PID = -1; /* write the resident pages of this process instead of the list */
+int EXTRACT_FORMAT = EXTRACT_ELF;
+const char *EXTRACT_FILE = NULL; /* default core.<pid>, or pages.<pid> with --raw */
+ScanSet *PATTERNS = NULL; /* -g and -G, searched for instead of printing the list */
+int OUTPUT_FORMAT = OUTPUT_TABLE; /* -f, of the process list and the carved tasks */
 const unsigned long long arrShifts[NUM_Shifts] = {
   0xffff880000000000,
   0xffffffff80000000, 
@@ -53,44 +77,115 @@ const unsigned long long arrShifts[NUM_Shifts] = {
   0xffffffff7fe00000
 };
 
-const unsigned long long comm_offset = 0x608;
-const unsigned long long pid_offset = 0x450;
-const unsigned long long tasks_offset = 0x358 + 1;
-const unsigned long long parent_offset = 0x468 + 1;
+/* defaults match dwarf_output_json, -p loads them from a profile instead */
+unsigned long long comm_offset = 0x608;
+unsigned long long pid_offset = 0x450;
+unsigned long long tasks_offset = 0x358;
+unsigned long long parent_offset = 0x468;
+unsigned long long task_struct_size = 0x1ac0;
+VmaParams vma_params; /* mm_struct and VMA layout for -m, set in main */
 
-void _debug(const char *format,...) {
-  if (debug) {
-    va_list va;
-    va_start(va,format);
-    vfprintf(stdout,format,va);
-    va_end(va);
-    printf("\n");
+/**
+ * This function returns the offset of a task_struct member in a profile
+ * @params profile - the loaded profile
+ * @params member - name of the member
+ * @returns the offset, dies if the profile does not have it
+*/
+unsigned long long task_member_offset(Profile *profile, const char *member) {
+  long long offset = profile_member_offset(profile, "task_struct", member);
+  if (offset == -1) {
+    _die("Profile has no task_struct.%s", member);
   }
+  return offset;
 }
 
-void _die(const char *format,...) {
-  va_list va;
-  va_start(va,format);
-  vfprintf(stderr,format,va);
-  va_end(va);
-  printf("\n");
-  exit(1);
+/**
+ * This function opens a profile keeping only the structs the tool uses
+ * @params filename - a binary profile or one written by dwarf.py, e.g. dwarf_output_json
+ * @returns the profile
+*/
+Profile* open_profile(const char *filename) {
+  const char *wanted[] = { "task_struct", "mm_struct", "vm_area_struct", "file", "path", "dentry", "qstr" };
+  return profile_load(filename, wanted, sizeof(wanted) / sizeof(wanted[0]));
 }
 
-/* NEEDS TO BE MOVED*/
 /**
- * This function adds to the head of a linkedlist of lime headers
- * These headers are used to seek to the correct block (and address) in the dump file
- * @params l - the head of the list
- * @params h - the lime header to be added to the list
- * @returns l - the updated head of the list
+ * This function sets the task_struct layout, and the VMA layout if the
+ * profile has it, from a loaded profile
+ * @params profile - the profile
 */
-LHdr_list* header_list_add(LHdr_list *l, LHdr *h) {
-  LHdr_list* new_head = (LHdr_list*) malloc(sizeof(LHdr_list));
-  new_head->header = h;
-  new_head->next = l;
-  l = new_head;
-  return l;
+void apply_profile(Profile *profile) {
+  long long size = profile_struct_size(profile, "task_struct");
+  if (size == -1) {
+    _die("Profile has no task_struct");
+  }
+  task_struct_size = size;
+  comm_offset = task_member_offset(profile, "comm");
+  pid_offset = task_member_offset(profile, "pid");
+  tasks_offset = task_member_offset(profile, "tasks");
+  parent_offset = task_member_offset(profile, "parent");
+  if (vma_params_from_profile(&vma_params, profile) == -1 && (MAPS || EXTRACT_PID != -1 || PATTERNS)) {
+    _die("Profile has no task_struct.mm, mm_struct.mmap/pgd or vm_area_struct members for -m, -x or -g");
+  }
+  _debug("DEBUG: task_struct size %llx comm %llx pid %llx tasks %llx parent %llx",
+    task_struct_size, comm_offset, pid_offset, tasks_offset, parent_offset);
+}
+
+/**
+ * This function sets the task_struct layout from a profile file
+ * @params filename - a binary profile or one written by dwarf.py, e.g. dwarf_output_json
+*/
+void load_profile(const char *filename) {
+  Profile *profile = open_profile(filename);
+  apply_profile(profile);
+  profile_free(profile);
+}
+
+/**
+ * This function finds the profile for the dump's kernel in PROFILE_DIR
+ * The release is read from linux_banner in the dump, or from its index
+ * @params dump - the opened dump
+ * @params release - set to the kernel release, empty if it was not found
+ * @params path - set to the profile's file name
+ * @params len - size of path
+ * @returns 0 or -1 if there is no release or no profile for it
+*/
+static int find_profile_for_dump(Dump *dump, char *release, char *path, int len) {
+  if (!dump->index || !dump_index_get_release(dump->index, release, PROFILE_RELEASE_LEN)) {
+    if (locate_kernel_release(dump, release, PROFILE_RELEASE_LEN) == -1) {
+      release[0] = '\0';
+      return -1;
+    }
+    if (dump->index) {
+      dump_index_set_release(dump->index, release);
+    }
+  }
+
+  const char *exts[] = { "prof", "json" };
+  for (unsigned int i = 0; i < sizeof(exts) / sizeof(exts[0]); i++) {
+    snprintf(path, len, "%s/%s.%s", PROFILE_DIR, release, exts[i]);
+    if (access(path, R_OK) == 0) {
+      _debug("DEBUG: using profile %s", path);
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/**
+ * This function picks the profile for the dump's kernel out of PROFILE_DIR
+ * @params dump - the opened dump
+*/
+void load_profile_for_dump(Dump *dump) {
+  char release[PROFILE_RELEASE_LEN];
+  char path[4096];
+  if (find_profile_for_dump(dump, release, path, sizeof(path)) == -1) {
+    if (!release[0]) {
+      _die("Could not find the kernel release in the dump");
+    }
+    _die("No profile for kernel %s in %s", release, PROFILE_DIR);
+  }
+  load_profile(path);
 }
 
 /**
@@ -103,533 +198,790 @@ struct task_struct* task_struct_init() {
 }
 
 /**
- * ****************************************************
- * FILE PROCESSING
- * ****************************************************
-*/
-
-/**
- * This function opens a file and returns a file descriptor
- * @param filename - char* to name of file
- * @return a FILE descriptor to the file
+ * This function gets the attr of the task_struct required from the dump
+ * The task is read in place from the dump mapping, so no seeking is needed
+ * @params task - pointer to the base of the task_struct in the dump mapping
+ * @params curr - task struct being processed
+ * @params offset - offset of attr to read
+ * @params length - length of attr to read  
+ * @params attr - id of the attr to read
 */
-int open_file(const char* filename) {
-  int fd;
-
-  fd = open(filename, O_RDWR); 
-  if (fd == -1) {
-   _die("Could not open file: %s", filename);
+void get_task_attr(const unsigned char *task, struct task_struct* curr, unsigned long long offset, int length, int attr) {
+  const unsigned char *src = task + offset;
+  switch(attr) {
+    case TASK_COMM_ID:
+      memcpy(curr->comm, src, length);
+      curr->comm[TASK_COMM_LEN - 1] = '\0';
+      break;
+    case TASK_PID_ID:
+      memcpy(&curr->pid, src, length);
+      break;
+    case TASK_PARENT_PTR_ID:
+      memcpy(&curr->parent_ptr, src, length);
+      break;
+    case TASK_TASKS_ID:
+      memcpy(&curr->tasks, src, length);
+      break;
+    case TASK_PPID_ID:
+      memcpy(&curr->ppid, src, length);
+      break;
+    case TASK_MM_ID:
+      memcpy(&curr->mm, src, length);
+      break;
+    default:
+      _die("get_task_attr - Wrong attr ID provided: %d", attr);
   }
-  _debug("DEBUG: Succesful open of file: %s", filename);
-  return fd;
 }
 
 /**
- * This function returns the length of a file using fseek()
- * @params fd - an open descriptor
- * @returns n or 0
+ * This function fetches a whole task_struct from the dump at once
+ * If the struct lies in a single lime block the mapping is returned directly,
+ * otherwise the pieces are copied into buf
+ * @params dump - the opened dump
+ * @params paddr - physical address of the base of the task_struct
+ * @params buf - reusable buffer of task_struct_size bytes
+ * @returns pointer to the task_struct bytes or NULL if it is not in the dump
 */
-unsigned long long get_file_length(int fd) {
-  lseek(fd, 0, SEEK_SET);
-  unsigned long long size = lseek(fd, 0, SEEK_END);
-  if(size == (unsigned long long) -1) {
-    _die("ERROR: Cannot seek to end of file");
-  }
-  lseek(fd, 0, SEEK_SET);
-    
-  _debug("DEBUG: found size of file");
-  
-  return size;
+const unsigned char* fetch_task(Dump *dump, unsigned long long paddr, unsigned char *buf) {
+  const unsigned char *task = dump_ptr(dump, paddr, task_struct_size);
+  if (task) {
+    return task;
+  }
+  if (dump_read(dump, paddr, buf, task_struct_size) == -1) {
+    return NULL;
+  }
+  return buf;
 }
 
 /**
- * This function returns the associated virtual address of a symbol 
- * @param map - the map to search 
- * @param symbol - the symbol to search for
- * @returns Either the address if found or -1 if sysmbol isn't present
+ * This function decodes every attr the tool uses from a fetched task_struct
+ * @params task - the task_struct bytes returned by fetch_task
+ * @params curr - task struct being filled
 */
-unsigned long long get_symbol_vaddr(Map** map, const char* symbol) {
-  for (int i = 0; i < SYSTEM_MAP_SIZE; i++) {
-    if (strcmp(map[i]->symbol, symbol) == 0) {
-      return map[i]->vaddr;
-    }
-  }
-  return -1;
+void decode_task(const unsigned char *task, struct task_struct *curr) {
+  get_task_attr(task, curr, comm_offset, TASK_COMM_LEN, TASK_COMM_ID);
+  get_task_attr(task, curr, pid_offset, TASK_PID_LEN, TASK_PID_ID);
+  get_task_attr(task, curr, tasks_offset, TASK_TASKS_LEN, TASK_TASKS_ID);
+  get_task_attr(task, curr, parent_offset, TASK_PARENT_PTR_LEN, TASK_PARENT_PTR_ID);
+  get_task_attr(task, curr, vma_params.mm_offset, TASK_MM_LEN, TASK_MM_ID);
 }
 
 /**
- * This function fills a linked list of lime headers with data
- * It seeks to the end of the dump file without resetting it 
- * 
- * It also sets PA_MAX to the e_addr of the last header
- * 
- * @params fp - file pointer for dump file
- * @return l - the linked list of headers
+ * This function reads the pid of every parent the walk did not reach
+ * The parents are independent, so their translations and pid reads are all
+ * put in flight at once through an AReader rather than one after the other
+ * @params dump - the opened dump
+ * @params tree - the walked tasks, ppid is -1 where the parent is missing
 */
-LHdr_list* get_lime_headers(int fd) {
-  LHdr_list *l = calloc(1, sizeof(LHdr_list));
-  unsigned long long fileSize = get_file_length(fd);
-
-  if (lseek64(fd, 0, SEEK_SET) != 0) 
-    _die("Unable to seek to offset 0 in dump");
-
-  unsigned long long bytes_read = 0;
-  int header_count = 0;
-  unsigned long long block_size = 0;
-  off64_t seek;
-  while (bytes_read < fileSize - 1) {
-    LHdr *header = malloc(sizeof(LHdr));
-    if (read(fd, header, sizeof(LHdr)) != sizeof(LHdr)) {
-      _die("Unable to read in lime header: %d", header_count);
+void get_parent_pids(Dump *dump, ProcTree *tree) {
+  int count = 0;
+  int *idx = malloc(sizeof(int) * tree->count);
+  unsigned long long *vaddrs = malloc(sizeof(unsigned long long) * tree->count);
+  unsigned long long *paddrs = malloc(sizeof(unsigned long long) * tree->count);
+  int *errs = malloc(sizeof(int) * tree->count);
+  for (int i = 0; i < tree->count; i++) {
+    if (tree->nodes[i].ppid != -1) {
+      continue;
     }
-    
-    l = header_list_add(l, header);
-    l->block_s_offset = lseek64(fd, 0, SEEK_CUR);
-    
-    block_size = header->e_addr - header->s_addr + 1;
-    seek = lseek64(fd, block_size, SEEK_CUR);
-    if (seek == -1) {
-      _die("Unable to seek to next header"); 
+    unsigned long long parent = tree->nodes[i].parent;
+    if (parent > KERNEL_MAP_SHIFT) {
+      paddrs[i] = parent - KERNEL_MAP_SHIFT; // text mapping, no tables to read
+      continue;
     }
-    l->block_e_offset = lseek64(fd, 0, SEEK_CUR);
+    idx[count] = i;
+    vaddrs[count] = parent;
+    count += 1;
+  }
 
-    header_count += 1;
-    bytes_read = seek;
+  AReader *ar = aread_create(dump, AREAD_DEPTH);
+  vtop_translate_async(kernel_vtop, ar, vaddrs, count, vaddrs, errs); // translated in place
+  for (int j = 0; j < count; j++) {
+    unsigned long long parent = tree->nodes[idx[j]].parent;
+    if (errs[j] == VTOP_OK) {
+      paddrs[idx[j]] = vaddrs[j];
+    } else if (parent >= STATIC_SHIFT) {
+      paddrs[idx[j]] = parent - STATIC_SHIFT; // tables missing from the dump, assume the default direct map
+    } else {
+      _die("get_parent_pids - Parent task not in dump: %llx", parent);
+    }
   }
 
-  if (debug) {
-    LHdr_list *curr = l;
-    while (curr->next) {
-      printf("start: %llx, end: %llx\n", curr->header->s_addr, curr->header->e_addr);
-      curr = curr->next;
+  for (int i = 0; i < tree->count; i++) {
+    if (tree->nodes[i].ppid == -1) {
+      aread_submit(ar, paddrs[i] + pid_offset, &tree->nodes[i].ppid, TASK_PID_LEN, &tree->nodes[i]);
     }
   }
-  
-  return l;
+  void *tag;
+  int status;
+  while ((status = aread_complete(ar, &tag)) != AREAD_IDLE) {
+    if (status == -1) {
+      _die("get_parent_pids - Parent task not in dump: %llx", ((ProcNode *) tag)->parent);
+    }
+  }
+  aread_free(ar);
+  free(errs);
+  free(paddrs);
+  free(vaddrs);
+  free(idx);
 }
 
 /**
- * This function gets the attr of the task_struct required from the dump
- * (currently assuming seek pointer is a base of task_struct)
- * Assuming task_struct does not go over lime block boundaries
- * Restores seek offset
- * @params fd - file descriptor or dump file
- * @params curr - task struct being processed
- * @params offset - offset of attr to read
- * @params length - length of attr to read  
+ * This function finds init_task in the dump and sets KERNEL_MAP_SHIFT
+ * The System.map address is tried with the usual static shifts first, if
+ * none of them holds a valid init_task (e.g. KASLR) every block is scanned
+ * for the "swapper/0" signature and the shift is derived from the hit
+ * A hit the dump's index has for the same parameters skips all of that
+ * @params dump - the opened dump
+ * @params vaddr - init_task in the System.map, or -1
+ * @params pgt_vaddr - init_pgt in the System.map, or -1
+ * @returns the physical address of init_task
 */
-void get_task_attr(int fd, struct task_struct* curr, unsigned long long  offset, int length, int attr) {
-  off64_t seek_pre_process = lseek64(fd, 0, SEEK_CUR);
-  if (lseek64(fd, offset, SEEK_CUR) != -1) {
-    int num_read = 0;
-    switch(attr) {
-      case TASK_COMM_ID:
-        num_read = read(fd, curr->comm, length);
-        break;
-      case TASK_PID_ID:
-        num_read = read(fd, &curr->pid, length);
-        break;
-      case TASK_PARENT_PTR_ID:
-        num_read = read(fd, &curr->parent_ptr, length);
-        break;
-      case TASK_TASKS_ID:
-        num_read = read(fd, &curr->tasks, length);
-        break;
-      case TASK_PPID_ID:
-        num_read = read(fd, &curr->ppid, length);
-        break;
-      default:
-        _die("get_task_attr - Wrong attr ID provided: %d", attr);
-    }
-    if (num_read == -1) {
-      _die("get_task_attr - Unable to read attr_id: %d", attr);
+unsigned long long find_init_task(Dump *dump, unsigned long long vaddr, unsigned long long pgt_vaddr) {
+  LocateParams params = {
+    .comm = INIT_TASK_COMM,
+    .comm_offset = comm_offset,
+    .tasks_offset = tasks_offset,
+    .parent_offset = parent_offset,
+    .task_size = task_struct_size,
+    .init_task_vaddr = vaddr == (unsigned long long) -1 ? 0 : vaddr,
+    .pgt_vaddr = pgt_vaddr == (unsigned long long) -1 ? 0 : pgt_vaddr,
+    .direct_map = STATIC_SHIFT,
+    .la57 = LA57,
+    .threads = NUM_THREADS ? NUM_THREADS : sysconf(_SC_NPROCESSORS_ONLN),
+  };
+  LocateHit hit;
+  unsigned long long key = locate_key(&params);
+  if (dump->index && dump_index_get_locate(dump->index, key, &hit)) {
+    _debug("SUCCESS: init_task at %llx, shift %llx from the index", hit.paddr, hit.shift);
+    KERNEL_MAP_SHIFT = hit.shift;
+    return hit.paddr;
+  }
+
+  //find the correct shift
+  int found = 0;
+  for (int i = 0; i < NUM_Shifts && params.init_task_vaddr && !found; i++) {
+    if (vaddr >= arrShifts[i] && locate_validate(dump, &params, vaddr - arrShifts[i], &hit)) {
+      _debug("SUCCESS: found a viable static shift: %llx", hit.shift);
+      found = 1;
     }
-    if (lseek64(fd, -(offset + length), SEEK_CUR) != seek_pre_process) {
-      _die("get_task_attr - Unable to restore file seek");
+  }
+
+  if (!found) {
+    _debug("DEBUG: no static shift matched, scanning the dump for %s", INIT_TASK_COMM);
+    if (locate_init_task(dump, &params, &hit) == -1) {
+      _die("Could not find init_task in the dump!");
     }
-  } else {
-    _die("get_task_attr - Cannot seek to offset: %llx (attr_id: %d)", offset, attr);
   }
+  if (dump->index) {
+    dump_index_set_locate(dump->index, key, &hit);
+  }
+  KERNEL_MAP_SHIFT = hit.shift;
+  return hit.paddr;
 }
 
+/**
+ * ****************************************************
+ * PRINTING PROCESSES
+ * ****************************************************  
+*/
 
+/* columns of print_process_list, the table as it always was */
+static const OutputColumn task_columns[] = {
+  { "name", OUTPUT_STR, 20 },
+  { "pid", OUTPUT_INT, 6 },
+  { "ppid", OUTPUT_INT, 6 },
+  { "next", OUTPUT_PTR, 0 },
+  { "parent", OUTPUT_PTR, 0 },
+};
 
 /**
- * This function finds the correct lime block for the paddr and seeks to that paddr
- * (seeks backwards as blocks are linked in reverse order)
- * Does not restore seek offset
- * @params fd - file descriptor of dump
- * @params list - list of lime headers
- * @params paddr - physical address to find in dump blocks
- * @returns -1 on failure or 0 for success
+ * This function lists the processes in the order they were walked
+ * While walking, a task is held back (with every task after it) until its
+ * parent has been walked, since its ppid is not known before; the list is
+ * linked, and every ppid resolved, once the walk is done
+ * @params out - the stream opened with task_columns
+ * @params tree - the tasks walked so far
+ * @params listed - tasks already listed, advanced past the ones written
+ * @params walking - the walk is still going on
 */
-int paddr_to_offset(int fd, LHdr_list *list, unsigned long long paddr) {
-  if (lseek64(fd, 0, SEEK_END) == -1) {
-    _die("Unable to seek to end of dump");
-  }
-
-  int succFlag = 0;
-  int header_length = sizeof(LHdr);
-  unsigned long long blockSize = 0;
-  LHdr_list *node  = list;
-  while (node->next) {
-    if (node->header->s_addr <= paddr && paddr < node->header->e_addr) {
-      succFlag = 1;
-      break;
+void print_process_list(Output *out, ProcTree *tree, int *listed, int walking) {
+  for (; *listed < tree->count; *listed += 1) {
+    ProcNode *node = &tree->nodes[*listed];
+    if (walking) {
+      int parent = proctree_find(tree, node->parent);
+      if (parent == -1) {
+        return;
+      }
+      node->ppid = tree->nodes[parent].pid;
     }
-    blockSize = node->header->e_addr - node->header->s_addr + 1;
-    if (lseek64(fd, -(header_length + blockSize),SEEK_CUR) == -1) {
-      _die("get_correct_header_and_seek - Unable to seek to next block header");
+    output_str(out, node->comm);
+    output_int(out, node->pid);
+    output_int(out, node->ppid);
+    output_hex(out, node->next);
+    output_hex(out, node->parent);
+  }
+}
+
+/**
+ * This function adds a decoded task to the tree
+*/
+static void add_task(ProcTree *tree, unsigned long long vaddr, const struct task_struct *curr) {
+  ProcNode *node = proctree_add(tree, vaddr);
+  STATS_ADD(tasks, 1);
+  node->pid = curr->pid;
+  memcpy(node->comm, curr->comm, PROC_COMM_LEN);
+  node->next = (unsigned long long) curr->tasks.next;
+  node->parent = (unsigned long long) curr->parent_ptr;
+  node->mm = (unsigned long long) curr->mm;
+}
+
+/**
+ * This function walks the task_struct list starting at init_task
+ * Tasks are only read once, parents are resolved from the walk afterwards
+ * and only a parent that was not walked is read from the dump
+ * The list is followed by a ListWalker, which stops back at init_task and
+ * on a cycle or a pointer out of the dump
+ * Given an output, tasks are listed while the walk goes on
+ * @params dump - the opened dump
+ * @params init_task - the decoded init_task
+ * @params init_task_vaddr - address of init_task
+ * @params out - stream for print_process_list, or NULL
+ * @returns the walked tasks
+*/
+ProcTree* walk_process_list(Dump *dump, struct task_struct *init_task, unsigned long long init_task_vaddr, Output *out) {
+  ProcTree *tree = proctree_create();
+  int listed = 0;
+  add_task(tree, init_task_vaddr, init_task);
+
+  ListParams params = {
+    .head = init_task_vaddr + tasks_offset,
+    .member_offset = tasks_offset,
+    .entry_size = task_struct_size,
+    .kernel_shift = KERNEL_MAP_SHIFT,
+    .direct_map = STATIC_SHIFT,
+    .la57 = LA57,
+  };
+  ListWalker *w = list_walk_create(dump, kernel_vtop, &params);
+  unsigned long long vaddr;
+  const unsigned char *task;
+  while (list_walk_next(w, &vaddr, &task) == LIST_WALK_ENTRY) {
+    struct task_struct curr;
+    decode_task(task, &curr);
+    add_task(tree, vaddr, &curr);
+    if (out) {
+      print_process_list(out, tree, &listed, 1);
     }
-    node = node->next;
   }
-  if (!succFlag) {
-    _debug("DEBUG: unable to find correct block in dump for address: %llx", paddr);
-    return -1;
+  if (w->status != LIST_WALK_END) {
+    fprintf(stderr, "WARNING: task list %s after %d tasks, %d bad prev pointers; the list is incomplete\n",
+      list_walk_error(w->status), w->entries, w->bad_prev);
+  } else if (w->bad_prev) {
+    fprintf(stderr, "WARNING: task list complete, but %d prev pointers do not point back\n", w->bad_prev);
   }
+  list_walk_free(w);
 
-  //seek to paddr in block
-  blockSize = node->header->e_addr - node->header->s_addr + 1;
-  if (lseek64(fd, -blockSize + (paddr - node->header->s_addr), SEEK_CUR) == -1) {
-    _die("get_correct_header_and_seek - Unable to seek to start of desired block");
+  int misses = proctree_link(tree);
+  _debug("DEBUG: walked %d tasks, %d parents outside the list", tree->count, misses);
+  if (misses) {
+    get_parent_pids(dump, tree);
+  }
+  if (out) {
+    print_process_list(out, tree, &listed, 0);
   }
-  return lseek64(fd, 0, SEEK_CUR);
+  return tree;
 }
 
 /**
- * This function takes an offset from the dump file
- * and converts it to the physical address 
- * Restores seek 
- * @params fd - file descriptor of dump
- * @params list - list o lime headers
- * @params seek - position of seek offset in dump file
- * @returns paddr - the physical address
+ * This function prints the memory map of every process, /proc/pid/maps style
+ * Processes sharing an mm_struct (e.g. vfork children) point at the first
+ * one printed instead of repeating it
+ * @params dump - the opened dump
+ * @params tree - the walked tasks
 */
-unsigned long long offset_to_paddr(LHdr_list *list, unsigned long long seek) {
-  int foundBlockFlag = 0;
-  LHdr_list *node = list;
-  while (node->next) {
-    if (node->block_s_offset <= seek && seek < node->block_e_offset) {
-        foundBlockFlag = 1;
-        break;
-    } 
-    node = node->next;
+void print_process_maps(Dump *dump, ProcTree *tree) {
+  unsigned long long *mms = malloc(sizeof(unsigned long long) * (tree->count ? tree->count : 1));
+  for (int i = 0; i < tree->count; i++) {
+    mms[i] = tree->nodes[i].mm;
   }
-  if (!foundBlockFlag) {
-    _die("Unable to find block that contains offset: %llx", seek);
+  vma_params.kernel_shift = KERNEL_MAP_SHIFT;
+  vma_params.direct_map = STATIC_SHIFT;
+  VmaMaps *maps = vma_collect(dump, kernel_vtop, &vma_params, mms, tree->count);
+  int *owner = malloc(sizeof(int) * (maps->count ? maps->count : 1));
+  memset(owner, 0xff, sizeof(int) * (maps->count ? maps->count : 1));
+
+  for (int i = 0; i < tree->count; i++) {
+    ProcNode *node = &tree->nodes[i];
+    MmMap *map = node->mm ? vma_find(maps, node->mm) : NULL;
+    if (!map) {
+      continue; // kernel thread
+    }
+    int m = map - maps->maps;
+    if (owner[m] != -1) {
+      printf("\n%s (%d) shares the memory map of pid %d\n", node->comm, node->pid, tree->nodes[owner[m]].pid);
+      continue;
+    }
+    owner[m] = i;
+    printf("\n%s (%d) mm %p pgd %llx, %d VMAs%s\n", node->comm, node->pid, (void *) map->mm, map->pgd,
+      map->count, map->broken ? ", list broken" : "");
+    for (int j = 0; j < map->count; j++) {
+      Vma *v = &map->vmas[j];
+      char flags[5];
+      vma_flags_string(v->flags, flags);
+      printf("    %016llx-%016llx %s %08llx %s\n", v->start, v->end, flags, v->pgoff << PAGE_SHIFT,
+        v->name == -1 ? "" : maps->names[v->name]);
+    }
   }
-
-  return = seek + node->header->e_addr + 1 - node->block_e_offset;
+  free(owner);
+  vma_maps_free(maps);
+  free(mms);
 }
 
 /**
- * This function returns the pid of a process' parent
- * @params fd - file descriptor of dump
- * @params list - list of lime headers in dump file
- * @parms curr - the current task to find the parent pid of 
-*/ 
-void get_parent_pid(int fd, LHdr_list *list, struct task_struct* curr) {
-  unsigned long long parent_paddr;
-  unsigned long long parent_vaddr = (unsigned long long) curr->parent_ptr;
-  if (parent_vaddr > KERNEL_MAP_SHIFT) {
-    parent_paddr = parent_vaddr - KERNEL_MAP_SHIFT;
+ * This function writes the resident pages of the process EXTRACT_PID
+ * @params dump - the opened dump
+ * @params tree - the walked tasks
+*/
+void extract_process_pages(Dump *dump, ProcTree *tree) {
+  ProcNode *node = NULL;
+  for (int i = 0; i < tree->count && !node; i++) {
+    if (tree->nodes[i].pid == EXTRACT_PID) {
+      node = &tree->nodes[i];
+    }
+  }
+  if (!node) {
+    _die("No process with pid %d in the task list", EXTRACT_PID);
+  }
+  if (!node->mm) {
+    _die("%s (%d) is a kernel thread, it has no user memory", node->comm, node->pid);
+  }
+
+  vma_params.kernel_shift = KERNEL_MAP_SHIFT;
+  vma_params.direct_map = STATIC_SHIFT;
+  VmaMaps *maps = vma_collect(dump, kernel_vtop, &vma_params, &node->mm, 1);
+  MmMap *map = vma_find(maps, node->mm);
+  char filename[4096];
+  if (EXTRACT_FILE) {
+    snprintf(filename, sizeof(filename), "%s", EXTRACT_FILE);
   } else {
-    parent_paddr = parent_vaddr - STATIC_SHIFT;
+    snprintf(filename, sizeof(filename), "%s.%d", EXTRACT_FORMAT == EXTRACT_RAW ? "pages" : "core", node->pid);
   }
-  paddr_to_offset(fd, list, parent_paddr);
 
-  get_task_attr(fd, curr, pid_offset, TASK_PID_LEN, TASK_PPID_ID);
+  ExtractResult result;
+  if (!map || extract_process(dump, maps, map, LA57, node->pid, node->comm, EXTRACT_FORMAT, filename, &result) == -1) {
+    _die("Unable to extract %s (%d) to %s", node->comm, node->pid, filename);
+  }
+  printf("%s (%d): %llu resident pages in %d segments of %d VMAs written to %s (%llu bytes, %d copies)%s\n",
+    node->comm, node->pid, result.pages, result.segments, map->count, filename, result.bytes, result.extents,
+    map->broken ? ", VMA list broken" : "");
+  vma_maps_free(maps);
 }
 
 /**
- * This function takes the address of init_task and fills a task_struct
- * structure
- * Does not restore seek offset
- * @params fd - file descriptor of dump
- * @params first - first lime header in dump
- * @params second - second line header
- * @params task_struct - the struct to fill
- * @params addr - the address of the struct in the dump
+ * This function searches the dump for PATTERNS and prints every hit with
+ * the processes mapping it
+ * @params dump - the opened dump
+ * @params tree - the walked tasks
 */
-void find_init_task(int fd, LHdr_list *list, struct task_struct *ts, unsigned long long vaddr) {
-  int successShiftFlag = 0;
+void print_scan_hits(Dump *dump, ProcTree *tree) {
+  ScanResult *result = scan_dump(dump, PATTERNS, NUM_THREADS ? NUM_THREADS : sysconf(_SC_NPROCESSORS_ONLN));
 
-  //find the correct shift
-  unsigned long long paddr = 0;
-  for (int i = 0; i < NUM_Shifts; i++) {
-    if (vaddr >= arrShifts[i]) {
-      paddr = vaddr - arrShifts[i];
-
-      int seek = paddr_to_offset(fd, list, paddr);
-      if (seek != -1) {
-        if (lseek64(fd, comm_offset, SEEK_CUR) != -1) {
-          if (read(fd, ts->comm, TASK_COMM_LEN -1) != -1) {
-            if (strcmp(ts->comm, INIT_TASK_COMM) == 0) {
-              _debug("SUCCESS: found a viable static shift: %llx", arrShifts[i]);
-              successShiftFlag = 1;
-              KERNEL_MAP_SHIFT = arrShifts[i];
-              break; // found correct shift
-            }
-          } else {
-            _debug("DEBUG: Unable to read in the comm of task");
-          }
-        } else {
-          _debug("DEBUG: Unable to seek to comm_offset");
-        }
-      } else {
-        _debug("DEBUG: address not in dump");
-      }
+  unsigned long long *mms = malloc(sizeof(unsigned long long) * (tree->count ? tree->count : 1));
+  for (int i = 0; i < tree->count; i++) {
+    mms[i] = tree->nodes[i].mm;
+  }
+  vma_params.kernel_shift = KERNEL_MAP_SHIFT;
+  vma_params.direct_map = STATIC_SHIFT;
+  VmaMaps *maps = vma_collect(dump, kernel_vtop, &vma_params, mms, tree->count);
+  Rmap *rmap = rmap_build(dump, PGT_PADDR, maps, LA57, STATIC_SHIFT, NUM_THREADS ? NUM_THREADS : sysconf(_SC_NPROCESSORS_ONLN));
+  scan_attribute(rmap, result);
+
+  /* name each mm_struct after the first task using it */
+  int *owner = malloc(sizeof(int) * (maps->count ? maps->count : 1));
+  memset(owner, 0xff, sizeof(int) * (maps->count ? maps->count : 1));
+  for (int i = 0; i < tree->count; i++) {
+    MmMap *map = tree->nodes[i].mm ? vma_find(maps, tree->nodes[i].mm) : NULL;
+    if (map && owner[map - maps->maps] == -1) {
+      owner[map - maps->maps] = i;
     }
   }
 
-  // fill rest of task if found 
-  if (successShiftFlag) {
-      if (lseek64(fd, -(comm_offset + TASK_COMM_LEN), SEEK_CUR) != -1) { // seek back to base of task_struct
-        get_task_attr(fd, ts, pid_offset, TASK_PID_LEN, TASK_PID_ID); // find and read pid
-        get_task_attr(fd, ts, tasks_offset, TASK_TASKS_LEN, TASK_TASKS_ID);  // find and read tasks list_head
-        get_task_attr(fd, ts, parent_offset, TASK_PARENT_PTR_LEN, TASK_PARENT_PTR_ID);
-        get_parent_pid(fd, list, ts);
-      } else {
-        _die("Could not seek back to start of task struct");
+  printf(" Phys Addr%*sPattern%*sProcess (PID)%*sVirt Addr\n", 9, " ", 14, " ", 8, " ");
+  printf("==============================================================================\n");
+  for (int i = 0; i < result->count; i++) {
+    ScanHit *hit = &result->hits[i];
+    printf("%016llx   %-20.20s", hit->paddr, PATTERNS->patterns[hit->pattern].text);
+    if (!hit->num_owners) {
+      printf(" -\n");
+    }
+    for (int j = 0; j < hit->num_owners; j++) {
+      RmapOwner *o = &result->owners[hit->first_owner + j];
+      char name[32] = "[kernel]";
+      if (o->owner != RMAP_KERNEL) {
+        ProcNode *node = &tree->nodes[owner[o->owner]];
+        snprintf(name, sizeof(name), "%.16s (%d)", node->comm, node->pid);
       }
-    } else {
-      _die("Could not find a successful shift!");
+      printf("%*s %-20s %016llx\n", j ? 39 : 0, "", name, o->vaddr);
     }
+  }
+  if (result->total > (unsigned long long) result->count) {
+    printf("\n%llu hits, only the first %d by address were kept\n", result->total, result->count);
+  }
+  free(owner);
+  rmap_free(rmap);
+  vma_maps_free(maps);
+  free(mms);
+  scan_result_free(result);
 }
 
 /**
- * ****************************************************
- * PRINTING PROCESSES
- * ****************************************************  
+ * This function prints the processes as a tree, pstree style
+ * Tasks whose parent was not walked are printed as extra roots
+ * @params tree - the walked and linked tasks
 */
+void print_process_tree(ProcTree *tree) {
+  int *stack = malloc(sizeof(int) * (tree->count + 1));
+  int *depth = malloc(sizeof(int) * (tree->count + 1));
+
+  printf("\n");
+  for (int root = 0; root < tree->count; root++) {
+    if (tree->nodes[root].parent_idx != -1) {
+      continue;
+    }
+    int top = 0;
+    stack[top] = root;
+    depth[top++] = 0;
+    while (top) {
+      top -= 1;
+      ProcNode *node = &tree->nodes[stack[top]];
+      int d = depth[top];
+      if (d) {
+        printf("%*s\\_ ", 4 * (d - 1) + 1, "");
+      }
+      printf("%s (%d)\n", node->comm, node->pid);
+
+      // push in reverse so children print in walk order
+      int first = top;
+      for (int c = node->first_child; c != -1; c = tree->nodes[c].next_sibling) {
+        stack[top] = c;
+        depth[top++] = d + 1;
+      }
+      for (int l = first, r = top - 1; l < r; l++, r--) {
+        int tmp = stack[l];
+        stack[l] = stack[r];
+        stack[r] = tmp;
+      }
+    }
+  }
+  free(stack);
+  free(depth);
+}
 
 /**
- * This function converts a ULL to little endian (and vice versa)
- * Then trims any trailing zeros e.g. 0x687000 -> 0x687
- * @params x - the ull to change
- * @returns the new representation of the ULL 
- */ 
-unsigned long long to_little_endian(unsigned long long x) {
-  unsigned long long y = (
-    ((x >> 56) & 0x00000000000000ff) |
-    ((x >> 40) & 0x000000000000ff00) |
-    ((x >> 24) & 0x0000000000ff0000) |
-    ((x >> 8) &  0x00000000ff000000) | 
-    ((x << 8) &  0x000000ff00000000) | 
-    ((x << 24) & 0x0000ff0000000000) |
-    ((x << 40) & 0x00ff000000000000) |
-    ((x << 56) & 0xff00000000000000)
-    );
-
-  int byte;
-  while (y != 0 && (byte = (y & 0xFF)) == 0) {
-    y = y >> 8;
-  }
-  return y;
+ * This function prints every plausible task_struct carved from the dump
+ * @params dump - the opened dump
+*/
+void print_carved_tasks(Dump *dump) {
+  CarveParams params = {
+    .comm_offset = comm_offset,
+    .pid_offset = pid_offset,
+    .tasks_offset = tasks_offset,
+    .parent_offset = parent_offset,
+    .task_size = task_struct_size,
+    .la57 = LA57,
+    .threads = NUM_THREADS ? NUM_THREADS : sysconf(_SC_NPROCESSORS_ONLN),
+  };
+  CarveResult *carved = carve_tasks(dump, &params);
+  STATS_ADD(tasks, carved->count);
+
+  static const OutputColumn columns[] = {
+    { "name", OUTPUT_STR, 20 },
+    { "pid", OUTPUT_INT, 6 },
+    { "paddr", OUTPUT_HEX, 18 },
+    { "next", OUTPUT_PTR, 0 },
+    { "parent", OUTPUT_PTR, 0 },
+  };
+  Output *out = output_open(fileno(stdout), OUTPUT_FORMAT, columns, sizeof(columns) / sizeof(columns[0]),
+    " Name               PID    Phys Addr          Next Task Addr        Parent Task Addr\n"
+    "==============================================================================================\n");
+  for (int i = 0; i < carved->count; i++) {
+    CarvedTask *t = &carved->tasks[i];
+    output_str(out, t->comm);
+    output_int(out, t->pid);
+    output_hex(out, t->paddr);
+    output_hex(out, t->next);
+    output_hex(out, t->parent);
+  }
+  output_close(out);
+  carve_result_free(carved);
 }
 
 /**
- * This function translates a virtual address to a physical address
- * (Cannot be used if static offset - use get_lime_headers)
- * (only works for nokaslr so far)
- * SAFE TO SEEK
- * @params fd - file descriptor
- * @params list - list of lime headers
- * @params vaddr - the virtual address to be translated
- * @returns paddr - the physical address or -1 on failure 
+ * This function analyses one dump with an already parsed System.map
+ * @params map - the parsed System.map of the dump's kernel
+ * @params dump_filename - the name of the memory dump
+ * @params profile - the profile already loaded for the dump, NULL for the
+ * -p one or to pick it out of PROFILE_DIR here
 */
-unsigned long long paddr_translation(int fd, LHdr_list *list, unsigned long long vaddr) {
-  if (!KERNEL_MAP_SHIFT) {
-    _die("STATIC SHIFT not set");
+void analyse_dump(SymbolTable *map, const char* dump_filename, Profile *profile) {
+  /* open dump file and map every lime block */
+  STATS_INPUT = dump_filename;
+  char index_filename[4096];
+  snprintf(index_filename, sizeof(index_filename), "%s%s", dump_filename, DUMP_INDEX_SUFFIX);
+  Dump *dump = dump_open_indexed(dump_filename, USE_INDEX ? index_filename : NULL);
+
+  if (profile) {
+    apply_profile(profile);
+  } else if (PROFILE_DIR) {
+    load_profile_for_dump(dump);
   }
+
+  if (CARVE) {
+    unsigned long long start = stats_now();
+    print_carved_tasks(dump);
+    stats_phase(STATS_CARVE, start);
+    dump_close(dump);
+    return;
+  }
+  
+  /* find init_task and the kernel shift */
+  unsigned long long init_task_vaddr = get_symbol_vaddr(map, INIT_TASK);
+  unsigned long long pgt_vaddr = get_symbol_vaddr(map, INIT_PGT);
+  unsigned long long start = stats_now();
+  unsigned long long init_task_paddr = find_init_task(dump, init_task_vaddr, pgt_vaddr);
+  stats_phase(STATS_LOCATE, start);
   
-  if (vaddr > KERNEL_MAP_SHIFT) {
-    return vaddr - KERNEL_MAP_SHIFT;
+  /* set the physical address of the page tables, KASLR moves the image as a whole */
+  if (init_task_vaddr != (unsigned long long) -1) {
+    PGT_PADDR = init_task_paddr + pgt_vaddr - init_task_vaddr;
+  } else {
+    PGT_PADDR = pgt_vaddr - KERNEL_MAP_SHIFT;
   }
+  kernel_vtop = vtop_create(dump, PGT_PADDR, LA57);
 
-  //return vaddr - 0xffff880000000000;
-
-  unsigned long long pa_pdpte = 0;
-  unsigned long long pa_pde = 0;
-  unsigned long long pa_pte = 0;
-  unsigned long long pa_page = 0;
-
-  unsigned int pgt_offset = (vaddr & PAGE_MAP_MASK) >> 39;
-  unsigned int pdpt_offset = (vaddr & PDPT_MASK) >> 30;
-  unsigned int pde_offset = (vaddr & PDE_MASK) >> 21;
-  unsigned int pte_offset = (vaddr & PTE_MASK) >> 12;
-  unsigned int page_offset = vaddr & PAGE_OFF_MASK;
-
-  /* read address of page directory pointer table */
-  paddr_to_offset(fd, list, PGT_PADDR + (8 * pgt_offset));
-  printf("\n\npme: %lx\n", lseek64(fd, 0, SEEK_CUR));
-  if (read(fd, &pa_pdpte, sizeof(unsigned long long)) == -1) {
-    _die("Failure to read in pa_pdpt: %llx", PGT_PADDR + (8 * pgt_offset));
+  /* fill the init_task task_struct */
+  struct task_struct init_task;
+  task_struct_init(&init_task);
+  unsigned char *buf = malloc(task_struct_size);
+  const unsigned char *task = fetch_task(dump, init_task_paddr, buf);
+  if (!task) {
+    _die("init_task not in dump: %llx", init_task_paddr);
   }
-  printf("pa_pdpt: %llx, %llx\n", pa_pdpte, to_little_endian(pa_pdpte));
-
-  /* read address of page directory */
-  paddr_to_offset(fd, list, pa_pdpte + (8 * pdpt_offset));
-  printf("\n\npa_pdee: %lx\n", lseek64(fd, 0, SEEK_CUR));
-  if (read(fd, &pa_pde, sizeof(unsigned long long)) == -1) {
-    _die("Failure to read in pa_pdpt: %llx", pa_pdpte + (8 * pdpt_offset));
+  decode_task(task, &init_task);
+  free(buf);
+
+  /* walk the task list, listing the processes as they are found */
+  Output *out = NULL;
+  if (EXTRACT_PID == -1 && !PATTERNS) {
+    out = output_open(fileno(stdout), OUTPUT_FORMAT, task_columns, sizeof(task_columns) / sizeof(task_columns[0]),
+      " Name               PID    PPID    Next Task Addr        Parent Task Addr\n"
+      "==============================================================================\n");
   }
-  printf("pa_pde: %llx, %llx\n",pa_pde, to_little_endian(pa_pde));
-
-  /* read address of page tabe */
-  paddr_to_offset(fd, list, to_little_endian(pa_pde) + (8 * pde_offset));
-  if (read(fd, &pa_pte, sizeof(unsigned long long)) == -1) {
-    _die("Failure to read in pa_pdpt: %llx", pa_pde + (8 * pde_offset));
+  start = stats_now();
+  ProcTree *tree = walk_process_list(dump, &init_task, init_task_paddr + KERNEL_MAP_SHIFT, out);
+  stats_phase(STATS_WALK, start);
+  if (EXTRACT_PID != -1) {
+    start = stats_now();
+    extract_process_pages(dump, tree);
+    stats_phase(STATS_EXTRACT, start);
+    proctree_free(tree);
+    vtop_free(kernel_vtop);
+    dump_close(dump);
+    return;
   }
-  printf("pa_pte: %llx, %llx\n", pa_pte, to_little_endian(pa_pte));
-
-  /* read address of page */
-  paddr_to_offset(fd, list, to_little_endian(pa_pte) + (8 * pte_offset));
-  if (read(fd, &pa_page, sizeof(unsigned long long)) == -1) {
-    _die("Failure to read in pa_pdpt: %llx", pa_pte + (8 * pte_offset));
+  if (PATTERNS) {
+    start = stats_now();
+    print_scan_hits(dump, tree);
+    fflush(stdout);
+    stats_phase(STATS_SCAN, start);
+    proctree_free(tree);
+    vtop_free(kernel_vtop);
+    dump_close(dump);
+    return;
+  }
+  start = stats_now();
+  output_close(out);
+  if (TREE) {
+    print_process_tree(tree);
   }
-  printf("pa_page: %llx, %llx\n",pa_page, to_little_endian(pa_page));
+  if (MAPS) {
+    print_process_maps(dump, tree);
+  }
+  fflush(stdout);
+  stats_phase(STATS_PRINT, start);
+  proctree_free(tree);
 
-  return to_little_endian(pa_page) + (8 * page_offset);
+  vtop_free(kernel_vtop);
+  dump_close(dump);
 }
 
+/**
+ * This is the "main" processing function to process the dump
+ * @params sys_filename - the filename of the System.map-$(uname -r)
+ * @params dump_filename - the name of the memory dump
+*/
+void process_dump(const char* sys_filename, const char* dump_filename) {
+  /* open map file and load into array */
+  unsigned long long start = stats_now();
+  int sysmap_fd = open_file(sys_filename);
+  SymbolTable *map = parse_system_map(sysmap_fd);
+  stats_phase(STATS_SYMBOLS, start);
 
+  analyse_dump(map, dump_filename, NULL);
+  symbol_table_free(map);
+}
 
 /**
- * This function prints out all the processes in the task_struct list starting at
- * the task_struct passed
- * @params ts - the task_struct to be pased first
+ * This function runs one batch job in its worker process
 */
-void print_process_list(int fd, LHdr_list *list, struct task_struct *init_task) {
-  int isSwapperflag = 1;
-  struct task_struct curr;
-  task_struct_init(&curr);
-
-  curr.pid = init_task->pid;
-  curr.ppid = init_task->ppid;
-  strncpy(curr.comm, init_task->comm, TASK_COMM_LEN - 1);
-  memcpy(&curr.tasks, &init_task->tasks, sizeof(struct list_head));
-  memcpy(&curr.parent_ptr, &init_task->parent_ptr, sizeof(struct task_struct *));
-
-  printf(" Name%*sPID%*sPPID%*sNext Task Addr%*sParent Task Addr\n", 
-    15, " ", 4, " ", 4, " ", 8, " ");
-  printf("==============================================================================\n");
+static void process_batch_job(BatchJob *job) {
+  memset(&stats, 0, sizeof(stats)); // the parent's parsing is reported by the parent
+  analyse_dump(job->map, job->dump, job->prof);
+}
 
-  unsigned long long next_addr;
-  while(curr.pid != 0 || isSwapperflag) {
-    printf("%-20s %-6d %-6d %p %p\n", 
-      curr.comm, curr.pid, curr.ppid, curr.tasks.next, curr.parent_ptr);
-    
-    next_addr = (unsigned long long) curr.tasks.next - STATIC_SHIFT;
-    if (paddr_to_offset(fd, list, next_addr - tasks_offset + 1) == -1) {
-      break; // reached swapper/0
+/**
+ * This function reads the PROFILE_DIR profile name of a batch dump
+ * The dump is opened in a child process, so a dump that _dies fails only
+ * its own job, from its worker, as it would without -P
+ * @params dump_filename - the dump
+ * @params path - set to the profile's file name
+ * @params len - size of path
+ * @returns 0 or -1 if the dump, its release or its profile was not found
+*/
+static int batch_dir_profile_path(const char *dump_filename, char *path, int len) {
+  int fds[2];
+  if (pipe(fds) == -1) {
+    _die("process_batch - Unable to create a pipe");
+  }
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == -1) {
+    _die("process_batch - Unable to fork");
+  }
+  if (!pid) {
+    close(fds[0]);
+    STATS_FILE = NULL; // the worker reports the dump
+    if (!freopen("/dev/null", "w", stdout) || !freopen("/dev/null", "w", stderr)) {
+      _exit(1);
+    }
+    char index_filename[4096];
+    snprintf(index_filename, sizeof(index_filename), "%s%s", dump_filename, DUMP_INDEX_SUFFIX);
+    Dump *dump = dump_open_indexed(dump_filename, USE_INDEX ? index_filename : NULL);
+    char release[PROFILE_RELEASE_LEN];
+    if (find_profile_for_dump(dump, release, path, len) == 0 && write(fds[1], path, strlen(path) + 1) == -1) {
+      _exit(1);
     }
+    dump_close(dump); // keeps the release in the index for the worker
+    _exit(0);
+  }
 
-    get_task_attr(fd, &curr, comm_offset, TASK_COMM_LEN, TASK_COMM_ID);
-    get_task_attr(fd, &curr, pid_offset, TASK_PID_LEN, TASK_PID_ID);
-    get_task_attr(fd, &curr, tasks_offset - 1, TASK_TASKS_LEN, TASK_TASKS_ID);
-    get_task_attr(fd, &curr, parent_offset - 1, TASK_PARENT_PTR_LEN, TASK_PARENT_PTR_ID);
-    get_parent_pid(fd, list, &curr);
-        
-    isSwapperflag = 0;
+  close(fds[1]);
+  int got = 0;
+  ssize_t n;
+  while (got < len && (n = read(fds[0], path + got, len - got)) != 0) {
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n == -1) {
+      break;
+    }
+    got += n;
   }
+  close(fds[0]);
+  waitpid(pid, NULL, 0);
+  STATS_ADD(syscalls, 4);
+  return got > 0 && path[got - 1] == '\0' ? 0 : -1;
 }
 
 /**
- * ****************************************************
- * FILE PARSING
- * ****************************************************
-*/
-
-/**
- * This function parses the system map file and returns a pointer 
- * to an array of symbols
- * Closes the file descriptor on exit!
- * @params fd - file descriptor of system map
- * @return an array of symbol structs - struct symbol { char* : symbol, ull : vaddr}
+ * This function analyses every dump of a manifest
+ * Each distinct System.map and profile (by content hash) is parsed once,
+ * before the workers are forked, and shared by every dump that uses it;
+ * with -P each dump's kernel release is read first to pick its profile
+ * @params manifest - lines of "<dump> <System.map> [profile]"
+ * @params out_dir - directory for the per dump outputs
+ * @params workers - dumps analysed at once
+ * @returns the number of dumps that failed
 */
-Map** parse_system_map(int fd) {
-  unsigned long long fileSize = get_file_length(fd);
-  char* buff = malloc(sizeof(char) * (fileSize + 2));
-  if ((read(fd, buff,fileSize) == -1)) {
-    _die("parse_system_map - Unable to read in system map");
-  }
-  buff[fileSize] = '\0';
-
-  Map **map = malloc (SYSTEM_MAP_SIZE * sizeof(Map));
-
-  char *tok_line;
-  char *tok_line_end;
-  char *tok_space;
-  char *tok_space_end;
-  char *strtol_ptr;
-  tok_line = strtok_r(buff, "\n", &tok_line_end);
-  
-  int index = 0; //line being parsed
-  int i = 0; // position in line 0, 1, 2 -> addr, type, sym
-
-  while(tok_line) { 
-    map[index] = malloc(sizeof(Map));
-    tok_space = strtok_r(tok_line, " ", &tok_space_end);
-    while(tok_space) {
-      switch(i) {
-        case 0: // Address 
-          map[index]->vaddr = strtoull(tok_space, &strtol_ptr, 16);
-          break;
-        case 1:
-          // not used
-          break;
-        case 2: // Symbol
-          strncpy(map[index]->symbol, tok_space, SYMBOL_SIZE);
-          break;
-        default:
-          _debug("DEBUG: Error parsing a symbol struct\n");
+int process_batch(const char* manifest, const char* out_dir, int workers) {
+  int count;
+  STATS_INPUT = manifest;
+  BatchJob *jobs = batch_read_manifest(manifest, &count);
+  BatchCache maps = { 0 };
+  BatchCache profiles = { 0 };
+
+  for (int i = 0; i < count; i++) {
+    unsigned long long hash = hash_file(jobs[i].sysmap);
+    jobs[i].map = batch_cache_lookup(&maps, hash);
+    if (!jobs[i].map) {
+      unsigned long long start = stats_now();
+      jobs[i].map = parse_system_map(open_file(jobs[i].sysmap));
+      stats_phase(STATS_SYMBOLS, start);
+      batch_cache_insert(&maps, hash, jobs[i].map);
+    }
+    if (jobs[i].profile) {
+      hash = hash_file(jobs[i].profile);
+      jobs[i].prof = batch_cache_lookup(&profiles, hash);
+      if (!jobs[i].prof) {
+        jobs[i].prof = open_profile(jobs[i].profile);
+        batch_cache_insert(&profiles, hash, jobs[i].prof);
+      }
+    } else if (PROFILE_DIR) {
+      char path[4096];
+      if (batch_dir_profile_path(jobs[i].dump, path, sizeof(path)) == -1) {
+        continue; // the worker reports why
+      }
+      hash = hash_file(path);
+      jobs[i].prof = batch_cache_lookup(&profiles, hash);
+      if (!jobs[i].prof) {
+        jobs[i].prof = open_profile(path);
+        batch_cache_insert(&profiles, hash, jobs[i].prof);
       }
-      i += 1;
-      tok_space = strtok_r(NULL, " ", &tok_space_end);
     }
-    i = 0;
-    index += 1;
-    tok_line = strtok_r(NULL, "\n", &tok_line_end);
   }
+  _debug("DEBUG: %d dumps, %d System.maps, %d profiles", count, maps.count, profiles.count);
 
-  close(fd);
-  return map;
+  int failed = batch_run(jobs, count, workers, out_dir, process_batch_job);
+
+  for (int i = 0; i < maps.count; i++) {
+    symbol_table_free(maps.entries[i].value);
+  }
+  for (int i = 0; i < profiles.count; i++) {
+    profile_free(profiles.entries[i].value);
+  }
+  free(maps.entries);
+  free(profiles.entries);
+  batch_free_manifest(jobs, count);
+  return failed;
 }
 
 /**
- * This is the "main" processing function to process the dump
- * @params sys_filename - the filename of the System.map-$(uname -r)
- * @params dump_filename - the name of the memory dump
+ * This function writes the counters for --stats, registered with atexit so
+ * runs that _die are reported too
 */
-void process_dump(const char* sys_filename, const char* dump_filename) {
-  /* open map file and load into array */
-  int sysmap_fd = open_file(sys_filename);
-  Map** map = parse_system_map(sysmap_fd);
-  
-  /* open dump file and create linked list of lime headers*/
-  int dump_fd = open_file(dump_filename);
-  LHdr_list *headerList = get_lime_headers(dump_fd);
-  
-  /* find and fill the init_task task_struct */
-  struct task_struct init_task;
-  task_struct_init(&init_task);
-  unsigned long long init_task_vaddr = get_symbol_vaddr(map, INIT_TASK);
-  find_init_task(dump_fd, headerList, &init_task, init_task_vaddr);
-  
-  /* set the physical address of the page tables */
-  unsigned long long pgt_vaddr = get_symbol_vaddr(map, INIT_PGT);
-  PGT_PADDR = pgt_vaddr - KERNEL_MAP_SHIFT;
-
-  /* printf the process list */
-  print_process_list(dump_fd, headerList, &init_task);
+static void write_stats() {
+  if (!STATS_FILE) {
+    return;
+  }
+  FILE *out = strcmp(STATS_FILE, "-") ? fopen(STATS_FILE, "a") : stderr;
+  if (!out) {
+    fprintf(stderr, "Could not open file: %s\n", STATS_FILE);
+    return;
+  }
+  stats_write_json(out, STATS_INPUT);
+  if (out != stderr) {
+    fclose(out);
+  }
 }
 
 /**
  * This functions handles command line arguments
  * 
  * usage: 
- *   sudo ./main -s /PathTo/System.map-$(uname -r) -d /PathTo/memoryDump
+ *   sudo ./main -s /PathTo/System.map-$(uname -r) -d /PathTo/memoryDump [-p profile | -P dir] [-5] [-j threads] [-c] [-t] [-m] [-f format]
+ *   sudo ./main -s /PathTo/System.map-$(uname -r) -d /PathTo/memoryDump -x pid [-O file] [--raw]
+ *   sudo ./main -s /PathTo/System.map-$(uname -r) -d /PathTo/memoryDump -g pattern... [-G file]
+ *   sudo ./main -b manifest [-o out_dir] [-w workers] [options]
+ *   --stats[=file] and --no-index may be added to either
 */
 int main(int argc, char** argv) {
   // if (getuid() != 0) {
@@ -638,11 +990,22 @@ int main(int argc, char** argv) {
 
   char* sys_filename = NULL;
   char* dump_filename = NULL;
+  char* profile_filename = NULL;
+  char* manifest_filename = NULL;
+  char* out_dir = ".";
+  int workers = 0;
   int sflag = 0;
   int dflag = 0;
   int opt = 0;
-
-  while((opt = getopt (argc, argv, "s:d:"))!= -1) {
+  vma_params_init(&vma_params);
+  struct option long_options[] = {
+    { "stats", optional_argument, NULL, 'S' },
+    { "no-index", no_argument, NULL, 'I' },
+    { "raw", no_argument, NULL, 'R' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  while((opt = getopt_long (argc, argv, "s:d:p:P:5j:ctmx:O:g:G:b:o:w:f:", long_options, NULL))!= -1) {
     switch(opt) {
       case 's':
         sflag = 1;
@@ -652,6 +1015,73 @@ int main(int argc, char** argv) {
         dflag = 1;
         dump_filename = optarg;
         break;
+      case 'p':
+        profile_filename = optarg;
+        break;
+      case 'P':
+        PROFILE_DIR = optarg;
+        break;
+      case '5':
+        LA57 = 1;
+        break;
+      case 'j':
+        NUM_THREADS = atoi(optarg);
+        break;
+      case 'c':
+        CARVE = 1;
+        break;
+      case 't':
+        TREE = 1;
+        break;
+      case 'm':
+        MAPS = 1;
+        break;
+      case 'x':
+        EXTRACT_PID = atoi(optarg);
+        break;
+      case 'O':
+        EXTRACT_FILE = optarg;
+        break;
+      case 'R':
+        EXTRACT_FORMAT = EXTRACT_RAW;
+        break;
+      case 'g':
+        if (!PATTERNS) {
+          PATTERNS = scan_set_create();
+        }
+        if (scan_set_add(PATTERNS, optarg) == -1) {
+          _die("Bad pattern: %s", optarg);
+        }
+        break;
+      case 'G':
+        if (!PATTERNS) {
+          PATTERNS = scan_set_create();
+        }
+        if (scan_set_load(PATTERNS, optarg) == -1) {
+          _die("Unable to load patterns from %s", optarg);
+        }
+        break;
+      case 'b':
+        manifest_filename = optarg;
+        break;
+      case 'o':
+        out_dir = optarg;
+        break;
+      case 'w':
+        workers = atoi(optarg);
+        break;
+      case 'f':
+        OUTPUT_FORMAT = output_format(optarg);
+        if (OUTPUT_FORMAT == -1) {
+          _die("Unknown output format: %s", optarg);
+        }
+        break;
+      case 'S':
+        STATS_FILE = optarg ? optarg : "-";
+        break;
+      case 'I':
+        USE_INDEX = 0;
+        break;
       case ':': /* Fall through is intentional */
       case '?': /* Fall through is intentional */
       default:
@@ -661,7 +1091,50 @@ int main(int argc, char** argv) {
     }
   }
 
-  char* usage = "Usage: sudo ./main -s /path/to/System.map -d /path/to/dump\n\n";
+  char* usage = "Usage: sudo ./main -s /path/to/System.map -d /path/to/dump [-p profile | -P dir] [-5] [-j threads] [-c] [-t] [-m] [-f format] [--stats[=file]] [--no-index]\n"
+    "       sudo ./main -s /path/to/System.map -d /path/to/dump -x pid [-O file] [--raw] [options]\n"
+    "       sudo ./main -s /path/to/System.map -d /path/to/dump -g pattern [-g pattern...] [-G file] [options]\n"
+    "       sudo ./main -b manifest [-o out_dir] [-w workers] [options]\n\n"
+    "  -p  struct profile (binary or dwarf_output_json) to take task_struct offsets from\n"
+    "  -P  directory of profiles named <kernel release>.prof or .json, picked by the dump's banner\n"
+    "  -5  dump is from a kernel using 5-level paging (LA57)\n"
+    "  -j  number of threads used to scan the dump (default: one per cpu)\n"
+    "  -c  carve task_structs from the whole dump, including unlinked ones\n"
+    "  -t  also print the process tree\n"
+    "  -m  also print the memory map (VMAs and backing files) of every process\n"
+    "  -f  format of the process list and of -c: table (default), csv or json (JSON Lines),\n"
+    "      rows are written as the tasks are found; -t and -m stay text and come after\n"
+    "  -x  write the resident user pages of process pid as an ELF core instead of the list\n"
+    "  -O  file written by -x (default: core.<pid>, or pages.<pid> with --raw)\n"
+    "  --raw  have -x write the bare pages, plus <file>.map saying where each run of them goes\n"
+    "  -g  search the whole dump for a string, or hex:<bytes>, and print each hit with the\n"
+    "      processes mapping it instead of the list; may be repeated, all are searched at once\n"
+    "  -G  file of patterns for -g, one per line\n"
+    "  -b  analyse every \"<dump> <System.map> [profile]\" line of a manifest\n"
+    "  -o  directory for the per dump outputs of -b (default: .)\n"
+    "  -w  dumps analysed at once by -b (default: one per cpu)\n"
+    "  --stats  at exit append the counters and phase timings as a line of JSON\n"
+    "           to file (default: stderr), one line per dump with -b\n"
+    "  --no-index  neither read nor write the <dump>.idx sidecar that caches the\n"
+    "              lime ranges, init_task and kernel release between runs\n";
+  if (LA57) {
+    STATIC_SHIFT = STATIC_SHIFT_LA57;
+  }
+  if (STATS_FILE) {
+    atexit(write_stats);
+  }
+  if (profile_filename) {
+    load_profile(profile_filename);
+  }
+  if (PATTERNS) {
+    scan_set_compile(PATTERNS);
+  }
+
+  if (manifest_filename) {
+    int failed = process_batch(manifest_filename, out_dir, workers ? workers : sysconf(_SC_NPROCESSORS_ONLN));
+    return failed ? 1 : 0;
+  }
+
   if (!sflag || !dflag) {
     _die("Did not pass system file name and/or dump filename\n%s", usage);
   }
@@ -0,0 +1,372 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "util.h"
+#include "dump.h"
+#include "symbols.h"
+#include "vtop.h"
+#include "locate.h"
+#include "profile.h"
+#include "aread.h"
+#include "rmap.h"
+#include "listwalk.h"
+
+/**
+ * This struct is a snapshot of what the process has cost so far
+ * rchar and the syscall counts come from /proc/self/io, which only counts
+ * read(2)/write(2) style calls; pages of the mapped dump show up as faults
+*/
+typedef struct bench_sample {
+  unsigned long long ns;
+  unsigned long long rchar;
+  unsigned long long syscalls;
+  unsigned long long faults;
+} BenchSample;
+
+/* task_struct layout, the defaults match main.c */
+unsigned long long comm_offset = 0x608;
+unsigned long long pid_offset = 0x450;
+unsigned long long tasks_offset = 0x358;
+unsigned long long parent_offset = 0x468;
+unsigned long long task_struct_size = 0x1ac0;
+
+BenchSample sample_cost = { 0 }; /* what taking a sample itself costs */
+
+static void take_sample(BenchSample *s) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  s->ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+  s->rchar = s->syscalls = 0;
+  FILE *f = fopen("/proc/self/io", "r");
+  if (f) {
+    char key[32];
+    unsigned long long val;
+    while (fscanf(f, "%31[^:]: %llu\n", key, &val) == 2) {
+      if (strcmp(key, "rchar") == 0) {
+        s->rchar = val;
+      } else if (strcmp(key, "syscr") == 0 || strcmp(key, "syscw") == 0) {
+        s->syscalls += val;
+      }
+    }
+    fclose(f);
+  }
+
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  s->faults = ru.ru_minflt + ru.ru_majflt;
+}
+
+/**
+ * This function prints one phase of the benchmark
+ * @params name - the phase
+ * @params start - sample taken before the phase
+ * @params items - what the phase processed (tasks, translations, bytes...)
+ * @params unit - what an item is
+*/
+static void report(const char *name, const BenchSample *start, unsigned long long items, const char *unit) {
+  BenchSample end;
+  take_sample(&end);
+  double secs = (end.ns - start->ns) / 1e9;
+  printf("%-12s %10.3f %12llu %-8s %14.0f %12llu %10llu %10llu\n", name, secs * 1e3, items, unit,
+    secs > 0 ? items / secs : 0,
+    end.rchar - start->rchar - sample_cost.rchar,
+    end.syscalls - start->syscalls - sample_cost.syscalls,
+    end.faults - start->faults);
+}
+
+/**
+ * This function resolves a kernel virtual address the way main.c does
+ * @returns the physical address or -1
+*/
+static unsigned long long translate(Translator *t, unsigned long long shift, unsigned long long vaddr) {
+  unsigned long long paddr;
+  if (vaddr > shift) {
+    return vaddr - shift;
+  }
+  if (vtop_translate(t, vaddr, &paddr, NULL) != VTOP_OK) {
+    return -1;
+  }
+  return paddr;
+}
+
+/**
+ * This function walks the task list from init_task and looks up every
+ * parent's pid, i.e. the work main.c does for the process list
+ * @params dump - the opened dump
+ * @params t - translator for the kernel page tables
+ * @params hit - init_task and the kernel shift
+ * @params vaddrs - filled with the tasks' direct map addresses
+ * @returns the number of tasks walked
+*/
+static int walk_tasks(Dump *dump, Translator *t, const LocateHit *hit, unsigned long long *vaddrs, int max) {
+  unsigned char *buf = malloc(task_struct_size);
+  unsigned long long first = hit->paddr + hit->shift;
+  unsigned long long vaddr = first;
+  unsigned long long checksum = 0;
+  int count = 0;
+  do {
+    unsigned long long paddr = translate(t, hit->shift, vaddr);
+    const unsigned char *task = paddr == (unsigned long long) -1 ? NULL : dump_ptr(dump, paddr, task_struct_size);
+    if (!task && paddr != (unsigned long long) -1 && dump_read(dump, paddr, buf, task_struct_size) == 0) {
+      task = buf; // spans lime blocks or compressed chunks
+    }
+    if (!task) {
+      _debug("DEBUG: task list broken at %llx", vaddr);
+      break;
+    }
+    int pid;
+    unsigned long long next, parent;
+    memcpy(&pid, task + pid_offset, sizeof(pid));
+    memcpy(&next, task + tasks_offset, sizeof(next));
+    memcpy(&parent, task + parent_offset, sizeof(parent));
+
+    checksum += pid + task[comm_offset];
+    int ppid;
+    if (dump_read(dump, translate(t, hit->shift, parent) + pid_offset, &ppid, sizeof(ppid)) == 0) {
+      checksum += ppid;
+    }
+
+    if (count < max) {
+      vaddrs[count] = vaddr;
+    }
+    count += 1;
+    vaddr = next - tasks_offset;
+  } while (vaddr != first && count < max);
+  _debug("DEBUG: walk checksum %llx", checksum);
+  free(buf);
+  return count;
+}
+
+/**
+ * This program times each stage of the analyser on one dump: System.map
+ * parsing, lime header parsing, finding init_task, a scan of the whole dump,
+ * the task walk and the page-table translation of every task (cached, sorted
+ * and with the reads in flight together through an AReader), e.g. on a dump
+ * written by mkdump
+ *
+ * usage:
+ *   ./membench -s System.map -d dump.lime [-p profile] [-5] [-j threads] [-i iterations] [-n max_tasks] [-q depth]
+*/
+int main(int argc, char** argv) {
+  char* sys_filename = NULL;
+  char* dump_filename = NULL;
+  char* profile_filename = NULL;
+  int la57 = 0;
+  int threads = 0;
+  int iterations = 5;
+  int max_tasks = 1 << 22;
+  int depth = AREAD_DEPTH;
+  int opt = 0;
+
+  while((opt = getopt (argc, argv, "s:d:p:5j:i:n:q:"))!= -1) {
+    switch(opt) {
+      case 's':
+        sys_filename = optarg;
+        break;
+      case 'd':
+        dump_filename = optarg;
+        break;
+      case 'p':
+        profile_filename = optarg;
+        break;
+      case '5':
+        la57 = 1;
+        break;
+      case 'j':
+        threads = atoi(optarg);
+        break;
+      case 'i':
+        iterations = atoi(optarg);
+        break;
+      case 'n':
+        max_tasks = atoi(optarg);
+        break;
+      case 'q':
+        depth = atoi(optarg);
+        break;
+      case ':': /* Fall through is intentional */
+      case '?': /* Fall through is intentional */
+      default:
+        printf("Invalid options or missing argument: '-%c'.\n",
+            opt);
+        break;
+    }
+  }
+
+  if (!sys_filename || !dump_filename) {
+    _die("Did not pass system file name and/or dump filename\n"
+      "Usage: ./membench -s System.map -d dump.lime [-p profile] [-5] [-j threads] [-i iterations] [-n max_tasks] [-q depth]\n"
+      "  -q  reads in flight for vtop-async, 0 reads with pread (default: %d)\n", AREAD_DEPTH);
+  }
+  if (iterations < 1) {
+    iterations = 1;
+  }
+
+  if (profile_filename) {
+    const char *wanted[] = { "task_struct" };
+    Profile *profile = profile_load(profile_filename, wanted, 1);
+    long long size = profile_struct_size(profile, "task_struct");
+    long long comm = profile_member_offset(profile, "task_struct", "comm");
+    long long pid = profile_member_offset(profile, "task_struct", "pid");
+    long long tasks = profile_member_offset(profile, "task_struct", "tasks");
+    long long parent = profile_member_offset(profile, "task_struct", "parent");
+    if (size == -1 || comm == -1 || pid == -1 || tasks == -1 || parent == -1) {
+      _die("Profile has no task_struct with comm, pid, tasks and parent: %s", profile_filename);
+    }
+    task_struct_size = size;
+    comm_offset = comm;
+    pid_offset = pid;
+    tasks_offset = tasks;
+    parent_offset = parent;
+    profile_free(profile);
+  }
+
+  BenchSample a, b, start;
+  take_sample(&a);
+  take_sample(&b);
+  sample_cost.rchar = b.rchar - a.rchar;
+  sample_cost.syscalls = b.syscalls - a.syscalls;
+
+  printf("%-12s %10s %12s %-8s %14s %12s %10s %10s\n",
+    "phase", "ms", "items", "unit", "items/s", "rchar", "syscalls", "faults");
+
+  take_sample(&start);
+  SymbolTable *map = NULL;
+  for (int i = 0; i < iterations; i++) {
+    if (map) {
+      symbol_table_free(map);
+    }
+    map = parse_system_map(open_file(sys_filename));
+  }
+  report("symbols", &start, (unsigned long long) map->count * iterations, "symbols");
+
+  take_sample(&start);
+  Dump *dump = NULL;
+  for (int i = 0; i < iterations; i++) {
+    if (dump) {
+      dump_close(dump);
+    }
+    dump = dump_open(dump_filename);
+  }
+  report("headers", &start, (unsigned long long) dump->num_ranges * iterations, "ranges");
+
+  unsigned long long init_task_vaddr = get_symbol_vaddr(map, "init_task");
+  unsigned long long pgt_vaddr = get_symbol_vaddr(map, "init_pgt");
+  if (pgt_vaddr == (unsigned long long) -1) {
+    pgt_vaddr = get_symbol_vaddr(map, "init_level4_pgt");
+  }
+  LocateParams params = {
+    .comm = "swapper/0",
+    .comm_offset = comm_offset,
+    .tasks_offset = tasks_offset,
+    .parent_offset = parent_offset,
+    .task_size = task_struct_size,
+    .init_task_vaddr = init_task_vaddr == (unsigned long long) -1 ? 0 : init_task_vaddr,
+    .pgt_vaddr = pgt_vaddr == (unsigned long long) -1 ? 0 : pgt_vaddr,
+    .la57 = la57,
+    .threads = threads ? threads : sysconf(_SC_NPROCESSORS_ONLN),
+  };
+  unsigned long long dump_bytes = 0;
+  for (int i = 0; i < dump->num_ranges; i++) {
+    dump_bytes += dump->ranges[i].e_addr - dump->ranges[i].s_addr + 1;
+  }
+  LocateHit hit;
+  take_sample(&start);
+  if (locate_init_task(dump, &params, &hit) == -1) {
+    _die("Could not find init_task in the dump!");
+  }
+  report("locate", &start, 1, "init_task");
+
+  /* a signature that is nowhere in the dump makes every byte be scanned */
+  LocateParams absent = params;
+  absent.comm = "membench/absent";
+  LocateHit none;
+  take_sample(&start);
+  locate_init_task(dump, &absent, &none);
+  report("scan", &start, dump_bytes, "bytes");
+
+  Translator *t = vtop_create(dump, locate_pgt_paddr(&params, hit.paddr, hit.shift), la57);
+  unsigned long long *vaddrs = malloc(sizeof(unsigned long long) * max_tasks);
+  take_sample(&start);
+  int count = walk_tasks(dump, t, &hit, vaddrs, max_tasks);
+  report("walk", &start, count, "tasks");
+
+  /* the same list through a ListWalker, entries prefetched ahead of the decoding */
+  ListParams list = {
+    .head = hit.paddr + hit.shift + tasks_offset,
+    .member_offset = tasks_offset,
+    .entry_size = task_struct_size,
+    .kernel_shift = hit.shift,
+    .la57 = la57,
+    .ahead = depth ? depth : 1,
+  };
+  take_sample(&start);
+  ListWalker *lw = list_walk_create(dump, t, &list);
+  unsigned long long entry_vaddr;
+  const unsigned char *entry;
+  int listed = 1; // init_task is the head
+  while (list_walk_next(lw, &entry_vaddr, &entry) == LIST_WALK_ENTRY) {
+    listed += 1;
+  }
+  _debug("DEBUG: task list %s", list_walk_error(lw->status));
+  list_walk_free(lw);
+  report("walk-list", &start, listed, "tasks");
+
+  /* the task list without init_task, which is in the text mapping */
+  unsigned long long *paddrs = malloc(sizeof(unsigned long long) * count);
+  int n = count - 1;
+  vtop_flush(t);
+  take_sample(&start);
+  for (int i = 0; i < n; i++) {
+    vtop_translate(t, vaddrs[i + 1], &paddrs[i], NULL);
+  }
+  report("vtop-cold", &start, n, "vaddrs");
+
+  take_sample(&start);
+  for (int i = 0; i < n; i++) {
+    vtop_translate(t, vaddrs[i + 1], &paddrs[i], NULL);
+  }
+  report("vtop-warm", &start, n, "vaddrs");
+
+  vtop_flush(t);
+  take_sample(&start);
+  vtop_translate_batch(t, vaddrs + 1, n, paddrs, NULL);
+  report("vtop-batch", &start, n, "vaddrs");
+
+  vtop_flush(t);
+  AReader *ar = aread_create(dump, depth);
+  take_sample(&start);
+  vtop_translate_async(t, ar, vaddrs + 1, n, paddrs, NULL);
+  report("vtop-async", &start, n, "vaddrs");
+  aread_free(ar);
+
+  /* the kernel's tables only, keeping the direct map (0 skips nothing in the
+   * kernel half) so the map has an entry for every page of memory */
+  take_sample(&start);
+  Rmap *rmap = rmap_build(dump, t->root, NULL, la57, 0, threads ? threads : sysconf(_SC_NPROCESSORS_ONLN));
+  report("rmap", &start, rmap->tables, "tables");
+
+  take_sample(&start);
+  unsigned long long owned = 0;
+  for (int i = 0; i < n; i++) {
+    owned += rmap_lookup(rmap, paddrs[i], NULL, 0);
+  }
+  report("rmap-lookup", &start, n, "paddrs");
+  _debug("DEBUG: %llu owners of %d task_structs", owned, n);
+  rmap_free(rmap);
+
+  printf("\n%d tasks, init_task at %llx, kernel shift %llx\n", count, hit.paddr, hit.shift);
+
+  free(paddrs);
+  free(vaddrs);
+  vtop_free(t);
+  dump_close(dump);
+  symbol_table_free(map);
+  return 0;
+}
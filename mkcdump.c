@@ -0,0 +1,65 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "util.h"
+#include "dump.h"
+#include "cdump.h"
+
+/**
+ * This program converts a LiME dump into the seekable compressed format
+ * (see cdump.h) that the analyser reads directly
+ *
+ * usage:
+ *   ./mkcdump -i dump.lime -o dump.cdump [-c chunk_kb] [-l level] [-j threads]
+*/
+int main(int argc, char** argv) {
+  char* in_filename = NULL;
+  char* out_filename = NULL;
+  unsigned int chunk_size = CDUMP_CHUNK_SIZE;
+  int level = 1;
+  int threads = 0;
+  int opt = 0;
+
+  while((opt = getopt (argc, argv, "i:o:c:l:j:"))!= -1) {
+    switch(opt) {
+      case 'i':
+        in_filename = optarg;
+        break;
+      case 'o':
+        out_filename = optarg;
+        break;
+      case 'c':
+        chunk_size = atoi(optarg) * 1024;
+        break;
+      case 'l':
+        level = atoi(optarg);
+        break;
+      case 'j':
+        threads = atoi(optarg);
+        break;
+      case ':': /* Fall through is intentional */
+      case '?': /* Fall through is intentional */
+      default:
+        printf("Invalid options or missing argument: '-%c'.\n",
+            opt);
+        break;
+    }
+  }
+
+  if (!in_filename || !out_filename) {
+    _die("Did not pass input and/or output file name\n"
+      "Usage: ./mkcdump -i dump.lime -o dump.cdump [-c chunk_kb] [-l level] [-j threads]\n");
+  }
+  if (chunk_size < 4096 || chunk_size % 4096) {
+    _die("The chunk size must be a multiple of 4 KB");
+  }
+
+  Dump *dump = dump_open(in_filename);
+  if (cdump_write(dump, out_filename, chunk_size, level, threads ? threads : sysconf(_SC_NPROCESSORS_ONLN)) == -1) {
+    _die("Could not write compressed dump: %s", out_filename);
+  }
+  dump_close(dump);
+  return 0;
+}
@@ -0,0 +1,613 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+
+#include "util.h"
+#include "dump.h"
+#include "vtop.h"
+#include "profile.h"
+#include "vma.h"
+
+#define MB (1ULL << 20)
+#define RAM_START 0x200000ULL                /* first physical address of the first range */
+#define KERNEL_PADDR 0x1000000ULL            /* physical load address of the kernel */
+#define KERNEL_TEXT 0xffffffff81000000ULL    /* its link address, what System.map has */
+#define KERNEL_TEXT_END 0xffffffffc0000000ULL
+#define DIRECT_MAP 0xffff880000000000ULL
+#define DIRECT_MAP_LA57 0xff11000000000000ULL
+
+/* kernel image layout, offsets from KERNEL_PADDR */
+#define BANNER_OFF 0x1000
+#define INIT_TASK_OFF 0x10000
+#define INIT_PGT_OFF 0x200000                /* page tables are allocated from here */
+
+#define TASK_ALIGN 64                        /* task_struct slab alignment */
+#define TASK_STRIDE 1000003ULL               /* spreads tasks over the slots */
+#define DECOY_INTERVAL MB                    /* a fake "swapper/0" every MB with -N */
+#define VMA_BASE 0x400000ULL                 /* first user address of a synthetic map */
+#define VMA_STRIDE 0x1000000ULL
+#define HEAP_BASE 0x100000000000ULL          /* an anonymous VMA reserved after the others */
+#define HEAP_SIZE (1ULL << 40)               /* 1 TB, a 2 MB page at its start and a 4 KB page halfway */
+#define MM_SHARE_INTERVAL 8                  /* every 8th process shares the previous one's mm */
+#define OBJ_ALIGN 64
+
+/**
+ * This struct is the dump being generated
+ * ranges[].data point into the mapped output file
+*/
+typedef struct synth {
+  DumpRange *ranges;
+  int num_ranges;
+  int levels;
+  unsigned long long next_table;  /* bump allocator for page-table pages */
+  unsigned long long tables_end;
+  unsigned long long seed;
+} Synth;
+
+/* task_struct layout, the defaults match main.c */
+unsigned long long comm_offset = 0x608;
+unsigned long long pid_offset = 0x450;
+unsigned long long tasks_offset = 0x358;
+unsigned long long parent_offset = 0x468;
+unsigned long long task_struct_size = 0x1ac0;
+VmaParams vma_params;
+
+/* backing files of the synthetic VMAs */
+const char *file_names[] = { "bash", "libc-2.27.so", "ld-2.27.so", "libpthread-2.27.so", "libm-2.27.so", "sshd", "java", "libjvm.so" };
+#define NUM_FILES (sizeof(file_names) / sizeof(file_names[0]))
+
+static unsigned long long next_rand(Synth *s) {
+  s->seed ^= s->seed << 13;
+  s->seed ^= s->seed >> 7;
+  s->seed ^= s->seed << 17;
+  return s->seed;
+}
+
+/**
+ * This function returns the byte at a physical address of the dump
+ * @returns the pointer, dies if paddr is not in a range
+*/
+static unsigned char* synth_ptr(Synth *s, unsigned long long paddr) {
+  for (int i = 0; i < s->num_ranges; i++) {
+    if (paddr >= s->ranges[i].s_addr && paddr <= s->ranges[i].e_addr) {
+      return (unsigned char *) s->ranges[i].data + (paddr - s->ranges[i].s_addr);
+    }
+  }
+  _die("synth_ptr - %llx is not in a range", paddr);
+  return NULL;
+}
+
+static void write_u64(Synth *s, unsigned long long paddr, unsigned long long val) {
+  memcpy(synth_ptr(s, paddr), &val, sizeof(val));
+}
+
+static unsigned long long read_u64(Synth *s, unsigned long long paddr) {
+  unsigned long long val;
+  memcpy(&val, synth_ptr(s, paddr), sizeof(val));
+  return val;
+}
+
+/**
+ * This function maps one page in the kernel page tables
+ * Missing tables are taken from the bump allocator (already zero)
+ * @params s - the dump
+ * @params root - physical address of the top level table
+ * @params vaddr - page to map
+ * @params paddr - physical address of the page
+ * @params leaf - 0 for a 4 KB page, 1 for a 2 MB page
+*/
+static void map_page(Synth *s, unsigned long long root, unsigned long long vaddr, unsigned long long paddr, int leaf) {
+  unsigned long long table = root;
+  for (int level = s->levels - 1; level > leaf; level--) {
+    unsigned long long slot = table + 8 * ((vaddr >> (PAGE_SHIFT + 9 * level)) & 0x1ff);
+    unsigned long long entry = read_u64(s, slot);
+    if (!(entry & PTE_PRESENT)) {
+      if (s->next_table >= s->tables_end) {
+        _die("map_page - out of page-table pages");
+      }
+      entry = s->next_table | PTE_PRESENT | PTE_RW;
+      s->next_table += PAGE_SIZE;
+      write_u64(s, slot, entry);
+    }
+    table = entry & PTE_ADDR_MASK;
+  }
+  unsigned long long slot = table + 8 * ((vaddr >> (PAGE_SHIFT + 9 * leaf)) & 0x1ff);
+  write_u64(s, slot, paddr | PTE_PRESENT | PTE_RW | PTE_NX | (leaf ? PTE_PS : 0));
+}
+
+/**
+ * This function picks a process name for task i
+*/
+static void task_name(Synth *s, int i, char *comm) {
+  const char *names[] = { "kworker/%d:%d", "ksoftirqd/%d", "bash", "sshd", "java", "nginx", "postgres", "systemd-%d" };
+  const char *fmt = names[next_rand(s) % (sizeof(names) / sizeof(names[0]))];
+  snprintf(comm, 16, fmt, i % 64, i % 7);
+}
+
+/**
+ * This function returns the physical address of task slot n
+ * Slots are laid out after the kernel image in the first range, then in the
+ * other ranges in order
+*/
+static unsigned long long slot_paddr(Synth *s, unsigned long long kernel_end, unsigned long long slot_size, unsigned long long n) {
+  for (int i = 0; i < s->num_ranges; i++) {
+    unsigned long long start = i == 0 ? kernel_end : s->ranges[i].s_addr;
+    unsigned long long count = (s->ranges[i].e_addr + 1 - start) / slot_size;
+    if (n < count) {
+      return start + n * slot_size;
+    }
+    n -= count;
+  }
+  _die("slot_paddr - slot out of range");
+  return 0;
+}
+
+static unsigned long long align_obj(unsigned long long size) {
+  return (size + OBJ_ALIGN - 1) & ~(OBJ_ALIGN - 1ULL);
+}
+
+/**
+ * This struct hands out the task slots the task list does not use, for
+ * mm_structs, VMAs and files
+*/
+typedef struct slot_pool {
+  unsigned char *used;
+  unsigned long long num_slots;
+  unsigned long long next;
+} SlotPool;
+
+static unsigned long long pool_take(SlotPool *pool) {
+  while (pool->next < pool->num_slots && pool->used[pool->next]) {
+    pool->next += 1;
+  }
+  if (pool->next == pool->num_slots) {
+    _die("pool_take - out of free slots, add ranges or make them larger");
+  }
+  pool->used[pool->next] = 1;
+  return pool->next++;
+}
+
+/**
+ * This function writes the backing files: a struct file pointing at a
+ * dentry whose d_name.name points at the name, all in one slot
+ * @params base - physical address of the slot
+ * @params direct_map - where the slot is mapped
+ * @params files - set to the address of each struct file
+*/
+static void write_files(Synth *s, unsigned long long base, unsigned long long direct_map, unsigned long long *files) {
+  unsigned long long file_size = align_obj(vma_params.file_dentry_offset + 8);
+  unsigned long long dentry_size = align_obj(vma_params.dentry_name_offset + 8);
+  unsigned long long block = file_size + dentry_size + OBJ_ALIGN;
+  for (unsigned int f = 0; f < NUM_FILES; f++) {
+    unsigned long long file = base + f * block;
+    unsigned long long dentry = file + file_size;
+    unsigned long long name = dentry + dentry_size;
+    write_u64(s, file + vma_params.file_dentry_offset, direct_map + dentry);
+    write_u64(s, dentry + vma_params.dentry_name_offset, direct_map + name);
+    memcpy(synth_ptr(s, name), file_names[f], strlen(file_names[f]) + 1);
+    files[f] = direct_map + file;
+  }
+}
+
+/**
+ * This function writes an mm_struct and its VMA list into one slot
+ * VMAs alternate r-x, rw- and r-- and the last two are anonymous, then
+ * comes the reserved heap
+ * @params base - physical address of the slot
+ * @params pgd - address of the top level page table
+ * @returns the address of the mm_struct
+*/
+static unsigned long long write_mm(Synth *s, unsigned long long base, unsigned long long direct_map, unsigned long long pgd,
+    int num_vmas, const unsigned long long *files, int seed) {
+  const unsigned long long prot[] = { VMA_READ | VMA_EXEC, VMA_READ | VMA_WRITE, VMA_READ };
+  unsigned long long mm_size = align_obj((vma_params.mmap_offset > vma_params.pgd_offset ? vma_params.mmap_offset : vma_params.pgd_offset) + 8);
+  unsigned long long vma_size = align_obj(vma_params.vma_size);
+  write_u64(s, base + vma_params.pgd_offset, pgd);
+  write_u64(s, base + vma_params.mmap_offset, direct_map + base + mm_size);
+  for (int k = 0; k < num_vmas; k++) {
+    unsigned long long vma = base + mm_size + k * vma_size;
+    unsigned long long start = VMA_BASE + k * VMA_STRIDE;
+    write_u64(s, vma + vma_params.vm_start_offset, start);
+    write_u64(s, vma + vma_params.vm_end_offset, start + (k + 1) * PAGE_SIZE);
+    write_u64(s, vma + vma_params.vm_flags_offset, prot[k % 3]);
+    write_u64(s, vma + vma_params.vm_pgoff_offset, k);
+    write_u64(s, vma + vma_params.vm_file_offset, k < num_vmas - 2 ? files[(seed + k) % NUM_FILES] : 0);
+    write_u64(s, vma + vma_params.vm_next_offset, direct_map + vma + vma_size);
+  }
+  unsigned long long heap = base + mm_size + num_vmas * vma_size;
+  write_u64(s, heap + vma_params.vm_start_offset, HEAP_BASE);
+  write_u64(s, heap + vma_params.vm_end_offset, HEAP_BASE + HEAP_SIZE);
+  write_u64(s, heap + vma_params.vm_flags_offset, VMA_READ | VMA_WRITE);
+  return direct_map + base;
+}
+
+/**
+ * This program writes a synthetic LiME dump and its System.map, to test and
+ * benchmark the analyser on inputs of any size
+ * The dump has the kernel image at KERNEL_PADDR shifted by the kaslr offset,
+ * kernel page tables for the text and the direct map, a linux_banner and a
+ * circular task list whose task_structs are spread over every range; with -M
+ * user processes also get an mm_struct, a VMA list, backing files and
+ * user page tables mapping most of the VMA pages and a mostly absent heap
+ *
+ * usage:
+ *   ./mkdump -o dump.lime -m System.map [-n tasks] [-r ranges] [-R range_mb] [-g gap_mb]
+ *            [-k kaslr] [-D direct_map] [-4] [-5] [-N] [-p profile] [-V release] [-S seed] [-u unlinked] [-M vmas]
+*/
+int main(int argc, char** argv) {
+  char* dump_filename = NULL;
+  char* map_filename = NULL;
+  char* profile_filename = NULL;
+  const char* release = "4.15.0-synthetic";
+  int num_tasks = 1000;
+  int unlinked = 0;
+  int num_vmas = 0;
+  int num_ranges = 4;
+  unsigned long long range_size = 256 * MB;
+  unsigned long long gap_size = 64 * MB;
+  unsigned long long kaslr = 0;
+  unsigned long long direct_map = 0;
+  int small_pages = 0;
+  int la57 = 0;
+  int noise = 0;
+  unsigned long long seed = 0x9e3779b97f4a7c15ULL;
+  int opt = 0;
+
+  while((opt = getopt (argc, argv, "o:m:n:r:R:g:k:D:45Np:V:S:u:M:"))!= -1) {
+    switch(opt) {
+      case 'o':
+        dump_filename = optarg;
+        break;
+      case 'm':
+        map_filename = optarg;
+        break;
+      case 'n':
+        num_tasks = atoi(optarg);
+        break;
+      case 'r':
+        num_ranges = atoi(optarg);
+        break;
+      case 'R':
+        range_size = strtoull(optarg, NULL, 0) * MB;
+        break;
+      case 'g':
+        gap_size = strtoull(optarg, NULL, 0) * MB;
+        break;
+      case 'k':
+        kaslr = strtoull(optarg, NULL, 0);
+        break;
+      case 'D':
+        direct_map = strtoull(optarg, NULL, 0);
+        break;
+      case '4':
+        small_pages = 1;
+        break;
+      case '5':
+        la57 = 1;
+        break;
+      case 'N':
+        noise = 1;
+        break;
+      case 'p':
+        profile_filename = optarg;
+        break;
+      case 'V':
+        release = optarg;
+        break;
+      case 'S':
+        seed = strtoull(optarg, NULL, 0) | 1;
+        break;
+      case 'u':
+        unlinked = atoi(optarg);
+        break;
+      case 'M':
+        num_vmas = atoi(optarg);
+        break;
+      case ':': /* Fall through is intentional */
+      case '?': /* Fall through is intentional */
+      default:
+        printf("Invalid options or missing argument: '-%c'.\n",
+            opt);
+        break;
+    }
+  }
+
+  char* usage = "Usage: ./mkdump -o dump.lime -m System.map [-n tasks] [-r ranges] [-R range_mb] [-g gap_mb]\n"
+    "                [-k kaslr] [-D direct_map] [-4] [-5] [-N] [-p profile] [-V release] [-S seed] [-u unlinked] [-M vmas]\n\n"
+    "  -n  number of tasks including swapper/0 (default: 1000)\n"
+    "  -r  number of lime ranges (default: 4)\n"
+    "  -R  size of each range in MB (default: 256)\n"
+    "  -g  hole between ranges in MB (default: 64)\n"
+    "  -k  kaslr offset of the kernel text, 2 MB aligned (default: 0)\n"
+    "  -D  base of the direct map, 1 GB aligned (default: the non randomised base)\n"
+    "  -4  map the direct map with 4 KB pages instead of 2 MB pages\n"
+    "  -5  use 5-level paging (LA57)\n"
+    "  -N  fill memory with random bytes and fake swapper/0 strings\n"
+    "  -p  struct profile to take the task_struct layout from\n"
+    "  -V  kernel release written in linux_banner\n"
+    "  -S  seed of the random layout\n"
+    "  -u  number of tasks (pids 3 and up) left out of the task list but still parents\n"
+    "  -M  number of VMAs of each user process, 0 for no mm_structs (default: 0); each\n"
+    "      also gets a 1 TB heap with only a 2 MB and a 4 KB page resident\n";
+  if (!dump_filename || !map_filename) {
+    _die("Did not pass dump and/or System.map file name\n%s", usage);
+  }
+  if (!direct_map) {
+    direct_map = la57 ? DIRECT_MAP_LA57 : DIRECT_MAP;
+  }
+  if (num_tasks < 1 || num_ranges < 1 || range_size == 0) {
+    _die("Need at least one task and one range\n%s", usage);
+  }
+  if (unlinked < 0 || (unlinked && unlinked > num_tasks - 3)) {
+    _die("-u needs at least %d more tasks", unlinked + 3 - num_tasks);
+  }
+  if ((range_size | gap_size | kaslr) & ((1ULL << PMD_SHIFT) - 1) || direct_map & ((1ULL << PUD_SHIFT) - 1)) {
+    _die("Ranges, gaps and the kaslr offset must be 2 MB aligned, the direct map 1 GB aligned");
+  }
+
+  vma_params_init(&vma_params);
+  if (profile_filename) {
+    const char *wanted[] = { "task_struct", "mm_struct", "vm_area_struct", "file", "path", "dentry", "qstr" };
+    Profile *profile = profile_load(profile_filename, wanted, sizeof(wanted) / sizeof(wanted[0]));
+    long long size = profile_struct_size(profile, "task_struct");
+    long long comm = profile_member_offset(profile, "task_struct", "comm");
+    long long pid = profile_member_offset(profile, "task_struct", "pid");
+    long long tasks = profile_member_offset(profile, "task_struct", "tasks");
+    long long parent = profile_member_offset(profile, "task_struct", "parent");
+    if (size == -1 || comm == -1 || pid == -1 || tasks == -1 || parent == -1) {
+      _die("Profile has no task_struct with comm, pid, tasks and parent: %s", profile_filename);
+    }
+    task_struct_size = size;
+    comm_offset = comm;
+    pid_offset = pid;
+    tasks_offset = tasks;
+    parent_offset = parent;
+    if (vma_params_from_profile(&vma_params, profile) == -1 && num_vmas) {
+      _die("Profile has no task_struct.mm, mm_struct or vm_area_struct members for -M: %s", profile_filename);
+    }
+    profile_free(profile);
+  }
+
+  /* page tables: a few per range per level, and one page per 2 MB with -4 */
+  unsigned long long table_pages = 16;
+  for (int i = 0; i < num_ranges; i++) {
+    table_pages += (range_size >> PUD_SHIFT) + (range_size >> PGD_SHIFT) + 6;
+    if (small_pages) {
+      table_pages += (range_size >> PMD_SHIFT) + 2;
+    }
+  }
+  if (num_vmas > 0) {
+    table_pages += 16 + num_vmas + num_vmas * (num_vmas + 1) / 2; // the user tables and pages
+    table_pages += 2 * (1 << (PMD_SHIFT - PAGE_SHIFT)); // the heap's 2 MB page, aligned
+  }
+  unsigned long long kernel_end = KERNEL_PADDR + INIT_PGT_OFF + table_pages * PAGE_SIZE;
+  kernel_end = (kernel_end + (1ULL << PMD_SHIFT) - 1) & ~((1ULL << PMD_SHIFT) - 1);
+  if (RAM_START + range_size < kernel_end) {
+    _die("The first range must hold the kernel image, use -R %llu or more", (kernel_end - RAM_START) / MB);
+  }
+  if (KERNEL_TEXT + kaslr + (kernel_end - KERNEL_PADDR) > KERNEL_TEXT_END) {
+    _die("kaslr offset %llx puts the kernel past the text mapping", kaslr);
+  }
+
+  /* create the file and lay the ranges out in it */
+  int fd = open(dump_filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    _die("Could not create file: %s", dump_filename);
+  }
+  unsigned long long file_size = num_ranges * (sizeof(LHdr) + range_size);
+  if (ftruncate(fd, file_size) == -1) {
+    _die("Could not size %s to %llu bytes", dump_filename, file_size);
+  }
+  unsigned char *file = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (file == MAP_FAILED) {
+    _die("Could not map file: %s", dump_filename);
+  }
+
+  Synth s = { 0 };
+  s.num_ranges = num_ranges;
+  s.levels = la57 ? 5 : 4;
+  s.seed = seed;
+  s.ranges = calloc(num_ranges, sizeof(DumpRange));
+  unsigned long long offset = 0;
+  for (int i = 0; i < num_ranges; i++) {
+    LHdr h = { 0 };
+    h.magic = LIME_MAGIC;
+    h.version = LIME_VERSION;
+    h.s_addr = RAM_START + i * (range_size + gap_size);
+    h.e_addr = h.s_addr + range_size - 1;
+    memcpy(file + offset, &h, sizeof(h));
+    s.ranges[i].s_addr = h.s_addr;
+    s.ranges[i].e_addr = h.e_addr;
+    s.ranges[i].offset = offset + sizeof(h);
+    s.ranges[i].data = file + offset + sizeof(h);
+    offset += sizeof(h) + range_size;
+  }
+
+  if (noise) {
+    for (int i = 0; i < num_ranges; i++) {
+      unsigned long long *p = (unsigned long long *) s.ranges[i].data;
+      for (unsigned long long j = 0; j < range_size / sizeof(*p); j++) {
+        p[j] = next_rand(&s);
+      }
+      for (unsigned long long off = DECOY_INTERVAL / 2; off < range_size; off += DECOY_INTERVAL) {
+        memcpy((unsigned char *) s.ranges[i].data + off, "swapper/0", sizeof("swapper/0"));
+      }
+    }
+    memset(synth_ptr(&s, KERNEL_PADDR), 0, kernel_end - KERNEL_PADDR);
+  }
+
+  /* kernel image: banner, init_task and the page tables */
+  unsigned long long shift = KERNEL_TEXT + kaslr - KERNEL_PADDR;
+  char banner[256];
+  int banner_len = snprintf(banner, sizeof(banner), "Linux version %s (mkdump@localhost) (gcc) #1 SMP\n", release);
+  memcpy(synth_ptr(&s, KERNEL_PADDR + BANNER_OFF), banner, banner_len + 1);
+
+  unsigned long long pgt = KERNEL_PADDR + INIT_PGT_OFF;
+  s.next_table = pgt + PAGE_SIZE;
+  s.tables_end = kernel_end;
+  for (unsigned long long pa = KERNEL_PADDR; pa < kernel_end; pa += 1ULL << PMD_SHIFT) {
+    map_page(&s, pgt, pa + shift, pa, 1);
+  }
+  unsigned long long page = small_pages ? PAGE_SIZE : 1ULL << PMD_SHIFT;
+  for (int i = 0; i < num_ranges; i++) {
+    for (unsigned long long pa = s.ranges[i].s_addr; pa < s.ranges[i].e_addr; pa += page) {
+      map_page(&s, pgt, direct_map + pa, pa, !small_pages);
+    }
+  }
+
+  /* with -M every process shares one user address space, its VMAs backed
+   * by pages stamped with their address, all but every third one resident */
+  unsigned long long user_pgd = pgt;
+  if (num_vmas > 0) {
+    user_pgd = s.next_table;
+    s.next_table += PAGE_SIZE;
+    memcpy(synth_ptr(&s, user_pgd + PAGE_SIZE / 2), synth_ptr(&s, pgt + PAGE_SIZE / 2), PAGE_SIZE / 2);
+    for (int k = 0; k < num_vmas; k++) {
+      for (int p = 0; p <= k; p++) {
+        if (p % 3 == 2) {
+          continue;
+        }
+        unsigned long long vaddr = VMA_BASE + k * VMA_STRIDE + p * PAGE_SIZE;
+        unsigned long long pa = s.next_table;
+        s.next_table += PAGE_SIZE;
+        memset(synth_ptr(&s, pa), k + 1, PAGE_SIZE);
+        write_u64(&s, pa, vaddr);
+        map_page(&s, user_pgd, vaddr, pa, 0);
+      }
+    }
+    unsigned long long pa = (s.next_table + (1ULL << PMD_SHIFT) - 1) & ~((1ULL << PMD_SHIFT) - 1);
+    s.next_table = pa + (1ULL << PMD_SHIFT);
+    for (unsigned long long off = 0; off < 1ULL << PMD_SHIFT; off += PAGE_SIZE) {
+      memset(synth_ptr(&s, pa + off), ((HEAP_BASE + off - VMA_BASE) >> 24) + 1, PAGE_SIZE);
+      write_u64(&s, pa + off, HEAP_BASE + off);
+    }
+    map_page(&s, user_pgd, HEAP_BASE, pa, 1);
+    pa = s.next_table;
+    s.next_table += PAGE_SIZE;
+    memset(synth_ptr(&s, pa), ((HEAP_BASE + HEAP_SIZE / 2 - VMA_BASE) >> 24) + 1, PAGE_SIZE);
+    write_u64(&s, pa, HEAP_BASE + HEAP_SIZE / 2);
+    map_page(&s, user_pgd, HEAP_BASE + HEAP_SIZE / 2, pa, 0);
+    if (s.next_table > s.tables_end) {
+      _die("Out of page-table pages for the user pages");
+    }
+  }
+
+  /* tasks: swapper/0 in the kernel image, the rest spread over the slots */
+  unsigned long long slot_size = (task_struct_size + TASK_ALIGN - 1) & ~(TASK_ALIGN - 1ULL);
+  unsigned long long num_slots = 0;
+  for (int i = 0; i < num_ranges; i++) {
+    unsigned long long start = i == 0 ? kernel_end : s.ranges[i].s_addr;
+    num_slots += (s.ranges[i].e_addr + 1 - start) / slot_size;
+  }
+  if ((unsigned long long) num_tasks > num_slots) {
+    _die("%d tasks do not fit in %llu slots, add ranges or make them larger", num_tasks, num_slots);
+  }
+  unsigned long long stride = TASK_STRIDE;
+  while (num_slots % stride == 0) {
+    stride += 2;
+  }
+
+  unsigned long long *paddrs = malloc(sizeof(unsigned long long) * num_tasks);
+  unsigned long long *vaddrs = malloc(sizeof(unsigned long long) * num_tasks);
+  paddrs[0] = KERNEL_PADDR + INIT_TASK_OFF;
+  vaddrs[0] = paddrs[0] + shift;
+  for (int i = 1; i < num_tasks; i++) {
+    paddrs[i] = slot_paddr(&s, kernel_end, slot_size, (i * stride) % num_slots);
+    vaddrs[i] = direct_map + paddrs[i];
+  }
+
+  /* the task list, tasks 3 to 3 + unlinked - 1 are not on it */
+  int *linked = malloc(sizeof(int) * num_tasks);
+  int *position = malloc(sizeof(int) * num_tasks);
+  int num_linked = 0;
+  for (int i = 0; i < num_tasks; i++) {
+    position[i] = -1;
+    if (i < 3 || i >= 3 + unlinked) {
+      position[i] = num_linked;
+      linked[num_linked++] = i;
+    }
+  }
+
+  /* mm_structs and files go in the slots no task is in */
+  SlotPool pool = { calloc(num_slots, 1), num_slots, 0 };
+  for (int i = 1; i < num_tasks; i++) {
+    pool.used[(i * stride) % num_slots] = 1;
+  }
+  unsigned long long mm_size = align_obj((vma_params.mmap_offset > vma_params.pgd_offset ? vma_params.mmap_offset : vma_params.pgd_offset) + 8);
+  if (num_vmas < 0 || mm_size + (num_vmas + 1) * align_obj(vma_params.vma_size) > slot_size ||
+      NUM_FILES * (align_obj(vma_params.file_dentry_offset + 8) + align_obj(vma_params.dentry_name_offset + 8) + OBJ_ALIGN) > slot_size) {
+    _die("-M %d VMAs do not fit in a %llu byte slot", num_vmas, slot_size);
+  }
+  unsigned long long files[NUM_FILES];
+  if (num_vmas) {
+    unsigned long long base = slot_paddr(&s, kernel_end, slot_size, pool_take(&pool));
+    memset(synth_ptr(&s, base), 0, slot_size);
+    write_files(&s, base, direct_map, files);
+  }
+  unsigned long long last_mm = 0;
+  int num_mms = 0;
+
+  for (int i = 0; i < num_tasks; i++) {
+    unsigned char *task = synth_ptr(&s, paddrs[i]);
+    memset(task, 0, task_struct_size);
+    char comm[16] = { 0 };
+    if (i == 0) {
+      strcpy(comm, "swapper/0");
+    } else {
+      task_name(&s, i, comm);
+    }
+    memcpy(task + comm_offset, comm, sizeof(comm));
+    if (num_vmas && i > 0 && comm[0] != 'k') {
+      if (!last_mm || i % MM_SHARE_INTERVAL) {
+        unsigned long long base = slot_paddr(&s, kernel_end, slot_size, pool_take(&pool));
+        memset(synth_ptr(&s, base), 0, slot_size);
+        last_mm = write_mm(&s, base, direct_map, direct_map + user_pgd, num_vmas, files, i);
+        num_mms += 1;
+      }
+      memcpy(task + vma_params.mm_offset, &last_mm, sizeof(last_mm));
+    }
+    int pid = i;
+    memcpy(task + pid_offset, &pid, sizeof(pid));
+    unsigned long long next = vaddrs[i] + tasks_offset; // list_del_init points an unlinked task at itself
+    unsigned long long prev = next;
+    if (position[i] != -1) {
+      next = vaddrs[linked[(position[i] + 1) % num_linked]] + tasks_offset;
+      prev = vaddrs[linked[(position[i] + num_linked - 1) % num_linked]] + tasks_offset;
+    }
+    memcpy(task + tasks_offset, &next, sizeof(next));
+    memcpy(task + tasks_offset + sizeof(next), &prev, sizeof(prev));
+    unsigned long long parent = vaddrs[i <= 2 ? 0 : next_rand(&s) % i];
+    memcpy(task + parent_offset, &parent, sizeof(parent));
+  }
+  free(pool.used);
+  free(position);
+  free(linked);
+  free(paddrs);
+  free(vaddrs);
+
+  if (munmap(file, file_size) == -1 || close(fd) == -1) {
+    _die("Could not write file: %s", dump_filename);
+  }
+
+  /* the System.map has the link addresses, i.e. no kaslr */
+  FILE *map = fopen(map_filename, "w");
+  if (!map) {
+    _die("Could not create file: %s", map_filename);
+  }
+  unsigned long long text = KERNEL_TEXT - KERNEL_PADDR;
+  fprintf(map, "%016llx T _text\n", KERNEL_TEXT);
+  fprintf(map, "%016llx D linux_banner\n", text + KERNEL_PADDR + BANNER_OFF);
+  fprintf(map, "%016llx D init_task\n", text + KERNEL_PADDR + INIT_TASK_OFF);
+  fprintf(map, "%016llx D init_level4_pgt\n", text + pgt);
+  fprintf(map, "%016llx D init_pgt\n", text + pgt);
+  fclose(map);
+
+  printf("%s: %d ranges of %llu MB, %d tasks, %d mm_structs, %llu page-table pages, kernel shift %llx, direct map %llx\n",
+    dump_filename, num_ranges, range_size / MB, num_tasks, num_mms, (s.next_table - pgt) / PAGE_SIZE, shift, direct_map);
+  free(s.ranges);
+  return 0;
+}
@@ -0,0 +1,53 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "util.h"
+#include "profile.h"
+
+/**
+ * This program converts a json profile (dwarf_output_json or the output of
+ * dwarf2json) into the binary profile the analyser maps in place
+ *
+ * usage:
+ *   ./mkprofile -i dwarf_output_json -o /PathTo/profiles/$(uname -r).prof [-r $(uname -r)]
+*/
+int main(int argc, char** argv) {
+  char* in_filename = NULL;
+  char* out_filename = NULL;
+  char* release = NULL;
+  int opt = 0;
+
+  while((opt = getopt (argc, argv, "i:o:r:"))!= -1) {
+    switch(opt) {
+      case 'i':
+        in_filename = optarg;
+        break;
+      case 'o':
+        out_filename = optarg;
+        break;
+      case 'r':
+        release = optarg;
+        break;
+      case ':': /* Fall through is intentional */
+      case '?': /* Fall through is intentional */
+      default:
+        printf("Invalid options or missing argument: '-%c'.\n",
+            opt);
+        break;
+    }
+  }
+
+  if (!in_filename || !out_filename) {
+    _die("Did not pass input and/or output file name\n"
+      "Usage: ./mkprofile -i profile.json -o <release>.prof [-r release]\n");
+  }
+
+  Profile *profile = profile_load_json(in_filename, NULL, 0);
+  if (profile_write_binary(profile, release, out_filename) == -1) {
+    _die("Could not write profile: %s", out_filename);
+  }
+  profile_free(profile);
+  return 0;
+}
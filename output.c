@@ -0,0 +1,252 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "util.h"
+#include "output.h"
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/**
+ * This function names a format for -f
+ * @returns OUTPUT_TABLE, OUTPUT_CSV, OUTPUT_JSON or -1
+*/
+int output_format(const char *name) {
+  if (!strcmp(name, "table")) {
+    return OUTPUT_TABLE;
+  }
+  if (!strcmp(name, "csv")) {
+    return OUTPUT_CSV;
+  }
+  if (!strcmp(name, "json") || !strcmp(name, "jsonl")) {
+    return OUTPUT_JSON;
+  }
+  return -1;
+}
+
+/**
+ * This function writes out everything buffered
+*/
+void output_flush(Output *out) {
+  size_t done = 0;
+  while (done < out->len) {
+    ssize_t n = write(out->fd, out->buf + done, out->len - done);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      _die("output_flush - Unable to write the output");
+    }
+    done += n;
+  }
+  out->len = 0;
+}
+
+/**
+ * This function makes room for n more bytes, n is at most a field's worth
+*/
+static inline void reserve(Output *out, size_t n) {
+  if (out->len + n > OUTPUT_BUFFER) {
+    output_flush(out);
+  }
+}
+
+static inline void put(Output *out, const char *s, size_t n) {
+  memcpy(out->buf + out->len, s, n);
+  out->len += n;
+}
+
+/**
+ * This function starts a row of CSV column names
+*/
+static void write_csv_header(Output *out) {
+  for (int i = 0; i < out->num_columns; i++) {
+    size_t n = strlen(out->columns[i].name);
+    reserve(out, n + 2);
+    if (i) {
+      put(out, ",", 1);
+    }
+    put(out, out->columns[i].name, n);
+  }
+  put(out, "\n", 1);
+}
+
+/**
+ * This function opens a stream of rows
+ * @params fd - where the rows go, e.g. fileno(stdout); stdout is flushed first
+ * @params format - OUTPUT_TABLE, OUTPUT_CSV or OUTPUT_JSON
+ * @params columns - the fields of every row, in order
+ * @params count - number of columns
+ * @params banner - lines written before a table, NULL for none
+ * @returns the stream
+*/
+Output* output_open(int fd, int format, const OutputColumn *columns, int count, const char *banner) {
+  Output *out = calloc(1, sizeof(Output));
+  out->fd = fd;
+  out->format = format;
+  out->columns = columns;
+  out->num_columns = count;
+  out->buf = malloc(OUTPUT_BUFFER);
+  fflush(stdout); // anything printf'd so far comes first
+
+  if (format == OUTPUT_TABLE && banner) {
+    size_t n = strlen(banner);
+    reserve(out, n);
+    put(out, banner, n);
+  } else if (format == OUTPUT_CSV) {
+    write_csv_header(out);
+  }
+  return out;
+}
+
+/**
+ * This function starts the next field of a row
+ * @returns its column
+*/
+static const OutputColumn* field_start(Output *out, int type) {
+  const OutputColumn *col = &out->columns[out->column];
+  if (col->type != type && !(type == OUTPUT_HEX && col->type == OUTPUT_PTR)) {
+    _die("output - Column %s written with the wrong type", col->name);
+  }
+  size_t key = out->format == OUTPUT_JSON ? strlen(col->name) + 4 : 0;
+  reserve(out, key + col->width + 48);
+  if (out->format == OUTPUT_JSON) {
+    out->buf[out->len++] = out->column ? ',' : '{';
+    out->buf[out->len++] = '"';
+    put(out, col->name, key - 4);
+    out->buf[out->len++] = '"';
+    out->buf[out->len++] = ':';
+  } else if (out->column) {
+    out->buf[out->len++] = out->format == OUTPUT_CSV ? ',' : ' ';
+  }
+  return col;
+}
+
+/**
+ * This function ends a field, padding it in a table, and the row after its
+ * last column
+ * @params written - characters the value took
+*/
+static void field_end(Output *out, const OutputColumn *col, size_t written) {
+  if (out->format == OUTPUT_TABLE && written < (size_t) col->width) {
+    reserve(out, col->width - written);
+    memset(out->buf + out->len, ' ', col->width - written);
+    out->len += col->width - written;
+  }
+  out->column += 1;
+  if (out->column == out->num_columns) {
+    reserve(out, 2);
+    if (out->format == OUTPUT_JSON) {
+      out->buf[out->len++] = '}';
+    }
+    out->buf[out->len++] = '\n';
+    out->column = 0;
+  }
+}
+
+/**
+ * This function writes a string field
+ * Strings from the dump are untrusted: CSV quotes them when needed and JSON
+ * escapes quotes, backslashes and every byte outside printable ASCII
+*/
+void output_str(Output *out, const char *value) {
+  const OutputColumn *col = field_start(out, OUTPUT_STR);
+  size_t n = strlen(value);
+  if (out->format == OUTPUT_TABLE) {
+    reserve(out, n);
+    put(out, value, n);
+    field_end(out, col, n);
+    return;
+  }
+
+  int quote = out->format == OUTPUT_JSON || strpbrk(value, ",\"\r\n");
+  if (quote) {
+    out->buf[out->len++] = '"';
+  }
+  for (const unsigned char *p = (const unsigned char *) value; *p; p++) {
+    reserve(out, 8);
+    if (*p == '"') {
+      put(out, out->format == OUTPUT_JSON ? "\\\"" : "\"\"", 2);
+    } else if (out->format == OUTPUT_JSON && *p == '\\') {
+      put(out, "\\\\", 2);
+    } else if (out->format == OUTPUT_JSON && (*p < 0x20 || *p >= 0x7f)) {
+      char esc[6] = { '\\', 'u', '0', '0', hex_digits[*p >> 4], hex_digits[*p & 0xf] };
+      put(out, esc, sizeof(esc));
+    } else {
+      out->buf[out->len++] = *p;
+    }
+  }
+  reserve(out, 1);
+  if (quote) {
+    out->buf[out->len++] = '"';
+  }
+  field_end(out, col, n);
+}
+
+/**
+ * This function writes a decimal field
+*/
+void output_int(Output *out, long long value) {
+  const OutputColumn *col = field_start(out, OUTPUT_INT);
+  char digits[24];
+  char *p = digits + sizeof(digits);
+  unsigned long long v = value < 0 ? -(unsigned long long) value : (unsigned long long) value;
+  do {
+    *--p = '0' + v % 10;
+    v /= 10;
+  } while (v);
+  if (value < 0) {
+    *--p = '-';
+  }
+  size_t n = digits + sizeof(digits) - p;
+  put(out, p, n);
+  field_end(out, col, n);
+}
+
+/**
+ * This function writes a hex field, prefixed with 0x in an OUTPUT_PTR
+ * column and in JSON, where it is a string since JSON numbers cannot hold
+ * 64 bits
+*/
+void output_hex(Output *out, unsigned long long value) {
+  const OutputColumn *col = field_start(out, OUTPUT_HEX);
+  if (col->type == OUTPUT_PTR && !value && out->format == OUTPUT_TABLE) {
+    put(out, "(nil)", 5);
+    field_end(out, col, 5);
+    return;
+  }
+
+  char digits[20];
+  char *p = digits + sizeof(digits);
+  do {
+    *--p = hex_digits[value & 0xf];
+    value >>= 4;
+  } while (value);
+  if (col->type == OUTPUT_PTR || out->format == OUTPUT_JSON) {
+    *--p = 'x';
+    *--p = '0';
+  }
+  size_t n = digits + sizeof(digits) - p;
+  if (out->format == OUTPUT_JSON) {
+    out->buf[out->len++] = '"';
+  }
+  put(out, p, n);
+  if (out->format == OUTPUT_JSON) {
+    out->buf[out->len++] = '"';
+  }
+  field_end(out, col, n);
+}
+
+/**
+ * This function writes out what is left and frees the stream
+*/
+void output_close(Output *out) {
+  if (out->column) {
+    _die("output_close - Row left unfinished at column %s", out->columns[out->column].name);
+  }
+  output_flush(out);
+  free(out->buf);
+  free(out);
+}
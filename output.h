@@ -0,0 +1,54 @@
+#ifndef _OUTPUT_H
+#define _OUTPUT_H
+
+#include <stddef.h>
+
+#define OUTPUT_BUFFER (1 << 20)  /* bytes gathered before each write(2) */
+
+/* formats, picked with -f */
+#define OUTPUT_TABLE 0           /* aligned columns for people */
+#define OUTPUT_CSV 1             /* a header line then one line per row */
+#define OUTPUT_JSON 2            /* JSON Lines, an object per row */
+
+/* column types */
+#define OUTPUT_STR 0
+#define OUTPUT_INT 1
+#define OUTPUT_HEX 2             /* bare hex, e.g. a physical address; 0x prefixed in JSON */
+#define OUTPUT_PTR 3             /* 0x prefixed hex, (nil) in a table as %p prints it */
+
+/**
+ * This struct is one column of the rows written
+*/
+
+typedef struct output_column {
+	const char *name;           /* CSV header and JSON key */
+	int type;
+	int width;                  /* table only, values are padded to it */
+} OutputColumn;
+
+/**
+ * This struct is a stream of rows to a file descriptor
+ * Fields are formatted straight into one large buffer, which is written
+ * out whenever it fills, so rows leave as they are produced at a write(2)
+ * per OUTPUT_BUFFER bytes; a row ends by itself after its last column
+*/
+
+typedef struct output {
+	int fd;
+	int format;
+	const OutputColumn *columns;
+	int num_columns;
+	int column;                 /* next field of the row */
+	char *buf;
+	size_t len;
+} Output;
+
+int output_format(const char *name);
+Output* output_open(int fd, int format, const OutputColumn *columns, int count, const char *banner);
+void output_str(Output *out, const char *value);
+void output_int(Output *out, long long value);
+void output_hex(Output *out, unsigned long long value);
+void output_flush(Output *out);
+void output_close(Output *out);
+
+#endif
@@ -0,0 +1,128 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "util.h"
+#include "proctree.h"
+
+/**
+ * This function hashes a task_struct address
+ * The low bits are mostly zero (slab alignment), so they are mixed in from above
+*/
+static inline unsigned int addr_hash(unsigned long long vaddr) {
+  vaddr ^= vaddr >> 33;
+  vaddr *= 0xff51afd7ed558ccdULL;
+  vaddr ^= vaddr >> 33;
+  return (unsigned int) vaddr;
+}
+
+/**
+ * This function creates an empty tree
+ * @returns the tree
+*/
+ProcTree* proctree_create(void) {
+  ProcTree *tree = calloc(1, sizeof(ProcTree));
+  tree->mask = 1023;
+  tree->slots = calloc(tree->mask + 1, sizeof(unsigned int));
+  return tree;
+}
+
+/**
+ * This function doubles the index, keeping it at most half full
+*/
+static void proctree_grow_index(ProcTree *tree) {
+  unsigned int capacity = (tree->mask + 1) * 2;
+  free(tree->slots);
+  tree->slots = calloc(capacity, sizeof(unsigned int));
+  tree->mask = capacity - 1;
+  for (int i = 0; i < tree->count; i++) {
+    unsigned int slot = addr_hash(tree->nodes[i].vaddr) & tree->mask;
+    while (tree->slots[slot]) {
+      slot = (slot + 1) & tree->mask;
+    }
+    tree->slots[slot] = i + 1;
+  }
+}
+
+/**
+ * This function returns the index of the task at vaddr
+ * @returns the index or -1 if it has not been added
+*/
+int proctree_find(ProcTree *tree, unsigned long long vaddr) {
+  unsigned int slot = addr_hash(vaddr) & tree->mask;
+  while (tree->slots[slot]) {
+    if (tree->nodes[tree->slots[slot] - 1].vaddr == vaddr) {
+      return tree->slots[slot] - 1;
+    }
+    slot = (slot + 1) & tree->mask;
+  }
+  return -1;
+}
+
+/**
+ * This function adds a task, the caller fills in everything but the links
+ * @params tree - the tree
+ * @params vaddr - address of the task_struct
+ * @returns the new node
+*/
+ProcNode* proctree_add(ProcTree *tree, unsigned long long vaddr) {
+  if (tree->count == tree->capacity) {
+    tree->capacity = tree->capacity ? tree->capacity * 2 : 1024;
+    tree->nodes = realloc(tree->nodes, tree->capacity * sizeof(ProcNode));
+    if (!tree->nodes) {
+      _die("proctree_add - Unable to grow task array to %d entries", tree->capacity);
+    }
+  }
+  if ((unsigned int) (tree->count + 1) * 2 > tree->mask + 1) {
+    proctree_grow_index(tree);
+  }
+
+  int idx = tree->count++;
+  ProcNode *node = &tree->nodes[idx];
+  memset(node, 0, sizeof(*node));
+  node->vaddr = vaddr;
+  node->ppid = -1;
+  node->parent_idx = -1;
+  node->first_child = -1;
+  node->next_sibling = -1;
+
+  unsigned int slot = addr_hash(vaddr) & tree->mask;
+  while (tree->slots[slot]) {
+    slot = (slot + 1) & tree->mask;
+  }
+  tree->slots[slot] = idx + 1;
+  return node;
+}
+
+/**
+ * This function resolves every task's parent from the index
+ * ppid is filled in for parents that were walked and children are linked
+ * in walk order, a task that is its own parent (init_task) is a root
+ * @params tree - the tree
+ * @returns the number of tasks whose parent was not walked
+*/
+int proctree_link(ProcTree *tree) {
+  int misses = 0;
+  for (int i = tree->count - 1; i >= 0; i--) {
+    ProcNode *node = &tree->nodes[i];
+    int parent = proctree_find(tree, node->parent);
+    if (parent == -1) {
+      misses += 1;
+      continue;
+    }
+    node->ppid = tree->nodes[parent].pid;
+    if (parent == i) {
+      continue;
+    }
+    node->parent_idx = parent;
+    node->next_sibling = tree->nodes[parent].first_child;
+    tree->nodes[parent].first_child = i;
+  }
+  return misses;
+}
+
+void proctree_free(ProcTree *tree) {
+  free(tree->nodes);
+  free(tree->slots);
+  free(tree);
+}
@@ -0,0 +1,43 @@
+#ifndef _PROCTREE_H
+#define _PROCTREE_H
+
+#define PROC_COMM_LEN 16
+
+/**
+ * This struct is one task found by the walk
+ * Tasks are linked to their parent and children by index once the walk is done
+*/
+
+typedef struct proc_node {
+	unsigned long long vaddr;   /* address of the task_struct */
+	unsigned long long parent;  /* parent task_struct address */
+	unsigned long long next;    /* tasks.next */
+	unsigned long long mm;      /* mm_struct address, 0 for kernel threads */
+	int pid;
+	int ppid;                   /* -1 until resolved */
+	char comm[PROC_COMM_LEN];
+	int parent_idx;             /* -1 if the parent was not walked */
+	int first_child;
+	int next_sibling;
+} ProcNode;
+
+/**
+ * This struct is every task of a walk, indexed by task_struct address
+ * slots hold an index into nodes + 1, 0 marks an empty slot
+*/
+
+typedef struct proc_tree {
+	ProcNode *nodes;
+	int count;
+	int capacity;
+	unsigned int *slots;
+	unsigned int mask;
+} ProcTree;
+
+ProcTree* proctree_create(void);
+ProcNode* proctree_add(ProcTree *tree, unsigned long long vaddr);
+int proctree_find(ProcTree *tree, unsigned long long vaddr);
+int proctree_link(ProcTree *tree);
+void proctree_free(ProcTree *tree);
+
+#endif
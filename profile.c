@@ -0,0 +1,627 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "util.h"
+#include "profile.h"
+#include "stats.h"
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+/**
+ * This struct is the position of the streaming json parser
+*/
+typedef struct json_cursor {
+  const char *p;
+  const char *end;
+  const char *start;
+} Cursor;
+
+static void json_fail(Cursor *c) {
+  _die("profile_load_json - Malformed profile at byte %lld", (long long) (c->p - c->start));
+}
+
+static inline void skip_ws(Cursor *c) {
+  while (c->p < c->end && (*c->p == ' ' || *c->p == '\n' || *c->p == '\t' || *c->p == '\r')) {
+    c->p++;
+  }
+}
+
+/**
+ * This function consumes ch if it is the next token
+ * @returns 1 if it was consumed
+*/
+static inline int accept(Cursor *c, char ch) {
+  skip_ws(c);
+  if (c->p < c->end && *c->p == ch) {
+    c->p++;
+    return 1;
+  }
+  return 0;
+}
+
+static inline void expect(Cursor *c, char ch) {
+  if (!accept(c, ch)) {
+    json_fail(c);
+  }
+}
+
+/**
+ * This function reads a string token as a view into the file
+ * Escapes are skipped over but not decoded, kernel names never have any
+*/
+static void parse_string(Cursor *c, const char **s, unsigned int *len) {
+  expect(c, '"');
+  const char *start = c->p;
+  while (c->p < c->end && *c->p != '"') {
+    c->p += (*c->p == '\\') ? 2 : 1;
+  }
+  if (c->p >= c->end) {
+    json_fail(c);
+  }
+  *s = start;
+  *len = c->p - start;
+  c->p++;
+}
+
+static unsigned long long parse_number(Cursor *c) {
+  skip_ws(c);
+  const char *start = c->p;
+  unsigned long long v = 0;
+  while (c->p < c->end && (unsigned int) (*c->p - '0') < 10) {
+    v = v * 10 + (*c->p - '0');
+    c->p++;
+  }
+  if (c->p == start) {
+    json_fail(c);
+  }
+  return v;
+}
+
+/**
+ * This function skips any json value without building it
+ * Containers are skipped by counting brackets outside of strings
+*/
+static void skip_value(Cursor *c) {
+  skip_ws(c);
+  if (c->p >= c->end) {
+    json_fail(c);
+  }
+  if (*c->p == '"') {
+    const char *s;
+    unsigned int len;
+    parse_string(c, &s, &len);
+    return;
+  }
+  if (*c->p != '{' && *c->p != '[') {
+    while (c->p < c->end && *c->p != ',' && *c->p != '}' && *c->p != ']' &&
+           *c->p != ' ' && *c->p != '\n' && *c->p != '\t' && *c->p != '\r') {
+      c->p++;
+    }
+    return;
+  }
+
+  int depth = 0;
+  while (c->p < c->end) {
+    char ch = *c->p++;
+    if (ch == '"') {
+      while (c->p < c->end && *c->p != '"') {
+        c->p += (*c->p == '\\') ? 2 : 1;
+      }
+      c->p++;
+    } else if (ch == '{' || ch == '[') {
+      depth++;
+    } else if (ch == '}' || ch == ']') {
+      if (--depth == 0) {
+        return;
+      }
+    }
+  }
+  json_fail(c);
+}
+
+static int name_eq(const char *a, unsigned int len, const char *b) {
+  return strlen(b) == len && memcmp(a, b, len) == 0;
+}
+
+static int is_wanted(const char *name, unsigned int len, const char **wanted, int num_wanted) {
+  if (!num_wanted) {
+    return 1;
+  }
+  for (int i = 0; i < num_wanted; i++) {
+    if (name_eq(name, len, wanted[i])) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static ProfileStruct* profile_add(Profile *profile) {
+  if (profile->count == profile->capacity) {
+    profile->capacity = profile->capacity ? profile->capacity * 2 : 16;
+    profile->structs = realloc(profile->structs, profile->capacity * sizeof(ProfileStruct));
+    if (!profile->structs) {
+      _die("profile_load_json - Unable to grow struct array to %d entries", profile->capacity);
+    }
+  }
+  return &profile->structs[profile->count++];
+}
+
+/**
+ * This function parses one vtype, [size, {member: [offset, type], ...}]
+ * Only the offsets are kept, member types are skipped
+*/
+static void parse_struct(Cursor *c, ProfileStruct *st) {
+  int capacity = 0;
+  st->members = NULL;
+  st->num_members = 0;
+
+  expect(c, '[');
+  st->size = parse_number(c);
+  expect(c, ',');
+  expect(c, '{');
+  if (!accept(c, '}')) {
+    do {
+      if (st->num_members == capacity) {
+        capacity = capacity ? capacity * 2 : 32;
+        st->members = realloc(st->members, capacity * sizeof(ProfileMember));
+      }
+      ProfileMember *m = &st->members[st->num_members++];
+      parse_string(c, &m->name, &m->len);
+      expect(c, ':');
+      expect(c, '[');
+      m->offset = parse_number(c);
+      while (accept(c, ',')) {
+        skip_value(c);
+      }
+      expect(c, ']');
+    } while (accept(c, ','));
+    expect(c, '}');
+  }
+  expect(c, ']');
+}
+
+/**
+ * This function parses a vtypes object, keeping only the wanted structs
+*/
+static void parse_vtypes(Cursor *c, Profile *profile, const char **wanted, int num_wanted) {
+  expect(c, '{');
+  if (accept(c, '}')) {
+    return;
+  }
+  do {
+    const char *name;
+    unsigned int len;
+    parse_string(c, &name, &len);
+    expect(c, ':');
+    if (is_wanted(name, len, wanted, num_wanted)) {
+      ProfileStruct *st = profile_add(profile);
+      st->name = name;
+      st->len = len;
+      parse_struct(c, st);
+    } else {
+      skip_value(c);
+    }
+  } while (accept(c, ','));
+  expect(c, '}');
+}
+
+/**
+ * This function loads a struct profile written by dwarf.py (print_obj)
+ * The file is mapped and parsed in one streaming pass, structs that are
+ * not wanted are skipped without being materialised
+ * "all_vtypes" is used, or "vtypes" for profiles that only have that
+ * @params filename - the profile, e.g. dwarf_output_json
+ * @params wanted - names of the structs to keep
+ * @params num_wanted - number of names, 0 keeps every struct
+ * @returns the profile
+*/
+Profile* profile_load_json(const char *filename, const char **wanted, int num_wanted) {
+  Profile *profile = calloc(1, sizeof(Profile));
+  int fd = open_file(filename);
+  unsigned long long fileSize = get_file_length(fd);
+  if (!fileSize) {
+    _die("profile_load_json - Empty profile: %s", filename);
+  }
+
+  profile->file = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (profile->file == MAP_FAILED) {
+    _die("profile_load_json - Unable to map profile: %s", filename);
+  }
+  profile->file_len = fileSize;
+  madvise(profile->file, fileSize, MADV_SEQUENTIAL);
+  close(fd);
+  STATS_ADD(syscalls, 3);
+
+  Cursor c = { profile->file, (const char *) profile->file + fileSize, profile->file };
+  Cursor vtypes = { NULL, c.end, c.start };
+  int found = 0;
+
+  expect(&c, '{');
+  if (!accept(&c, '}')) {
+    do {
+      const char *key;
+      unsigned int len;
+      parse_string(&c, &key, &len);
+      expect(&c, ':');
+      if (!found && name_eq(key, len, "all_vtypes")) {
+        parse_vtypes(&c, profile, wanted, num_wanted);
+        found = 1;
+      } else {
+        if (name_eq(key, len, "vtypes")) {
+          skip_ws(&c);
+          vtypes.p = c.p;
+        }
+        skip_value(&c);
+      }
+    } while (accept(&c, ','));
+  }
+
+  if (!found && vtypes.p) {
+    parse_vtypes(&vtypes, profile, wanted, num_wanted);
+  }
+  _debug("DEBUG: loaded %d structs from %s", profile->count, filename);
+  return profile;
+}
+
+/**
+ * This function opens a profile of either format
+ * A binary profile is recognised by its magic, anything else is parsed as json
+ * @params filename - the profile
+ * @params wanted - structs to keep from a json profile, see profile_load_json
+ * @params num_wanted - number of names, 0 keeps every struct
+ * @returns the profile
+*/
+Profile* profile_load(const char *filename, const char **wanted, int num_wanted) {
+  char magic[sizeof(((ProfileHeader *) 0)->magic)] = { 0 };
+  int fd = open_file(filename);
+  int n = read(fd, magic, sizeof(magic));
+  close(fd);
+  STATS_ADD(syscalls, 2);
+  STATS_ADD(bytes_read, n > 0 ? n : 0);
+  if (n == sizeof(magic) && memcmp(magic, PROFILE_MAGIC, sizeof(PROFILE_MAGIC)) == 0) {
+    return profile_load_binary(filename);
+  }
+  return profile_load_json(filename, wanted, num_wanted);
+}
+
+/**
+ * This function maps a binary profile, the tables are used in place
+ * @params filename - a profile written by profile_write_binary
+ * @returns the profile
+*/
+Profile* profile_load_binary(const char *filename) {
+  Profile *profile = calloc(1, sizeof(Profile));
+  int fd = open_file(filename);
+  unsigned long long fileSize = get_file_length(fd);
+  if (fileSize < sizeof(ProfileHeader)) {
+    _die("profile_load_binary - Truncated profile: %s", filename);
+  }
+
+  profile->file = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (profile->file == MAP_FAILED) {
+    _die("profile_load_binary - Unable to map profile: %s", filename);
+  }
+  profile->file_len = fileSize;
+  close(fd);
+  STATS_ADD(syscalls, 2);
+
+  const ProfileHeader *h = profile->file;
+  if (memcmp(h->magic, PROFILE_MAGIC, sizeof(PROFILE_MAGIC)) != 0 || h->version != PROFILE_VERSION) {
+    _die("profile_load_binary - Not a version %d profile: %s", PROFILE_VERSION, filename);
+  }
+  if (h->structs_off + (unsigned long long) h->num_structs * sizeof(ProfileBinStruct) > fileSize ||
+      h->members_off + (unsigned long long) h->num_members * sizeof(ProfileBinMember) > fileSize ||
+      h->strtab_off + h->strtab_size > fileSize || !h->strtab_size ||
+      ((const char *) profile->file)[h->strtab_off + h->strtab_size - 1] != '\0') {
+    _die("profile_load_binary - Corrupt profile: %s", filename);
+  }
+  profile->header = h;
+  _debug("DEBUG: mapped %u structs for %.*s from %s", h->num_structs, PROFILE_RELEASE_LEN, h->release, filename);
+  return profile;
+}
+
+static inline const ProfileBinStruct* bin_structs(const Profile *profile) {
+  return (const ProfileBinStruct *) ((const char *) profile->file + profile->header->structs_off);
+}
+
+static inline const ProfileBinMember* bin_members(const Profile *profile) {
+  return (const ProfileBinMember *) ((const char *) profile->file + profile->header->members_off);
+}
+
+static inline const char* bin_name(const Profile *profile, uint32_t name) {
+  if (name >= profile->header->strtab_size) {
+    return "";
+  }
+  return (const char *) profile->file + profile->header->strtab_off + name;
+}
+
+/**
+ * This function finds a struct in a binary profile by binary search
+ * @returns the struct or NULL
+*/
+static const ProfileBinStruct* bin_find_struct(const Profile *profile, const char *name) {
+  const ProfileBinStruct *structs = bin_structs(profile);
+  int lo = 0, hi = (int) profile->header->num_structs - 1;
+  while (lo <= hi) {
+    int mid = lo + (hi - lo) / 2;
+    int cmp = strcmp(bin_name(profile, structs[mid].name), name);
+    if (!cmp) {
+      return &structs[mid];
+    }
+    if (cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return NULL;
+}
+
+static long long bin_member_offset(const Profile *profile, const ProfileBinStruct *st, const char *member) {
+  if ((unsigned long long) st->first_member + st->num_members > profile->header->num_members) {
+    return -1;
+  }
+  const ProfileBinMember *members = bin_members(profile) + st->first_member;
+  int lo = 0, hi = (int) st->num_members - 1;
+  while (lo <= hi) {
+    int mid = lo + (hi - lo) / 2;
+    int cmp = strcmp(bin_name(profile, members[mid].name), member);
+    if (!cmp) {
+      return members[mid].offset;
+    }
+    if (cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return -1;
+}
+
+/**
+ * This function finds a struct in a json profile
+ * @returns the struct or NULL
+*/
+static ProfileStruct* profile_get_struct(Profile *profile, const char *name) {
+  for (int i = 0; i < profile->count; i++) {
+    if (name_eq(profile->structs[i].name, profile->structs[i].len, name)) {
+      return &profile->structs[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * This function returns the size of a struct
+ * @returns the size or -1 if the struct is not in the profile
+*/
+long long profile_struct_size(Profile *profile, const char *name) {
+  if (profile->header) {
+    const ProfileBinStruct *st = bin_find_struct(profile, name);
+    return st ? (long long) st->size : -1;
+  }
+  ProfileStruct *st = profile_get_struct(profile, name);
+  return st ? (long long) st->size : -1;
+}
+
+/**
+ * This function returns the offset of a member in a struct
+ * @returns the offset or -1 if the struct or member is not in the profile
+*/
+long long profile_member_offset(Profile *profile, const char *name, const char *member) {
+  if (profile->header) {
+    const ProfileBinStruct *st = bin_find_struct(profile, name);
+    return st ? bin_member_offset(profile, st, member) : -1;
+  }
+  ProfileStruct *st = profile_get_struct(profile, name);
+  if (!st) {
+    return -1;
+  }
+  for (int i = 0; i < st->num_members; i++) {
+    if (name_eq(st->members[i].name, st->members[i].len, member)) {
+      return st->members[i].offset;
+    }
+  }
+  return -1;
+}
+
+/**
+ * This function returns the kernel release a binary profile was made for
+ * @returns the release, empty for json profiles
+*/
+const char* profile_release(Profile *profile) {
+  static char release[PROFILE_RELEASE_LEN + 1];
+  if (!profile->header) {
+    return "";
+  }
+  memcpy(release, profile->header->release, PROFILE_RELEASE_LEN);
+  release[PROFILE_RELEASE_LEN] = '\0';
+  return release;
+}
+
+/**
+ * ****************************************************
+ * BINARY PROFILE WRITER
+ * ****************************************************
+*/
+
+/**
+ * This struct interns names into the string table of a binary profile
+*/
+typedef struct strtab {
+  char *data;
+  unsigned int size;
+  unsigned int capacity;
+  unsigned int *slots;     /* offset + 1 of each interned name, 0 is empty */
+  unsigned int mask;
+  unsigned int count;
+} Strtab;
+
+static unsigned int view_hash(const char *name, unsigned int len) {
+  unsigned int h = FNV_OFFSET;
+  for (unsigned int i = 0; i < len; i++) {
+    h ^= (unsigned char) name[i];
+    h *= FNV_PRIME;
+  }
+  return h;
+}
+
+/**
+ * This function returns the string table offset of a name, adding it once
+*/
+static uint32_t strtab_intern(Strtab *tab, const char *name, unsigned int len) {
+  unsigned int slot = view_hash(name, len) & tab->mask;
+  while (tab->slots[slot]) {
+    const char *other = tab->data + tab->slots[slot] - 1;
+    if (strlen(other) == len && memcmp(other, name, len) == 0) {
+      return tab->slots[slot] - 1;
+    }
+    slot = (slot + 1) & tab->mask;
+  }
+
+  if (tab->size + len + 1 > tab->capacity) {
+    while (tab->size + len + 1 > tab->capacity) {
+      tab->capacity = tab->capacity ? tab->capacity * 2 : 4096;
+    }
+    tab->data = realloc(tab->data, tab->capacity);
+  }
+  uint32_t off = tab->size;
+  memcpy(tab->data + off, name, len);
+  tab->data[off + len] = '\0';
+  tab->size += len + 1;
+  tab->slots[slot] = off + 1;
+  tab->count += 1;
+  return off;
+}
+
+static int view_cmp(const char *a, unsigned int alen, const char *b, unsigned int blen) {
+  int cmp = memcmp(a, b, alen < blen ? alen : blen);
+  if (cmp) {
+    return cmp;
+  }
+  return (alen > blen) - (alen < blen);
+}
+
+static int struct_cmp(const void *a, const void *b) {
+  const ProfileStruct *sa = *(ProfileStruct * const *) a;
+  const ProfileStruct *sb = *(ProfileStruct * const *) b;
+  return view_cmp(sa->name, sa->len, sb->name, sb->len);
+}
+
+static int member_cmp(const void *a, const void *b) {
+  const ProfileMember *ma = a;
+  const ProfileMember *mb = b;
+  return view_cmp(ma->name, ma->len, mb->name, mb->len);
+}
+
+/**
+ * This function writes a json profile in the binary format
+ * Structs and members are sorted by name so lookups are a binary search,
+ * duplicate names keep their first definition
+ * @params profile - a profile loaded from json
+ * @params release - kernel release to key the profile by, may be NULL
+ * @params filename - where to write it
+ * @returns 0 or -1 if the file could not be written
+*/
+int profile_write_binary(Profile *profile, const char *release, const char *filename) {
+  if (profile->header) {
+    _die("profile_write_binary - Profile is already binary");
+  }
+
+  ProfileStruct **order = malloc(sizeof(ProfileStruct *) * (profile->count ? profile->count : 1));
+  int total_members = 0;
+  for (int i = 0; i < profile->count; i++) {
+    order[i] = &profile->structs[i];
+    total_members += profile->structs[i].num_members;
+  }
+  qsort(order, profile->count, sizeof(ProfileStruct *), struct_cmp);
+
+  ProfileBinStruct *structs = calloc(profile->count ? profile->count : 1, sizeof(ProfileBinStruct));
+  ProfileBinMember *members = calloc(total_members ? total_members : 1, sizeof(ProfileBinMember));
+  Strtab tab = { 0 };
+  unsigned int slots = 1024;
+  while (slots < (unsigned int) (profile->count + total_members) * 2) {
+    slots <<= 1;
+  }
+  tab.slots = calloc(slots, sizeof(unsigned int));
+  tab.mask = slots - 1;
+
+  unsigned int num_structs = 0;
+  unsigned int num_members = 0;
+  for (int i = 0; i < profile->count; i++) {
+    ProfileStruct *st = order[i];
+    if (num_structs && view_cmp(st->name, st->len,
+          tab.data + structs[num_structs - 1].name, strlen(tab.data + structs[num_structs - 1].name)) == 0) {
+      continue;
+    }
+    ProfileBinStruct *out = &structs[num_structs++];
+    out->name = strtab_intern(&tab, st->name, st->len);
+    out->size = st->size;
+    out->first_member = num_members;
+
+    qsort(st->members, st->num_members, sizeof(ProfileMember), member_cmp);
+    for (int m = 0; m < st->num_members; m++) {
+      if (m && member_cmp(&st->members[m], &st->members[m - 1]) == 0) {
+        continue;
+      }
+      members[num_members].name = strtab_intern(&tab, st->members[m].name, st->members[m].len);
+      members[num_members].offset = st->members[m].offset;
+      num_members += 1;
+    }
+    out->num_members = num_members - out->first_member;
+  }
+
+  ProfileHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, PROFILE_MAGIC, sizeof(PROFILE_MAGIC));
+  h.version = PROFILE_VERSION;
+  h.num_structs = num_structs;
+  h.num_members = num_members;
+  h.strtab_size = tab.size;
+  h.structs_off = sizeof(ProfileHeader);
+  h.members_off = h.structs_off + num_structs * sizeof(ProfileBinStruct);
+  h.strtab_off = h.members_off + num_members * sizeof(ProfileBinMember);
+  if (release) {
+    strncpy(h.release, release, PROFILE_RELEASE_LEN);
+  }
+
+  int ret = -1;
+  FILE *f = fopen(filename, "wb");
+  if (f) {
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+      fwrite(structs, sizeof(ProfileBinStruct), num_structs, f) == num_structs &&
+      fwrite(members, sizeof(ProfileBinMember), num_members, f) == num_members &&
+      fwrite(tab.data, 1, tab.size, f) == tab.size;
+    if (fclose(f) == 0 && ok) {
+      ret = 0;
+    }
+  }
+  _debug("DEBUG: wrote %u structs, %u members, %u bytes of names", num_structs, num_members, tab.size);
+
+  free(order);
+  free(structs);
+  free(members);
+  free(tab.data);
+  free(tab.slots);
+  return ret;
+}
+
+/**
+ * This function frees a profile and unmaps the file its names point into
+ * @params profile - the profile to free
+*/
+void profile_free(Profile *profile) {
+  for (int i = 0; i < profile->count; i++) {
+    free(profile->structs[i].members);
+  }
+  if (profile->file) {
+    munmap(profile->file, profile->file_len);
+    STATS_ADD(syscalls, 1);
+  }
+  free(profile->structs);
+  free(profile);
+}
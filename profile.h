@@ -0,0 +1,90 @@
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+#include <stdint.h>
+
+#define PROFILE_MAGIC "MAPROF1"
+#define PROFILE_VERSION 1
+#define PROFILE_RELEASE_LEN 64
+
+/**
+ * This struct is one member of a kernel struct
+ * name is a view into the profile file and is NOT NUL terminated
+*/
+
+typedef struct profile_member {
+	const char *name;
+	unsigned int len;
+	unsigned long long offset;
+} ProfileMember;
+
+/**
+ * This struct is the layout of one kernel struct
+*/
+
+typedef struct profile_struct {
+	const char *name;
+	unsigned int len;
+	unsigned long long size;
+	ProfileMember *members;
+	int num_members;
+} ProfileStruct;
+
+/**
+ * These structs are the binary profile format, all little endian
+ * The file is a header, the struct table sorted by name, the member table
+ * (each struct's members contiguous and sorted by name) and a string table
+ * of interned, NUL terminated names
+*/
+
+typedef struct profile_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t num_structs;
+	uint32_t num_members;
+	uint32_t strtab_size;
+	uint64_t structs_off;
+	uint64_t members_off;
+	uint64_t strtab_off;
+	char release[PROFILE_RELEASE_LEN];  /* kernel release the profile is for */
+} __attribute__ ((__packed__)) ProfileHeader;
+
+typedef struct profile_bin_struct {
+	uint32_t name;          /* offset in the string table */
+	uint32_t first_member;
+	uint32_t num_members;
+	uint32_t pad;
+	uint64_t size;
+} __attribute__ ((__packed__)) ProfileBinStruct;
+
+typedef struct profile_bin_member {
+	uint32_t name;
+	uint32_t pad;
+	uint64_t offset;
+} __attribute__ ((__packed__)) ProfileBinMember;
+
+/**
+ * This struct is a loaded kernel struct profile (vtypes of dwarf.py)
+ * A json profile is parsed into structs, a binary one is used in place
+ * through header
+*/
+
+typedef struct profile {
+	ProfileStruct *structs;
+	int count;
+	int capacity;
+	const ProfileHeader *header; /* set for a binary profile */
+	void *file;              /* the mapped profile the names point into */
+	unsigned long long file_len;
+} Profile;
+
+Profile* profile_load(const char *filename, const char **wanted, int num_wanted);
+Profile* profile_load_json(const char *filename, const char **wanted, int num_wanted);
+Profile* profile_load_binary(const char *filename);
+int profile_write_binary(Profile *profile, const char *release, const char *filename);
+const char* profile_release(Profile *profile);
+long long profile_struct_size(Profile *profile, const char *name);
+long long profile_member_offset(Profile *profile, const char *name, const char *member);
+void profile_free(Profile *profile);
+
+#endif
@@ -0,0 +1,336 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "util.h"
+#include "dump.h"
+#include "vtop.h"
+#include "vma.h"
+#include "rmap.h"
+#include "stats.h"
+
+#define ENTRIES_PER_TABLE 512
+#define USER_ENTRIES 256           /* the lower half of a top level table */
+
+/* size of the direct map of all physical memory, skipped in init_pgt */
+#define DIRECT_MAP_SIZE (1ULL << 46)
+#define DIRECT_MAP_SIZE_LA57 (1ULL << 55)
+
+/**
+ * This struct is a part of the top level table of one address space
+*/
+typedef struct rmap_work {
+  unsigned long long root;   /* physical address of the top level table */
+  int owner;
+  int lo;                    /* top level entries [lo, hi) */
+  int hi;
+} RmapWork;
+
+/**
+ * This struct is the state shared by the walking threads
+*/
+typedef struct rmap_ctx {
+  Dump *dump;
+  RmapWork *work;
+  int num_work;
+  int next;
+  int levels;
+  unsigned long long direct_map;
+  unsigned long long direct_map_end;
+  unsigned long long limit;  /* mappings one work item may have, more means a corrupt table */
+} RmapCtx;
+
+/**
+ * This struct is what one thread found, each array sorted once it is done
+*/
+typedef struct rmap_part {
+  RmapEntry *entries[RMAP_NUM_SIZES];
+  unsigned long long count[RMAP_NUM_SIZES];
+  unsigned long long capacity[RMAP_NUM_SIZES];
+  unsigned long long tables;
+  unsigned long long missing;
+  int broken;
+} RmapPart;
+
+/**
+ * This struct is the walk of one work item
+*/
+typedef struct rmap_walk {
+  RmapCtx *ctx;
+  RmapPart *part;
+  int owner;
+  unsigned long long found;
+  unsigned long long table[5][ENTRIES_PER_TABLE]; /* one table per level being walked */
+} RmapWalk;
+
+static void rmap_add(RmapWalk *w, int size, unsigned long long pfn, unsigned long long vaddr) {
+  RmapPart *part = w->part;
+  if (part->count[size] == part->capacity[size]) {
+    part->capacity[size] = part->capacity[size] ? part->capacity[size] * 2 : 1024;
+    part->entries[size] = realloc(part->entries[size], sizeof(RmapEntry) * part->capacity[size]);
+    if (!part->entries[size]) {
+      _die("rmap_build - Unable to grow mapping array to %llu entries", part->capacity[size]);
+    }
+  }
+  RmapEntry *e = &part->entries[size][part->count[size]++];
+  e->pfn = pfn;
+  e->vaddr = vaddr;
+  e->owner = w->owner;
+  w->found += 1;
+}
+
+/**
+ * This function records every page a table maps, descending into the
+ * tables below it
+ * @params table - physical address of the table
+ * @params level - 0 for a page table, levels - 1 for the top level
+ * @params base - virtual address the table starts at
+ * @params lo, hi - entries to look at
+ * @returns 0, or -1 once the walk has more mappings than memory has pages
+*/
+static int walk_table(RmapWalk *w, unsigned long long table, int level, unsigned long long base, int lo, int hi) {
+  RmapCtx *ctx = w->ctx;
+  unsigned long long *entries = w->table[level];
+  w->part->tables += 1;
+  if (dump_read(ctx->dump, table, entries, PAGE_SIZE) == -1) {
+    w->part->missing += 1;
+    return 0;
+  }
+  STATS_ADD(table_reads, 1);
+
+  int shift = PAGE_SHIFT + 9 * level;
+  int top_bit = PAGE_SHIFT + 9 * ctx->levels - 1;
+  for (int i = lo; i < hi; i++) {
+    unsigned long long entry = entries[i];
+    if (!(entry & PTE_PRESENT)) {
+      continue;
+    }
+    unsigned long long vaddr = base | (unsigned long long) i << shift;
+    if (vaddr & (1ULL << top_bit)) {
+      vaddr |= ~((1ULL << top_bit) - 1); // canonical form
+    }
+    if (vaddr >= ctx->direct_map && vaddr < ctx->direct_map_end) {
+      continue;
+    }
+    if (w->found >= ctx->limit) {
+      return -1;
+    }
+    unsigned long long paddr = entry & PTE_ADDR_MASK;
+    if (!level) {
+      rmap_add(w, RMAP_4K, paddr >> PAGE_SHIFT, vaddr);
+    } else if (level <= 2 && (entry & PTE_PS)) {
+      rmap_add(w, level == 1 ? RMAP_2M : RMAP_1G, (paddr & ~((1ULL << shift) - 1)) >> PAGE_SHIFT, vaddr);
+    } else if (walk_table(w, paddr, level - 1, vaddr, 0, ENTRIES_PER_TABLE) == -1) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int entry_cmp(const void *a, const void *b) {
+  const RmapEntry *ea = a;
+  const RmapEntry *eb = b;
+  if (ea->pfn != eb->pfn) {
+    return (ea->pfn > eb->pfn) - (ea->pfn < eb->pfn);
+  }
+  if (ea->owner != eb->owner) {
+    return (ea->owner > eb->owner) - (ea->owner < eb->owner);
+  }
+  return (ea->vaddr > eb->vaddr) - (ea->vaddr < eb->vaddr);
+}
+
+static void* rmap_worker(void *arg) {
+  RmapCtx *ctx = arg;
+  RmapPart *part = calloc(1, sizeof(RmapPart));
+  RmapWalk *w = malloc(sizeof(RmapWalk));
+  w->ctx = ctx;
+  w->part = part;
+  for (;;) {
+    int i = __atomic_fetch_add(&ctx->next, 1, __ATOMIC_RELAXED);
+    if (i >= ctx->num_work) {
+      break;
+    }
+    RmapWork *work = &ctx->work[i];
+    w->owner = work->owner;
+    w->found = 0;
+    unsigned long long start[RMAP_NUM_SIZES];
+    memcpy(start, part->count, sizeof(start));
+    if (walk_table(w, work->root, ctx->levels - 1, 0, work->lo, work->hi) == -1) {
+      _debug("DEBUG: page tables at %llx map more than the dump holds, dropped", work->root);
+      memcpy(part->count, start, sizeof(start));
+      part->broken += 1;
+    }
+  }
+  free(w);
+  for (int s = 0; s < RMAP_NUM_SIZES; s++) {
+    qsort(part->entries[s], part->count[s], sizeof(RmapEntry), entry_cmp);
+  }
+  return part;
+}
+
+/**
+ * This function merges two sorted runs
+*/
+static void merge(const RmapEntry *a, unsigned long long na, const RmapEntry *b, unsigned long long nb, RmapEntry *out) {
+  unsigned long long i = 0;
+  unsigned long long j = 0;
+  while (i < na && j < nb) {
+    *out++ = entry_cmp(&a[i], &b[j]) <= 0 ? a[i++] : b[j++];
+  }
+  memcpy(out, a + i, (na - i) * sizeof(RmapEntry));
+  memcpy(out + (na - i), b + j, (nb - j) * sizeof(RmapEntry));
+}
+
+/**
+ * This function merges the sorted runs of every thread, pairwise
+ * @returns the merged array, the runs are freed
+*/
+static RmapEntry* merge_runs(RmapEntry **runs, unsigned long long *counts, int num_runs, unsigned long long *total) {
+  while (num_runs > 1) {
+    int out = 0;
+    for (int i = 0; i < num_runs; i += 2) {
+      if (i + 1 == num_runs) {
+        runs[out] = runs[i];
+        counts[out++] = counts[i];
+        continue;
+      }
+      RmapEntry *merged = malloc(sizeof(RmapEntry) * (counts[i] + counts[i + 1] + 1));
+      if (!merged) {
+        _die("rmap_build - Unable to merge %llu mappings", counts[i] + counts[i + 1]);
+      }
+      merge(runs[i], counts[i], runs[i + 1], counts[i + 1], merged);
+      free(runs[i]);
+      free(runs[i + 1]);
+      runs[out] = merged;
+      counts[out++] = counts[i] + counts[i + 1];
+    }
+    num_runs = out;
+  }
+  *total = num_runs ? counts[0] : 0;
+  return num_runs ? runs[0] : NULL;
+}
+
+/**
+ * This function builds the reverse map of a dump's address spaces
+ * The kernel half of init_pgt is walked once, in parallel by top level
+ * entry, and only the user half of each mm's tables since the kernel half
+ * is shared; the direct map is left out as it maps every frame
+ * @params dump - the opened dump
+ * @params kernel_pgd - physical address of init_pgt
+ * @params maps - the memory maps whose pgd are walked, may be NULL
+ * @params la57 - walk 5-level page tables
+ * @params direct_map - start of the direct map
+ * @params threads - walking threads
+ * @returns the map
+*/
+Rmap* rmap_build(Dump *dump, unsigned long long kernel_pgd, VmaMaps *maps, int la57,
+  unsigned long long direct_map, int threads) {
+  RmapCtx ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.dump = dump;
+  ctx.levels = la57 ? 5 : 4;
+  ctx.direct_map = direct_map;
+  ctx.direct_map_end = direct_map + (la57 ? DIRECT_MAP_SIZE_LA57 : DIRECT_MAP_SIZE);
+  if (ctx.direct_map_end < direct_map) {
+    ctx.direct_map_end = ~0ULL; // runs to the top of the address space
+  }
+  for (int i = 0; i < dump->num_ranges; i++) {
+    ctx.limit += (dump->ranges[i].e_addr - dump->ranges[i].s_addr + 1) >> PAGE_SHIFT;
+  }
+
+  int num_mms = maps ? maps->count : 0;
+  ctx.work = malloc(sizeof(RmapWork) * (ENTRIES_PER_TABLE - USER_ENTRIES + num_mms));
+  for (int i = USER_ENTRIES; i < ENTRIES_PER_TABLE; i++) {
+    ctx.work[ctx.num_work++] = (RmapWork) { kernel_pgd, RMAP_KERNEL, i, i + 1 };
+  }
+  for (int i = 0; i < num_mms; i++) {
+    if (maps->maps[i].pgd) {
+      ctx.work[ctx.num_work++] = (RmapWork) { maps->maps[i].pgd, i, 0, USER_ENTRIES };
+    }
+  }
+
+  threads = threads > 0 ? threads : 1;
+  pthread_t *tids = malloc(sizeof(pthread_t) * threads);
+  int started = 0;
+  for (int i = 1; i < threads; i++) {
+    if (pthread_create(&tids[started], NULL, rmap_worker, &ctx) != 0) {
+      _debug("DEBUG: unable to start rmap thread %d", i);
+      break;
+    }
+    started += 1;
+  }
+  RmapPart **parts = malloc(sizeof(RmapPart *) * (started + 1));
+  parts[0] = rmap_worker(&ctx);
+  for (int i = 0; i < started; i++) {
+    pthread_join(tids[i], (void **) &parts[i + 1]);
+  }
+  free(tids);
+  free(ctx.work);
+
+  Rmap *rmap = calloc(1, sizeof(Rmap));
+  RmapEntry **runs = malloc(sizeof(RmapEntry *) * (started + 1));
+  unsigned long long *counts = malloc(sizeof(unsigned long long) * (started + 1));
+  for (int s = 0; s < RMAP_NUM_SIZES; s++) {
+    for (int i = 0; i <= started; i++) {
+      runs[i] = parts[i]->entries[s];
+      counts[i] = parts[i]->count[s];
+    }
+    rmap->entries[s] = merge_runs(runs, counts, started + 1, &rmap->count[s]);
+  }
+  for (int i = 0; i <= started; i++) {
+    rmap->tables += parts[i]->tables;
+    rmap->missing += parts[i]->missing;
+    rmap->broken += parts[i]->broken;
+    free(parts[i]);
+  }
+  free(counts);
+  free(runs);
+  free(parts);
+  _debug("DEBUG: rmap of %llu 4K, %llu 2M and %llu 1G mappings from %llu tables, %llu missing",
+    rmap->count[RMAP_4K], rmap->count[RMAP_2M], rmap->count[RMAP_1G], rmap->tables, rmap->missing);
+  return rmap;
+}
+
+/**
+ * This function finds the processes (and the kernel) mapping a physical address
+ * @params rmap - the map
+ * @params paddr - the physical address
+ * @params owners - filled with up to max owners, by page size then owner
+ * @params max - size of owners
+ * @returns the number of owners, which may be more than max
+*/
+int rmap_lookup(const Rmap *rmap, unsigned long long paddr, RmapOwner *owners, int max) {
+  static const int shifts[RMAP_NUM_SIZES] = { PAGE_SHIFT, PMD_SHIFT, PUD_SHIFT };
+  int found = 0;
+  for (int s = 0; s < RMAP_NUM_SIZES; s++) {
+    unsigned long long page = paddr & ~((1ULL << shifts[s]) - 1);
+    unsigned long long pfn = page >> PAGE_SHIFT;
+    const RmapEntry *entries = rmap->entries[s];
+    unsigned long long lo = 0;
+    unsigned long long hi = rmap->count[s];
+    while (lo < hi) {
+      unsigned long long mid = lo + (hi - lo) / 2;
+      if (entries[mid].pfn < pfn) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    for (; lo < rmap->count[s] && entries[lo].pfn == pfn; lo++) {
+      if (found < max) {
+        owners[found].owner = entries[lo].owner;
+        owners[found].vaddr = entries[lo].vaddr + (paddr - page);
+      }
+      found += 1;
+    }
+  }
+  return found;
+}
+
+void rmap_free(Rmap *rmap) {
+  for (int s = 0; s < RMAP_NUM_SIZES; s++) {
+    free(rmap->entries[s]);
+  }
+  free(rmap);
+}
@@ -0,0 +1,54 @@
+#ifndef _RMAP_H
+#define _RMAP_H
+
+#include "dump.h"
+#include "vma.h"
+
+#define RMAP_KERNEL -1      /* owner of the mappings of init_pgt */
+
+/* page sizes, each kept in its own array */
+#define RMAP_4K 0
+#define RMAP_2M 1
+#define RMAP_1G 2
+#define RMAP_NUM_SIZES 3
+
+/**
+ * This struct is one mapping of a page, keyed by its first frame
+*/
+
+typedef struct rmap_entry {
+	unsigned long long pfn;    /* first frame, aligned to the page size */
+	unsigned long long vaddr;  /* first byte of the page */
+	int owner;                 /* index into VmaMaps.maps, or RMAP_KERNEL */
+} __attribute__ ((__packed__)) RmapEntry;
+
+/**
+ * This struct is every mapping of every walked address space, sorted by
+ * frame so the owners of a physical address are found by binary search
+ * A large page is one entry, looked up by the query's frame rounded down
+ * to the page size
+*/
+
+typedef struct rmap {
+	RmapEntry *entries[RMAP_NUM_SIZES];
+	unsigned long long count[RMAP_NUM_SIZES];
+	unsigned long long tables;         /* page tables walked */
+	unsigned long long missing;        /* tables not in the dump */
+	int broken;                        /* address spaces given up on as corrupt */
+} Rmap;
+
+/**
+ * This struct is one owner of a physical address
+*/
+
+typedef struct rmap_owner {
+	int owner;                 /* index into VmaMaps.maps, or RMAP_KERNEL */
+	unsigned long long vaddr;  /* the address itself, not its page */
+} RmapOwner;
+
+Rmap* rmap_build(Dump *dump, unsigned long long kernel_pgd, VmaMaps *maps, int la57,
+  unsigned long long direct_map, int threads);
+int rmap_lookup(const Rmap *rmap, unsigned long long paddr, RmapOwner *owners, int max);
+void rmap_free(Rmap *rmap);
+
+#endif
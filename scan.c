@@ -0,0 +1,505 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <emmintrin.h>
+
+#include "util.h"
+#include "dump.h"
+#include "rmap.h"
+#include "scan.h"
+#include "stats.h"
+
+/* transitions into a state some pattern ends at have the low bit set */
+#define SCAN_OUTPUT 1U
+
+/**
+ * This struct is one piece of a lime block handed to a worker
+ * start and end are byte offsets into the range's data
+*/
+typedef struct scan_work {
+  const DumpRange *range;
+  unsigned long long start;
+  unsigned long long end;
+} ScanWork;
+
+/**
+ * This struct is the state shared by the scanning threads
+*/
+typedef struct scan_ctx {
+  Dump *dump;
+  const ScanSet *set;
+  ScanWork *work;
+  int num_work;
+  int next;
+  unsigned long long total;  /* hits found by every thread */
+} ScanCtx;
+
+/**
+ * This function creates an empty pattern set
+*/
+ScanSet* scan_set_create() {
+  return calloc(1, sizeof(ScanSet));
+}
+
+static int hex_digit(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+/**
+ * This function adds a pattern to a set
+ * @params set - a set not compiled yet
+ * @params spec - the literal text, or hex:<bytes> for binary patterns
+ * @returns 0, or -1 if the pattern is empty, too long or bad hex
+*/
+int scan_set_add(ScanSet *set, const char *spec) {
+  ScanPattern p;
+  memset(&p, 0, sizeof(p));
+  size_t prefix = strlen(SCAN_HEX_PREFIX);
+  if (!strncmp(spec, SCAN_HEX_PREFIX, prefix)) {
+    const char *hex = spec + prefix;
+    for (; hex[0] && hex[1]; hex += 2) {
+      int hi = hex_digit(hex[0]);
+      int lo = hex_digit(hex[1]);
+      if (hi == -1 || lo == -1 || p.len == SCAN_MAX_LEN) {
+        return -1;
+      }
+      p.bytes[p.len++] = hi << 4 | lo;
+    }
+    if (hex[0]) {
+      return -1; // odd number of digits
+    }
+  } else {
+    size_t len = strlen(spec);
+    if (len > SCAN_MAX_LEN) {
+      return -1;
+    }
+    memcpy(p.bytes, spec, len);
+    p.len = len;
+  }
+  if (!p.len) {
+    return -1;
+  }
+
+  for (int i = 0; i < set->count; i++) {
+    if (set->patterns[i].len == p.len && !memcmp(set->patterns[i].bytes, p.bytes, p.len)) {
+      return 0; // already there
+    }
+  }
+  if (set->count == set->capacity) {
+    set->capacity = set->capacity ? set->capacity * 2 : 64;
+    set->patterns = realloc(set->patterns, sizeof(ScanPattern) * set->capacity);
+    if (!set->patterns) {
+      _die("scan_set_add - Unable to grow pattern array to %d entries", set->capacity);
+    }
+  }
+  p.text = strdup(spec);
+  set->patterns[set->count++] = p;
+  if (p.len > set->max_len) {
+    set->max_len = p.len;
+  }
+  return 0;
+}
+
+/**
+ * This function adds every line of a file to a set
+ * Blank lines and lines starting with # are skipped
+ * @returns the number of patterns added, or -1 if the file cannot be read
+ * or has a bad pattern
+*/
+int scan_set_load(ScanSet *set, const char *filename) {
+  FILE *f = fopen(filename, "r");
+  STATS_ADD(syscalls, 1);
+  if (!f) {
+    return -1;
+  }
+  char line[2 * SCAN_MAX_LEN + 16];
+  int added = 0;
+  while (fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (!line[0] || line[0] == '#') {
+      continue;
+    }
+    if (scan_set_add(set, line) == -1) {
+      _debug("DEBUG: bad pattern in %s: %s", filename, line);
+      fclose(f);
+      return -1;
+    }
+    added += 1;
+  }
+  fclose(f);
+  return added;
+}
+
+/**
+ * This function builds the automaton of a set
+ * The trie of the patterns is turned into a DFA breadth first, each
+ * missing edge taking the one of the state's fail link, so the scan never
+ * follows a fail link
+*/
+void scan_set_compile(ScanSet *set) {
+  memset(set->classes, 0, sizeof(set->classes));
+  memset(set->starts, 0, sizeof(set->starts));
+  int num_classes = 1; // class 0 is every byte no pattern uses
+  int total = 1;
+  set->num_starts = 0;
+  set->num_pairs = 0;
+  for (int i = 0; i < set->count; i++) {
+    ScanPattern *p = &set->patterns[i];
+    int k = 0;
+    while (k < set->num_pairs && k < SCAN_SIMD_STARTS && memcmp(set->pair_bytes[k], p->bytes, 2)) {
+      k++;
+    }
+    if (p->len < 2) {
+      set->num_pairs = SCAN_SIMD_STARTS + 1;
+    } else if (k == set->num_pairs) {
+      if (k < SCAN_SIMD_STARTS) {
+        memcpy(set->pair_bytes[k], p->bytes, 2);
+      }
+      set->num_pairs += 1;
+    }
+    if (!set->starts[p->bytes[0]]) {
+      if (set->num_starts < SCAN_SIMD_STARTS) {
+        set->start_bytes[set->num_starts] = p->bytes[0];
+      }
+      set->num_starts += 1;
+    }
+    set->starts[p->bytes[0]] = 1;
+    for (int j = 0; j < p->len; j++) {
+      if (!set->classes[p->bytes[j]]) {
+        set->classes[p->bytes[j]] = num_classes++;
+      }
+    }
+    total += p->len;
+  }
+  set->class_shift = 1; // rows at least 2 wide keep the low bit of a row offset free
+  while ((1 << set->class_shift) < num_classes) {
+    set->class_shift += 1;
+  }
+  int shift = set->class_shift;
+  int width = 1 << shift;
+
+  set->next = calloc((size_t) total << shift, sizeof(unsigned int));
+  set->match = malloc(sizeof(int) * total);
+  set->dict = calloc(total, sizeof(int));
+  if (!set->next || !set->match || !set->dict) {
+    _die("scan_set_compile - Unable to allocate %d states", total);
+  }
+  memset(set->match, 0xff, sizeof(int) * total);
+
+  /* the trie, 0 marks a missing edge as no edge leads back to the root */
+  set->num_states = 1;
+  for (int i = 0; i < set->count; i++) {
+    ScanPattern *p = &set->patterns[i];
+    unsigned int s = 0;
+    for (int j = 0; j < p->len; j++) {
+      unsigned int *edge = &set->next[(s << shift) + set->classes[p->bytes[j]]];
+      if (!*edge) {
+        *edge = set->num_states++ << shift;
+      }
+      s = *edge >> shift;
+    }
+    set->match[s] = i;
+  }
+
+  /* fail links, breadth first so a state's fail row is complete before its own */
+  int *fail = calloc(set->num_states, sizeof(int));
+  int *queue = malloc(sizeof(int) * set->num_states);
+  int head = 0;
+  int tail = 0;
+  queue[tail++] = 0;
+  while (head < tail) {
+    int s = queue[head++];
+    for (int c = 0; c < width; c++) {
+      unsigned int *edge = &set->next[((unsigned int) s << shift) + c];
+      unsigned int down = set->next[((unsigned int) fail[s] << shift) + c];
+      if (!*edge) {
+        *edge = s ? down : 0;
+        continue;
+      }
+      int t = *edge >> shift;
+      int f = s ? (int) (down >> shift) : 0;
+      fail[t] = f;
+      set->dict[t] = set->match[f] != -1 ? f : set->dict[f];
+      queue[tail++] = t;
+    }
+  }
+  free(queue);
+  free(fail);
+
+  for (size_t i = 0; i < ((size_t) set->num_states << shift); i++) {
+    int t = set->next[i] >> shift;
+    if (set->match[t] != -1 || set->dict[t]) {
+      set->next[i] |= SCAN_OUTPUT;
+    }
+  }
+  _debug("DEBUG: %d patterns, %d states, %d byte classes", set->count, set->num_states, num_classes);
+}
+
+void scan_set_free(ScanSet *set) {
+  for (int i = 0; i < set->count; i++) {
+    free(set->patterns[i].text);
+  }
+  free(set->patterns);
+  free(set->next);
+  free(set->match);
+  free(set->dict);
+  free(set);
+}
+
+/**
+ * This function appends a hit, growing the array when full
+*/
+static ScanHit* scan_add(ScanResult *result) {
+  if (result->count == result->capacity) {
+    result->capacity = result->capacity ? result->capacity * 2 : 256;
+    result->hits = realloc(result->hits, result->capacity * sizeof(ScanHit));
+    if (!result->hits) {
+      _die("scan_dump - Unable to grow hit array to %d entries", result->capacity);
+    }
+  }
+  return &result->hits[result->count++];
+}
+
+/**
+ * This function records every pattern ending at a state
+ * @params end - offset in the range of the last byte matched
+ * @params limit - patterns starting at or past it belong to the next work item
+*/
+static void report(ScanCtx *ctx, const DumpRange *range, int state, unsigned long long end,
+  unsigned long long limit, ScanResult *result) {
+  const ScanSet *set = ctx->set;
+  for (int s = set->match[state] != -1 ? state : set->dict[state]; s; s = set->dict[s]) {
+    int pattern = set->match[s];
+    unsigned long long start = end + 1 - set->patterns[pattern].len;
+    if (start >= limit) {
+      continue;
+    }
+    if (__atomic_add_fetch(&ctx->total, 1, __ATOMIC_RELAXED) > SCAN_MAX_HITS) {
+      continue;
+    }
+    ScanHit *hit = scan_add(result);
+    hit->paddr = range->s_addr + start;
+    hit->pattern = pattern;
+    hit->first_owner = 0;
+    hit->num_owners = 0;
+  }
+}
+
+/**
+ * This function finds the next byte some pattern may start at
+ * Few distinct first two bytes are compared 16 positions at a time, else
+ * few distinct first bytes (memchr for one), so the automaton only runs
+ * near candidates; random data rarely has a pair, a first byte often
+ * @params needles - the start bytes broadcast, set->num_starts of them
+ * @params pairs - the first two bytes broadcast, set->num_pairs of them
+ * @returns the offset of the byte, n if there is none
+*/
+static inline unsigned long long skip(const ScanSet *set, const __m128i *needles, const __m128i (*pairs)[2],
+  const unsigned char *p, unsigned long long i, unsigned long long n) {
+  if (set->num_pairs <= SCAN_SIMD_STARTS) {
+    for (; i + 17 <= n; i += 16) {
+      __m128i v0 = _mm_loadu_si128((const __m128i *) (p + i));
+      __m128i v1 = _mm_loadu_si128((const __m128i *) (p + i + 1));
+      __m128i eq = _mm_and_si128(_mm_cmpeq_epi8(v0, pairs[0][0]), _mm_cmpeq_epi8(v1, pairs[0][1]));
+      for (int k = 1; k < set->num_pairs; k++) {
+        eq = _mm_or_si128(eq, _mm_and_si128(_mm_cmpeq_epi8(v0, pairs[k][0]), _mm_cmpeq_epi8(v1, pairs[k][1])));
+      }
+      int mask = _mm_movemask_epi8(eq);
+      if (mask) {
+        return i + __builtin_ctz(mask);
+      }
+    }
+  } else if (set->num_starts == 1) {
+    const unsigned char *q = memchr(p + i, set->start_bytes[0], n - i);
+    return q ? (unsigned long long) (q - p) : n;
+  } else if (set->num_starts <= SCAN_SIMD_STARTS) {
+    for (; i + 16 <= n; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+      __m128i eq = _mm_cmpeq_epi8(v, needles[0]);
+      for (int k = 1; k < set->num_starts; k++) {
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi8(v, needles[k]));
+      }
+      int mask = _mm_movemask_epi8(eq);
+      if (mask) {
+        return i + __builtin_ctz(mask);
+      }
+    }
+  }
+  while (i < n && !set->starts[p[i]]) {
+    i++;
+  }
+  return i;
+}
+
+/**
+ * This function scans one work item into result
+ * The automaton runs on past the end of the item by up to the longest
+ * pattern, so matches straddling two items are found by the first
+ * @params buf - window buffer for a compressed dump, NULL otherwise
+*/
+static void scan_work(ScanCtx *ctx, const ScanWork *work, ScanResult *result, unsigned char *buf) {
+  const ScanSet *set = ctx->set;
+  const DumpRange *range = work->range;
+  unsigned long long block_len = range->e_addr - range->s_addr + 1;
+  unsigned long long end = work->end + set->max_len - 1;
+  if (end > block_len) {
+    end = block_len;
+  }
+  STATS_ADD(scan_bytes, end - work->start);
+
+  const unsigned int *next = set->next;
+  const unsigned char *classes = set->classes;
+  int shift = set->class_shift;
+  __m128i needles[SCAN_SIMD_STARTS];
+  for (int k = 0; k < set->num_starts && k < SCAN_SIMD_STARTS; k++) {
+    needles[k] = _mm_set1_epi8(set->start_bytes[k]);
+  }
+  __m128i pairs[SCAN_SIMD_STARTS][2];
+  for (int k = 0; k < set->num_pairs && k < SCAN_SIMD_STARTS; k++) {
+    pairs[k][0] = _mm_set1_epi8(set->pair_bytes[k][0]);
+    pairs[k][1] = _mm_set1_epi8(set->pair_bytes[k][1]);
+  }
+  unsigned int row = 0;
+  for (unsigned long long pos = work->start; pos < end; pos += DUMP_WINDOW_SIZE) {
+    unsigned long long n = pos + DUMP_WINDOW_SIZE < end ? DUMP_WINDOW_SIZE : end - pos;
+    const unsigned char *p = dump_range_bytes(ctx->dump, range, pos, n, buf);
+    for (unsigned long long i = 0; i < n; i++) {
+      if (!row && (i = skip(set, needles, (const __m128i (*)[2]) pairs, p, i, n)) == n) {
+        break;
+      }
+      row = next[row + classes[p[i]]];
+      if (row & SCAN_OUTPUT) {
+        row &= ~SCAN_OUTPUT;
+        report(ctx, range, row >> shift, pos + i, work->end, result);
+      }
+    }
+  }
+}
+
+static void* scan_worker(void *arg) {
+  ScanCtx *ctx = arg;
+  ScanResult *result = calloc(1, sizeof(ScanResult));
+  unsigned char *buf = ctx->dump->cdump ? malloc(DUMP_WINDOW_SIZE) : NULL;
+  for (;;) {
+    int w = __atomic_fetch_add(&ctx->next, 1, __ATOMIC_RELAXED);
+    if (w >= ctx->num_work) {
+      break;
+    }
+    scan_work(ctx, &ctx->work[w], result, buf);
+  }
+  free(buf);
+  return result;
+}
+
+static int hit_cmp(const void *a, const void *b) {
+  const ScanHit *ha = a;
+  const ScanHit *hb = b;
+  if (ha->paddr != hb->paddr) {
+    return (ha->paddr > hb->paddr) - (ha->paddr < hb->paddr);
+  }
+  return ha->pattern - hb->pattern;
+}
+
+/**
+ * This function searches every lime block for all the patterns of a set
+ * Blocks are cut in chunks taken by idle threads from a shared counter, as
+ * the carver does
+ * @params dump - the opened dump
+ * @params set - a compiled set
+ * @params threads - scanning threads
+ * @returns the hits sorted by physical address, without owners
+*/
+ScanResult* scan_dump(Dump *dump, const ScanSet *set, int threads) {
+  ScanCtx ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.dump = dump;
+  ctx.set = set;
+
+  for (int i = 0; i < dump->num_ranges; i++) {
+    unsigned long long len = dump->ranges[i].e_addr - dump->ranges[i].s_addr + 1;
+    ctx.num_work += (len + SCAN_CHUNK_SIZE - 1) / SCAN_CHUNK_SIZE;
+  }
+  ctx.work = malloc(sizeof(ScanWork) * (ctx.num_work ? ctx.num_work : 1));
+  int w = 0;
+  for (int i = 0; i < dump->num_ranges; i++) {
+    unsigned long long len = dump->ranges[i].e_addr - dump->ranges[i].s_addr + 1;
+    for (unsigned long long start = 0; start < len; start += SCAN_CHUNK_SIZE) {
+      ctx.work[w].range = &dump->ranges[i];
+      ctx.work[w].start = start;
+      ctx.work[w].end = start + SCAN_CHUNK_SIZE < len ? start + SCAN_CHUNK_SIZE : len;
+      w += 1;
+    }
+  }
+  if (!set->count) {
+    ctx.num_work = 0;
+  }
+
+  threads = threads > 0 ? threads : 1;
+  pthread_t *tids = malloc(sizeof(pthread_t) * threads);
+  int started = 0;
+  for (int i = 1; i < threads; i++) {
+    if (pthread_create(&tids[started], NULL, scan_worker, &ctx) != 0) {
+      _debug("DEBUG: unable to start scan thread %d", i);
+      break;
+    }
+    started += 1;
+  }
+
+  ScanResult *result = scan_worker(&ctx);
+  for (int i = 0; i < started; i++) {
+    ScanResult *part;
+    pthread_join(tids[i], (void **) &part);
+    for (int j = 0; j < part->count; j++) {
+      *scan_add(result) = part->hits[j];
+    }
+    scan_result_free(part);
+  }
+  free(tids);
+  free(ctx.work);
+
+  result->total = ctx.total;
+  qsort(result->hits, result->count, sizeof(ScanHit), hit_cmp);
+  _debug("DEBUG: %llu hits, %d kept", result->total, result->count);
+  return result;
+}
+
+/**
+ * This function finds the processes, and kernel mappings, of each hit
+ * Hits in pages nothing maps (page cache, freed pages) get no owner
+ * @params rmap - the reverse map of the dump
+ * @params result - a scan result, its owners are filled in
+*/
+void scan_attribute(const Rmap *rmap, ScanResult *result) {
+  int capacity = 0;
+  result->num_owners = 0;
+  for (int i = 0; i < result->count; i++) {
+    ScanHit *hit = &result->hits[i];
+    int n = rmap_lookup(rmap, hit->paddr, NULL, 0);
+    if (result->num_owners + n > capacity) {
+      capacity = (result->num_owners + n) * 2;
+      result->owners = realloc(result->owners, sizeof(RmapOwner) * capacity);
+      if (!result->owners) {
+        _die("scan_attribute - Unable to grow owner array to %d entries", capacity);
+      }
+    }
+    hit->first_owner = result->num_owners;
+    hit->num_owners = rmap_lookup(rmap, hit->paddr, &result->owners[result->num_owners], n);
+    result->num_owners += hit->num_owners;
+  }
+}
+
+void scan_result_free(ScanResult *result) {
+  free(result->hits);
+  free(result->owners);
+  free(result);
+}
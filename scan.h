@@ -0,0 +1,83 @@
+#ifndef _SCAN_H
+#define _SCAN_H
+
+#include "dump.h"
+#include "rmap.h"
+
+#define SCAN_CHUNK_SIZE (16ULL << 20)  /* each worker takes this much of a lime block at a time */
+#define SCAN_MAX_LEN 256               /* longest pattern */
+#define SCAN_MAX_HITS 1000000          /* hits kept, the rest are only counted */
+#define SCAN_HEX_PREFIX "hex:"         /* a pattern given as hex bytes, e.g. hex:4d5a9000 */
+#define SCAN_SIMD_STARTS 8             /* starts looked for 16 bytes at a time, more use the table */
+
+/**
+ * This struct is one pattern, matched literally
+*/
+
+typedef struct scan_pattern {
+	unsigned char bytes[SCAN_MAX_LEN];
+	int len;
+	char *text;                /* as given, for printing */
+} ScanPattern;
+
+/**
+ * This struct is a set of patterns and the Aho-Corasick automaton matching
+ * all of them in one pass
+ * Bytes no pattern uses share one class, so a row of the transition table
+ * is only as wide as the patterns' alphabet; rows are a power of two wide and
+ * transitions hold row offsets, so the state is recovered by a shift
+*/
+
+typedef struct scan_set {
+	ScanPattern *patterns;
+	int count;
+	int capacity;
+	int max_len;
+	/* the automaton, built by scan_set_compile */
+	unsigned char classes[256];   /* byte -> class */
+	unsigned char starts[256];    /* byte begins some pattern */
+	unsigned char start_bytes[SCAN_SIMD_STARTS];
+	int num_starts;               /* distinct first bytes, only listed in start_bytes up to SCAN_SIMD_STARTS */
+	unsigned char pair_bytes[SCAN_SIMD_STARTS][2];
+	int num_pairs;                /* distinct first two bytes, as num_starts; past the limit with a one byte pattern */
+	int class_shift;              /* log2 of the row width */
+	int num_states;
+	unsigned int *next;           /* num_states rows of transitions */
+	int *match;                   /* pattern ending at a state, -1 if none */
+	int *dict;                    /* nearest state on the fail chain with a match, 0 if none */
+} ScanSet;
+
+/**
+ * This struct is one occurrence of a pattern
+*/
+
+typedef struct scan_hit {
+	unsigned long long paddr;  /* first byte */
+	int pattern;
+	int first_owner;           /* into ScanResult.owners */
+	int num_owners;
+} ScanHit;
+
+/**
+ * This struct is the hits of a scan, sorted by physical address
+*/
+
+typedef struct scan_result {
+	ScanHit *hits;
+	int count;
+	int capacity;
+	unsigned long long total;  /* hits found, more than count once SCAN_MAX_HITS is reached */
+	RmapOwner *owners;         /* each hit's, in hit order */
+	int num_owners;
+} ScanResult;
+
+ScanSet* scan_set_create();
+int scan_set_add(ScanSet *set, const char *spec);
+int scan_set_load(ScanSet *set, const char *filename);
+void scan_set_compile(ScanSet *set);
+void scan_set_free(ScanSet *set);
+ScanResult* scan_dump(Dump *dump, const ScanSet *set, int threads);
+void scan_attribute(const Rmap *rmap, ScanResult *result);
+void scan_result_free(ScanResult *result);
+
+#endif
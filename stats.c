@@ -0,0 +1,67 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "stats.h"
+
+Stats stats;
+
+static const char *phase_names[STATS_NUM_PHASES] = {
+  "parse_system_map", "get_lime_headers", "find_init_task",
+  "walk_process_list", "print_process_list", "carve_tasks", "extract", "scan"
+};
+
+/**
+ * This function reads the monotonic clock
+ * @returns nanoseconds from an arbitrary start
+*/
+unsigned long long stats_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * This function adds the time since start to a phase
+ * @params phase - one of STATS_*
+ * @params start - stats_now() when the phase began
+*/
+void stats_phase(int phase, unsigned long long start) {
+  STATS_ADD(phase_ns[phase], stats_now() - start);
+}
+
+/**
+ * This function writes the counters as one line of JSON
+ * @params out - where to write
+ * @params input - the dump (or manifest) the counters are for, may be NULL
+*/
+void stats_write_json(FILE *out, const char *input) {
+  fprintf(out, "{\"input\": ");
+  if (input) {
+    fputc('"', out);
+    for (const char *c = input; *c; c++) {
+      if (*c == '"' || *c == '\\') {
+        fputc('\\', out);
+      }
+      if ((unsigned char) *c < 0x20) {
+        fprintf(out, "\\u%04x", *c);
+      } else {
+        fputc(*c, out);
+      }
+    }
+    fputc('"', out);
+  } else {
+    fprintf(out, "null");
+  }
+  fprintf(out, ", \"syscalls\": %llu, \"bytes_read\": %llu, \"dump_bytes\": %llu, \"scan_bytes\": %llu, \"bytes_written\": %llu",
+    stats.syscalls, stats.bytes_read, stats.dump_bytes, stats.scan_bytes, stats.bytes_written);
+  fprintf(out, ", \"chunks_inflated\": %llu, \"chunk_hits\": %llu", stats.chunks_inflated, stats.chunk_hits);
+  fprintf(out, ", \"translations\": %llu, \"tlb_hits\": %llu, \"tlb_misses\": %llu, \"pwc_hits\": %llu, \"table_reads\": %llu",
+    stats.translations, stats.tlb_hits, stats.translations - stats.tlb_hits, stats.pwc_hits, stats.table_reads);
+  fprintf(out, ", \"tasks\": %llu, \"phases_ns\": {", stats.tasks);
+  for (int i = 0; i < STATS_NUM_PHASES; i++) {
+    fprintf(out, "%s\"%s\": %llu", i ? ", " : "", phase_names[i], stats.phase_ns[i]);
+  }
+  fprintf(out, "}}\n");
+  fflush(out);
+}
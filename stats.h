@@ -0,0 +1,47 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdio.h>
+
+/* timed stages of an analysis */
+#define STATS_SYMBOLS 0   /* parse_system_map */
+#define STATS_HEADERS 1   /* get_lime_headers */
+#define STATS_LOCATE 2    /* find_init_task */
+#define STATS_WALK 3      /* walk_process_list, listing the tasks as it goes */
+#define STATS_PRINT 4     /* the rest of the list, the tree and the maps */
+#define STATS_CARVE 5     /* print_carved_tasks */
+#define STATS_EXTRACT 6   /* extract_process_pages */
+#define STATS_SCAN 7      /* print_scan_hits */
+#define STATS_NUM_PHASES 8
+
+/**
+ * This struct is the process wide cost of the analysis
+ * Counters are bumped with relaxed atomics, so the scanning threads can share
+ * them; the translator keeps its own counters and adds them in on vtop_free
+*/
+
+typedef struct stats {
+	unsigned long long syscalls;       /* open, read, lseek, mmap... issued on the inputs */
+	unsigned long long bytes_read;     /* read(2) into buffers */
+	unsigned long long dump_bytes;     /* handed out by dump_ptr and dump_read */
+	unsigned long long scan_bytes;     /* searched by the locator and the carver */
+	unsigned long long bytes_written;  /* extracted to an output file */
+	unsigned long long chunks_inflated; /* compressed dump chunks decompressed */
+	unsigned long long chunk_hits;     /* compressed dump chunks found in a cache */
+	unsigned long long translations;   /* vtop_translate calls */
+	unsigned long long tlb_hits;
+	unsigned long long pwc_hits;       /* walks resumed from a cached paging-structure entry */
+	unsigned long long table_reads;    /* paging entries read from the dump */
+	unsigned long long tasks;          /* task_structs visited */
+	unsigned long long phase_ns[STATS_NUM_PHASES];
+} Stats;
+
+extern Stats stats;
+
+#define STATS_ADD(counter, n) __atomic_fetch_add(&stats.counter, (n), __ATOMIC_RELAXED)
+
+unsigned long long stats_now();
+void stats_phase(int phase, unsigned long long start);
+void stats_write_json(FILE *out, const char *input);
+
+#endif
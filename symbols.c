@@ -0,0 +1,194 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "util.h"
+#include "symbols.h"
+#include "stats.h"
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+/* rough System.map line length, used to size the first allocation */
+#define AVG_LINE_LEN 32
+
+/**
+ * This function hashes a symbol name (FNV-1a)
+ * @params symbol - the name
+ * @params len - length of the name
+ * @returns the 32 bit hash
+*/
+static unsigned int symbol_hash(const char *symbol, unsigned int len) {
+  unsigned int h = FNV_OFFSET;
+  for (unsigned int i = 0; i < len; i++) {
+    h ^= (unsigned char) symbol[i];
+    h *= FNV_PRIME;
+  }
+  return h;
+}
+
+/**
+ * This function builds the open addressing index over the parsed symbols
+ * The table is kept at most half full so probe chains stay short
+ * On duplicate names the first entry in the file wins, as the old linear search did
+ * @params table - table with map and count filled in
+*/
+static void build_symbol_index(SymbolTable *table) {
+  unsigned int capacity = 16;
+  while (capacity < (unsigned int) table->count * 2) {
+    capacity <<= 1;
+  }
+  table->slots = calloc(capacity, sizeof(unsigned int));
+  table->mask = capacity - 1;
+
+  for (int i = 0; i < table->count; i++) {
+    Map *sym = &table->map[i];
+    unsigned int slot = sym->hash & table->mask;
+    while (table->slots[slot]) {
+      Map *other = &table->map[table->slots[slot] - 1];
+      if (other->hash == sym->hash && other->len == sym->len &&
+          memcmp(other->symbol, sym->symbol, sym->len) == 0) {
+        break; // keep first definition
+      }
+      slot = (slot + 1) & table->mask;
+    }
+    if (!table->slots[slot]) {
+      table->slots[slot] = i + 1;
+    }
+  }
+}
+
+/**
+ * This function returns the associated virtual address of a symbol 
+ * @param table - the symbol table to search 
+ * @param symbol - the symbol to search for
+ * @returns Either the address if found or -1 if sysmbol isn't present
+*/
+unsigned long long get_symbol_vaddr(SymbolTable *table, const char* symbol) {
+  unsigned int len = strlen(symbol);
+  unsigned int hash = symbol_hash(symbol, len);
+  unsigned int slot = hash & table->mask;
+  while (table->slots[slot]) {
+    Map *entry = &table->map[table->slots[slot] - 1];
+    if (entry->hash == hash && entry->len == len && memcmp(entry->symbol, symbol, len) == 0) {
+      return entry->vaddr;
+    }
+    slot = (slot + 1) & table->mask;
+  }
+  return -1;
+}
+
+/**
+ * This function appends a symbol, growing the array when full
+ * @params table - the table to add to
+ * @returns the new (uninitialised) entry
+*/
+static Map* symbol_table_add(SymbolTable *table) {
+  if (table->count == table->capacity) {
+    table->capacity = table->capacity ? table->capacity * 2 : 1024;
+    table->map = realloc(table->map, table->capacity * sizeof(Map));
+    if (!table->map) {
+      _die("parse_system_map - Unable to grow symbol array to %d entries", table->capacity);
+    }
+  }
+  return &table->map[table->count++];
+}
+
+/**
+ * This function parses the system map file and returns a table
+ * of its symbols indexed by name
+ * The file is mapped and scanned once, lines are "<hex addr> <type> <name>"
+ * Names are stored as views into the mapping so no strings are copied
+ * Closes the file descriptor on exit!
+ * @params fd - file descriptor of system map
+ * @return the symbol table
+*/
+SymbolTable* parse_system_map(int fd) {
+  SymbolTable *table = calloc(1, sizeof(SymbolTable));
+  unsigned long long fileSize = get_file_length(fd);
+
+  if (fileSize) {
+    table->file = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (table->file == MAP_FAILED) {
+      _die("parse_system_map - Unable to map system map");
+    }
+    table->file_len = fileSize;
+    madvise(table->file, fileSize, MADV_SEQUENTIAL);
+    STATS_ADD(syscalls, 2);
+  }
+
+  table->capacity = fileSize / AVG_LINE_LEN + 1;
+  table->map = malloc(table->capacity * sizeof(Map));
+
+  const char *p = table->file;
+  const char *end = p + fileSize;
+  int line = 0;
+  while (p < end) {
+    line += 1;
+
+    // Address
+    unsigned long long vaddr = 0;
+    const char *addr_start = p;
+    for (; p < end; p++) {
+      unsigned int c = (unsigned char) *p;
+      unsigned int digit;
+      if (c - '0' < 10) {
+        digit = c - '0';
+      } else if ((c | 0x20) - 'a' < 6) {
+        digit = (c | 0x20) - 'a' + 10;
+      } else {
+        break;
+      }
+      vaddr = (vaddr << 4) | digit;
+    }
+    int has_addr = p != addr_start;
+
+    // Type (not used)
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\n') p++;
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+
+    // Symbol
+    const char *name = p;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') p++;
+    unsigned int len = p - name;
+
+    // skip anything trailing on the line
+    while (p < end && *p != '\n') p++;
+    p++;
+
+    if (!has_addr || !len) {
+      _debug("DEBUG: Error parsing symbol on line %d", line);
+      continue;
+    }
+
+    Map *sym = symbol_table_add(table);
+    sym->symbol = name;
+    sym->len = len;
+    sym->hash = symbol_hash(name, len);
+    sym->vaddr = vaddr;
+  }
+
+  build_symbol_index(table);
+  _debug("DEBUG: parsed %d symbols", table->count);
+
+  close(fd);
+  STATS_ADD(syscalls, 1);
+  return table;
+}
+
+/**
+ * This function frees a symbol table and unmaps the file its names point into
+ * @params table - the table to free
+*/
+void symbol_table_free(SymbolTable *table) {
+  if (table->file) {
+    munmap(table->file, table->file_len);
+    STATS_ADD(syscalls, 1);
+  }
+  free(table->map);
+  free(table->slots);
+  free(table);
+}
@@ -0,0 +1,35 @@
+#ifndef _SYMBOLS_H
+#define _SYMBOLS_H
+
+/**
+ * This struct is one symbol of the System.map-X file
+ * symbol is a view into the mapped file and is NOT NUL terminated
+*/
+
+typedef struct symbol {
+	const char *symbol;
+	unsigned int len;
+	unsigned int hash;
+	unsigned long long vaddr;
+} Map;
+
+/**
+ * This struct holds the parsed symbols and an open addressing hash table over them
+ * slots hold an index into map + 1, 0 marks an empty slot
+*/
+
+typedef struct symbol_table {
+	Map *map;
+	int count;
+	int capacity;
+	unsigned int *slots;
+	unsigned int mask;
+	void *file;              /* the mapped System.map the names point into */
+	unsigned long long file_len;
+} SymbolTable;
+
+SymbolTable* parse_system_map(int fd);
+unsigned long long get_symbol_vaddr(SymbolTable *table, const char* symbol);
+void symbol_table_free(SymbolTable *table);
+
+#endif
@@ -0,0 +1,104 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "util.h"
+#include "stats.h"
+
+int debug = 0;
+
+void _debug(const char *format,...) {
+  if (debug) {
+    va_list va;
+    va_start(va,format);
+    vfprintf(stdout,format,va);
+    va_end(va);
+    printf("\n");
+  }
+}
+
+void _die(const char *format,...) {
+  va_list va;
+  va_start(va,format);
+  vfprintf(stderr,format,va);
+  va_end(va);
+  printf("\n");
+  exit(1);
+}
+
+/**
+ * ****************************************************
+ * FILE PROCESSING
+ * ****************************************************
+*/
+
+/**
+ * This function opens a file read-only and returns a file descriptor
+ * Every input (dump, System.map, profile, vmlinux) is only read, so read
+ * permission and a read-only filesystem are enough
+ * @param filename - char* to name of file
+ * @return a FILE descriptor to the file
+*/
+int open_file(const char* filename) {
+  int fd;
+
+  fd = open(filename, O_RDONLY);
+  STATS_ADD(syscalls, 1);
+  if (fd == -1) {
+   _die("Could not open file: %s", filename);
+  }
+  _debug("DEBUG: Succesful open of file: %s", filename);
+  return fd;
+}
+
+/**
+ * This function returns the length of a file using fseek()
+ * @params fd - an open descriptor
+ * @returns n or 0
+*/
+unsigned long long get_file_length(int fd) {
+  lseek(fd, 0, SEEK_SET);
+  unsigned long long size = lseek(fd, 0, SEEK_END);
+  if(size == (unsigned long long) -1) {
+    _die("ERROR: Cannot seek to end of file");
+  }
+  lseek(fd, 0, SEEK_SET);
+  STATS_ADD(syscalls, 3);
+    
+  _debug("DEBUG: found size of file");
+  
+  return size;
+}
+
+/**
+ * This function hashes the contents of a file (64 bit FNV-1a)
+ * Used to recognise the same System.map or profile under different names
+ * @params filename - the file to hash
+ * @returns the hash
+*/
+unsigned long long hash_file(const char* filename) {
+  int fd = open_file(filename);
+  unsigned long long size = get_file_length(fd);
+  unsigned long long h = 14695981039346656037ULL;
+  if (size) {
+    const unsigned char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      _die("ERROR: Cannot map file: %s", filename);
+    }
+    madvise((void *) data, size, MADV_SEQUENTIAL);
+    for (unsigned long long i = 0; i < size; i++) {
+      h ^= data[i];
+      h *= 1099511628211ULL;
+    }
+    munmap((void *) data, size);
+    STATS_ADD(syscalls, 3);
+  }
+  close(fd);
+  STATS_ADD(syscalls, 1);
+  return h;
+}
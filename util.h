@@ -0,0 +1,14 @@
+#ifndef _UTIL_H
+#define _UTIL_H
+
+/* DEBUG FLAG */
+extern int debug;
+
+void _debug(const char *format,...);
+void _die(const char *format,...);
+
+int open_file(const char* filename);
+unsigned long long get_file_length(int fd);
+unsigned long long hash_file(const char* filename);
+
+#endif
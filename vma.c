@@ -0,0 +1,450 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "util.h"
+#include "dump.h"
+#include "vtop.h"
+#include "aread.h"
+#include "profile.h"
+#include "vma.h"
+
+/**
+ * This struct is the state of one vma_collect
+*/
+typedef struct vma_ctx {
+  Dump *dump;
+  Translator *kernel;
+  const VmaParams *params;
+  AReader *ar;
+} VmaCtx;
+
+/**
+ * This function sets the offsets of a 4.15 x86_64 kernel
+ * mm_struct and vm_area_struct are those of dwarf_output_json
+ * @params params - the parameters to fill in
+*/
+void vma_params_init(VmaParams *params) {
+  memset(params, 0, sizeof(VmaParams));
+  params->mm_offset = 0x3a8;
+  params->mmap_offset = 0x0;
+  params->pgd_offset = 0x40;
+  params->vm_start_offset = 0x0;
+  params->vm_end_offset = 0x8;
+  params->vm_next_offset = 0x10;
+  params->vm_flags_offset = 0x50;
+  params->vm_pgoff_offset = 0x98;
+  params->vm_file_offset = 0xa0;
+  params->vma_size = 0xa8;
+  params->file_dentry_offset = 0x18;
+  params->dentry_name_offset = 0x28;
+  params->direct_map = 0xffff880000000000ULL;
+}
+
+/**
+ * This function returns the offset of a member of a member, e.g. file.f_path.dentry
+ * @returns the offset or -1 if the profile does not have both
+*/
+static long long nested_offset(Profile *profile, const char *name, const char *member, const char *type, const char *inner) {
+  long long outer = profile_member_offset(profile, name, member);
+  long long offset = profile_member_offset(profile, type, inner);
+  return outer == -1 || offset == -1 ? -1 : outer + offset;
+}
+
+/**
+ * This function takes the offsets from a profile
+ * The file and dentry offsets are only used when the profile has them all
+ * @params params - the parameters, left as they are on failure
+ * @params profile - the loaded profile
+ * @returns 0 or -1 if the profile is missing task_struct.mm, mm_struct or
+ * vm_area_struct members
+*/
+int vma_params_from_profile(VmaParams *params, Profile *profile) {
+  long long offsets[] = {
+    profile_member_offset(profile, "task_struct", "mm"),
+    profile_member_offset(profile, "mm_struct", "mmap"),
+    profile_member_offset(profile, "mm_struct", "pgd"),
+    profile_member_offset(profile, "vm_area_struct", "vm_start"),
+    profile_member_offset(profile, "vm_area_struct", "vm_end"),
+    profile_member_offset(profile, "vm_area_struct", "vm_next"),
+    profile_member_offset(profile, "vm_area_struct", "vm_flags"),
+    profile_member_offset(profile, "vm_area_struct", "vm_pgoff"),
+    profile_member_offset(profile, "vm_area_struct", "vm_file"),
+  };
+  for (unsigned int i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+    if (offsets[i] == -1) {
+      return -1;
+    }
+  }
+  params->mm_offset = offsets[0];
+  params->mmap_offset = offsets[1];
+  params->pgd_offset = offsets[2];
+  params->vm_start_offset = offsets[3];
+  params->vm_end_offset = offsets[4];
+  params->vm_next_offset = offsets[5];
+  params->vm_flags_offset = offsets[6];
+  params->vm_pgoff_offset = offsets[7];
+  params->vm_file_offset = offsets[8];
+  params->vma_size = 0;
+  for (unsigned int i = 3; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+    if ((unsigned long long) offsets[i] + 8 > params->vma_size) {
+      params->vma_size = offsets[i] + 8;
+    }
+  }
+
+  long long dentry = nested_offset(profile, "file", "f_path", "path", "dentry");
+  long long name = nested_offset(profile, "dentry", "d_name", "qstr", "name");
+  if (dentry != -1 && name != -1) {
+    params->file_dentry_offset = dentry;
+    params->dentry_name_offset = name;
+  }
+  return 0;
+}
+
+/**
+ * This function hashes a kernel address, see proctree.c
+*/
+static inline unsigned int addr_hash(unsigned long long vaddr) {
+  vaddr ^= vaddr >> 33;
+  vaddr *= 0xff51afd7ed558ccdULL;
+  vaddr ^= vaddr >> 33;
+  return (unsigned int) vaddr;
+}
+
+/**
+ * This function returns the map of an mm_struct
+ * @returns the map or NULL if the mm was not collected
+*/
+MmMap* vma_find(VmaMaps *maps, unsigned long long mm) {
+  unsigned int slot = addr_hash(mm) & maps->mask;
+  while (maps->slots[slot]) {
+    if (maps->maps[maps->slots[slot] - 1].mm == mm) {
+      return &maps->maps[maps->slots[slot] - 1];
+    }
+    slot = (slot + 1) & maps->mask;
+  }
+  return NULL;
+}
+
+/**
+ * This function translates kernel addresses in place, all in one batch
+ * Kernel image addresses are the kernel shift away, anything else goes
+ * through the page tables and then the assumed direct map
+ * @params addrs - the addresses, set to the physical address or -1
+ * @params n - number of addresses
+*/
+static void resolve(VmaCtx *ctx, unsigned long long *addrs, int n) {
+  const VmaParams *params = ctx->params;
+  int *idx = malloc(sizeof(int) * (n ? n : 1));
+  unsigned long long *vaddrs = malloc(sizeof(unsigned long long) * (n ? n : 1));
+  int *errs = malloc(sizeof(int) * (n ? n : 1));
+  int count = 0;
+  for (int i = 0; i < n; i++) {
+    if (addrs[i] > params->kernel_shift) {
+      addrs[i] -= params->kernel_shift;
+    } else {
+      idx[count] = i;
+      vaddrs[count++] = addrs[i];
+    }
+  }
+  vtop_translate_async(ctx->kernel, ctx->ar, vaddrs, count, vaddrs, errs); // translated in place
+  for (int j = 0; j < count; j++) {
+    unsigned long long vaddr = addrs[idx[j]];
+    if (errs[j] == VTOP_OK) {
+      addrs[idx[j]] = vaddrs[j];
+    } else if (vaddr >= params->direct_map) {
+      addrs[idx[j]] = vaddr - params->direct_map;
+    } else {
+      addrs[idx[j]] = -1;
+    }
+  }
+  free(errs);
+  free(vaddrs);
+  free(idx);
+}
+
+/**
+ * This function reads n independent extents with all of them in flight
+ * @params paddrs - where to read, -1 is not read
+ * @params lens - bytes to read from each
+ * @params bufs - n buffers of stride bytes
+ * @params ok - set to 1 for each extent that was read
+*/
+static void read_all(VmaCtx *ctx, const unsigned long long *paddrs, const unsigned int *lens, int n,
+    unsigned char *bufs, unsigned long long stride, int *ok) {
+  for (int i = 0; i < n; i++) {
+    ok[i] = 0;
+    if (paddrs[i] != (unsigned long long) -1) {
+      aread_submit(ctx->ar, paddrs[i], bufs + i * stride, lens[i], &ok[i]);
+    }
+  }
+  void *tag;
+  int status;
+  while ((status = aread_complete(ctx->ar, &tag)) != AREAD_IDLE) {
+    *(int *) tag = status == 0;
+  }
+}
+
+/**
+ * This function reads the pointer at addr + offset for each address
+ * @params addrs - kernel addresses, replaced by the pointers read (0 if unreadable)
+*/
+static void read_ptrs(VmaCtx *ctx, unsigned long long *addrs, int n, unsigned long long offset) {
+  unsigned int *lens = malloc(sizeof(unsigned int) * (n ? n : 1));
+  int *ok = malloc(sizeof(int) * (n ? n : 1));
+  unsigned long long *paddrs = malloc(sizeof(unsigned long long) * (n ? n : 1));
+  for (int i = 0; i < n; i++) {
+    paddrs[i] = addrs[i] ? addrs[i] + offset : 0;
+    lens[i] = sizeof(unsigned long long);
+  }
+  resolve(ctx, paddrs, n);
+  for (int i = 0; i < n; i++) {
+    if (!addrs[i]) {
+      paddrs[i] = -1;
+    }
+  }
+  read_all(ctx, paddrs, lens, n, (unsigned char *) addrs, sizeof(unsigned long long), ok);
+  for (int i = 0; i < n; i++) {
+    if (!ok[i]) {
+      addrs[i] = 0;
+    }
+  }
+  free(paddrs);
+  free(ok);
+  free(lens);
+}
+
+static Vma* map_add(MmMap *map) {
+  if (map->count == map->capacity) {
+    map->capacity = map->capacity ? map->capacity * 2 : 16;
+    map->vmas = realloc(map->vmas, map->capacity * sizeof(Vma));
+    if (!map->vmas) {
+      _die("vma_collect - Unable to grow VMA array to %d entries", map->capacity);
+    }
+  }
+  return &map->vmas[map->count++];
+}
+
+static inline unsigned long long load_u64(const unsigned char *p) {
+  unsigned long long v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+/**
+ * This function walks the VMA list of every map
+ * The lists are walked side by side, a round reads the next VMA of every
+ * list that has not ended, so the reads of one round are all independent
+ * A list ends at a NULL vm_next; an unreadable VMA, one that does not start
+ * after the previous one (which also ends a cycle) or more than
+ * VMA_MAX_COUNT VMAs mark the map broken
+ * @params maps - the maps with their first VMA in cur
+ * @params cur - the next VMA of each map, 0 once its list ended
+*/
+static void walk_vmas(VmaCtx *ctx, VmaMaps *maps, unsigned long long *cur) {
+  const VmaParams *params = ctx->params;
+  int n = maps->count;
+  int *active = malloc(sizeof(int) * (n ? n : 1));
+  unsigned long long *paddrs = malloc(sizeof(unsigned long long) * (n ? n : 1));
+  unsigned int *lens = malloc(sizeof(unsigned int) * (n ? n : 1));
+  int *ok = malloc(sizeof(int) * (n ? n : 1));
+  unsigned char *bufs = malloc(params->vma_size * (n ? n : 1));
+
+  for (;;) {
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+      if (cur[i]) {
+        active[count] = i;
+        paddrs[count] = cur[i];
+        lens[count] = params->vma_size;
+        count += 1;
+      }
+    }
+    if (!count) {
+      break;
+    }
+    resolve(ctx, paddrs, count);
+    read_all(ctx, paddrs, lens, count, bufs, params->vma_size, ok);
+
+    for (int k = 0; k < count; k++) {
+      MmMap *map = &maps->maps[active[k]];
+      const unsigned char *vma = bufs + k * params->vma_size;
+      unsigned long long start = load_u64(vma + params->vm_start_offset);
+      unsigned long long end = load_u64(vma + params->vm_end_offset);
+      if (!ok[k] || start >= end || (map->count && start < map->vmas[map->count - 1].end) ||
+          map->count == VMA_MAX_COUNT) {
+        _debug("DEBUG: VMA list of mm %llx broken at %llx", map->mm, cur[active[k]]);
+        map->broken = 1;
+        cur[active[k]] = 0;
+        continue;
+      }
+      Vma *v = map_add(map);
+      v->start = start;
+      v->end = end;
+      v->flags = load_u64(vma + params->vm_flags_offset);
+      v->pgoff = load_u64(vma + params->vm_pgoff_offset);
+      v->file = load_u64(vma + params->vm_file_offset);
+      v->name = -1;
+      cur[active[k]] = load_u64(vma + params->vm_next_offset);
+    }
+  }
+  free(bufs);
+  free(ok);
+  free(lens);
+  free(paddrs);
+  free(active);
+}
+
+/**
+ * This function names the backing file of every VMA
+ * Each distinct struct file is followed once: file -> f_path.dentry ->
+ * d_name.name -> the name, one batch of reads per step
+*/
+static void name_files(VmaCtx *ctx, VmaMaps *maps) {
+  /* the distinct files, indexed by an open addressed table */
+  int total = 0;
+  for (int i = 0; i < maps->count; i++) {
+    total += maps->maps[i].count;
+  }
+  unsigned int mask = 15;
+  while (mask + 1 < (unsigned int) total * 2) {
+    mask = mask * 2 + 1;
+  }
+  unsigned int *slots = calloc(mask + 1, sizeof(unsigned int));
+  unsigned long long *files = malloc(sizeof(unsigned long long) * (total ? total : 1));
+  int num_files = 0;
+  for (int i = 0; i < maps->count; i++) {
+    for (int j = 0; j < maps->maps[i].count; j++) {
+      Vma *v = &maps->maps[i].vmas[j];
+      if (!v->file) {
+        continue;
+      }
+      unsigned int slot = addr_hash(v->file) & mask;
+      while (slots[slot] && files[slots[slot] - 1] != v->file) {
+        slot = (slot + 1) & mask;
+      }
+      if (!slots[slot]) {
+        files[num_files++] = v->file;
+        slots[slot] = num_files;
+      }
+      v->name = slots[slot] - 1;
+    }
+  }
+
+  /* file -> dentry -> name pointer -> name */
+  unsigned long long *names = malloc(sizeof(unsigned long long) * (num_files ? num_files : 1));
+  memcpy(names, files, sizeof(unsigned long long) * num_files);
+  read_ptrs(ctx, names, num_files, ctx->params->file_dentry_offset);
+  read_ptrs(ctx, names, num_files, ctx->params->dentry_name_offset);
+
+  unsigned long long *paddrs = malloc(sizeof(unsigned long long) * (num_files ? num_files : 1));
+  unsigned int *lens = malloc(sizeof(unsigned int) * (num_files ? num_files : 1));
+  int *ok = malloc(sizeof(int) * (num_files ? num_files : 1));
+  memcpy(paddrs, names, sizeof(unsigned long long) * num_files);
+  resolve(ctx, paddrs, num_files);
+  for (int i = 0; i < num_files; i++) {
+    // a name does not cross a page, it is in a dentry or a kmalloc'd buffer
+    unsigned long long room = PAGE_SIZE - (paddrs[i] & (PAGE_SIZE - 1));
+    lens[i] = room < VMA_NAME_LEN - 1 ? room : VMA_NAME_LEN - 1;
+    if (!names[i]) {
+      paddrs[i] = -1;
+    }
+  }
+  maps->names = calloc(num_files ? num_files : 1, VMA_NAME_LEN);
+  maps->num_names = num_files;
+  read_all(ctx, paddrs, lens, num_files, (unsigned char *) maps->names, VMA_NAME_LEN, ok);
+  for (int i = 0; i < num_files; i++) {
+    if (!ok[i]) {
+      snprintf(maps->names[i], VMA_NAME_LEN, "[file %llx]", files[i]);
+    }
+    maps->names[i][VMA_NAME_LEN - 1] = '\0';
+  }
+
+  free(ok);
+  free(lens);
+  free(paddrs);
+  free(names);
+  free(files);
+  free(slots);
+}
+
+/**
+ * This function collects the memory maps of a set of mm_structs
+ * Every mm is visited once however many tasks share it, and the reads of
+ * all the mm_structs, VMA lists and file names are batched through an
+ * AReader so they are in flight together
+ * @params dump - the opened dump
+ * @params kernel - translator for the kernel page tables
+ * @params params - offsets and the kernel shift
+ * @params mms - task_struct.mm of each task, 0 for kernel threads
+ * @params count - number of tasks
+ * @returns the maps, one per distinct mm
+*/
+VmaMaps* vma_collect(Dump *dump, Translator *kernel, const VmaParams *params, const unsigned long long *mms, int count) {
+  VmaMaps *maps = calloc(1, sizeof(VmaMaps));
+  maps->mask = 15;
+  while (maps->mask + 1 < (unsigned int) count * 2) {
+    maps->mask = maps->mask * 2 + 1;
+  }
+  maps->slots = calloc(maps->mask + 1, sizeof(unsigned int));
+  maps->maps = calloc(count ? count : 1, sizeof(MmMap));
+  for (int i = 0; i < count; i++) {
+    if (!mms[i]) {
+      continue;
+    }
+    unsigned int slot = addr_hash(mms[i]) & maps->mask;
+    while (maps->slots[slot] && maps->maps[maps->slots[slot] - 1].mm != mms[i]) {
+      slot = (slot + 1) & maps->mask;
+    }
+    if (!maps->slots[slot]) {
+      maps->maps[maps->count++].mm = mms[i];
+      maps->slots[slot] = maps->count;
+    }
+  }
+  _debug("DEBUG: %d tasks share %d mm_structs", count, maps->count);
+
+  VmaCtx ctx = { dump, kernel, params, aread_create(dump, AREAD_DEPTH) };
+  int n = maps->count;
+  unsigned long long *cur = malloc(sizeof(unsigned long long) * (n ? n : 1));
+  unsigned long long *pgds = malloc(sizeof(unsigned long long) * (n ? n : 1));
+  for (int i = 0; i < n; i++) {
+    cur[i] = pgds[i] = maps->maps[i].mm;
+  }
+  read_ptrs(&ctx, cur, n, params->mmap_offset);
+  read_ptrs(&ctx, pgds, n, params->pgd_offset);
+  resolve(&ctx, pgds, n);
+  for (int i = 0; i < n; i++) {
+    maps->maps[i].pgd = pgds[i] == (unsigned long long) -1 ? 0 : pgds[i];
+  }
+
+  walk_vmas(&ctx, maps, cur);
+  name_files(&ctx, maps);
+
+  aread_free(ctx.ar);
+  free(pgds);
+  free(cur);
+  return maps;
+}
+
+/**
+ * This function writes the permissions of a VMA the way /proc/pid/maps does
+ * @params flags - vm_flags
+ * @params out - at least 5 bytes
+*/
+void vma_flags_string(unsigned long long flags, char *out) {
+  out[0] = flags & VMA_READ ? 'r' : '-';
+  out[1] = flags & VMA_WRITE ? 'w' : '-';
+  out[2] = flags & VMA_EXEC ? 'x' : '-';
+  out[3] = flags & VMA_SHARED ? 's' : 'p';
+  out[4] = '\0';
+}
+
+void vma_maps_free(VmaMaps *maps) {
+  for (int i = 0; i < maps->count; i++) {
+    free(maps->maps[i].vmas);
+  }
+  free(maps->maps);
+  free(maps->slots);
+  free(maps->names);
+  free(maps);
+}
@@ -0,0 +1,88 @@
+#ifndef _VMA_H
+#define _VMA_H
+
+#include "dump.h"
+#include "vtop.h"
+#include "profile.h"
+
+#define VMA_NAME_LEN 256    /* backing file names are cut here, as d_name is by NAME_MAX */
+#define VMA_MAX_COUNT 65530 /* default vm.max_map_count, longer lists are corrupt */
+
+/* vm_flags bits */
+#define VMA_READ   0x1ULL
+#define VMA_WRITE  0x2ULL
+#define VMA_EXEC   0x4ULL
+#define VMA_SHARED 0x8ULL
+
+/**
+ * This struct is what the VMA walk needs to know about the kernel
+ * Offsets are for the vm_next list of VMAs, i.e. kernels before the maple
+ * tree (6.1); the defaults are those of dwarf_output_json
+*/
+
+typedef struct vma_params {
+	unsigned long long mm_offset;          /* task_struct.mm */
+	unsigned long long mmap_offset;        /* mm_struct.mmap, the first VMA */
+	unsigned long long pgd_offset;         /* mm_struct.pgd */
+	unsigned long long vm_start_offset;
+	unsigned long long vm_end_offset;
+	unsigned long long vm_next_offset;
+	unsigned long long vm_flags_offset;
+	unsigned long long vm_pgoff_offset;
+	unsigned long long vm_file_offset;
+	unsigned long long vma_size;           /* bytes of a VMA the walk reads */
+	unsigned long long file_dentry_offset; /* file.f_path.dentry */
+	unsigned long long dentry_name_offset; /* dentry.d_name.name */
+	unsigned long long kernel_shift;       /* kernel text vaddr - paddr */
+	unsigned long long direct_map;         /* assumed direct map when a table is missing */
+} VmaParams;
+
+/**
+ * This struct is one memory region of a process
+*/
+
+typedef struct vma {
+	unsigned long long start;
+	unsigned long long end;        /* exclusive */
+	unsigned long long flags;      /* vm_flags */
+	unsigned long long pgoff;      /* offset in the file, in pages */
+	unsigned long long file;       /* struct file *, 0 if anonymous */
+	int name;                      /* index into VmaMaps.names, -1 if anonymous or unreadable */
+} Vma;
+
+/**
+ * This struct is the memory map of one mm_struct
+*/
+
+typedef struct mm_map {
+	unsigned long long mm;         /* address of the mm_struct */
+	unsigned long long pgd;        /* physical address of its top level page table, 0 if unknown */
+	Vma *vmas;
+	int count;
+	int capacity;
+	int broken;                    /* the list ended early on an unreadable or out of order VMA */
+} MmMap;
+
+/**
+ * This struct is the memory maps of a set of processes
+ * Each mm_struct is walked once however many tasks share it, slots index
+ * maps by mm address (index + 1, 0 marks an empty slot)
+*/
+
+typedef struct vma_maps {
+	MmMap *maps;
+	int count;
+	unsigned int *slots;
+	unsigned int mask;
+	char (*names)[VMA_NAME_LEN];
+	int num_names;
+} VmaMaps;
+
+void vma_params_init(VmaParams *params);
+int vma_params_from_profile(VmaParams *params, Profile *profile);
+VmaMaps* vma_collect(Dump *dump, Translator *kernel, const VmaParams *params, const unsigned long long *mms, int count);
+MmMap* vma_find(VmaMaps *maps, unsigned long long mm);
+void vma_flags_string(unsigned long long flags, char *out);
+void vma_maps_free(VmaMaps *maps);
+
+#endif
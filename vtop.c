@@ -0,0 +1,394 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "util.h"
+#include "dump.h"
+#include "vtop.h"
+#include "aread.h"
+#include "stats.h"
+
+#define LEVEL_SHIFT(level) (PAGE_SHIFT + 9 * (level))
+#define LEVEL_INDEX(vaddr, level) (((vaddr) >> LEVEL_SHIFT(level)) & 0x1ff)
+
+/* bits kept from the entry itself when folding a level into the effective entry */
+#define PTE_KEEP (PTE_ADDR_MASK | PTE_PS | PTE_PRESENT)
+
+/**
+ * This function creates a translator for the address space rooted at root
+ * @params dump - the opened dump the tables are read from
+ * @params root - physical address of the top level table (e.g. init_pgt or mm->pgd)
+ * @params la57 - non zero for 5-level paging
+ * @returns the translator with empty caches
+*/
+Translator* vtop_create(Dump *dump, unsigned long long root, int la57) {
+  Translator *t = malloc(sizeof(Translator));
+  t->dump = dump;
+  t->root = root & PTE_ADDR_MASK;
+  t->levels = la57 ? 5 : 4;
+  t->translations = t->tlb_misses = t->pwc_hits = t->table_reads = 0;
+  vtop_flush(t);
+  return t;
+}
+
+/**
+ * This function empties every cache of a translator
+ * @params t - the translator
+*/
+void vtop_flush(Translator *t) {
+  memset(t->tlb_4k, 0xff, sizeof(t->tlb_4k));
+  memset(t->tlb_2m, 0xff, sizeof(t->tlb_2m));
+  memset(t->tlb_1g, 0xff, sizeof(t->tlb_1g));
+  memset(t->pwc, 0xff, sizeof(t->pwc));
+}
+
+void vtop_free(Translator *t) {
+  STATS_ADD(translations, t->translations);
+  STATS_ADD(tlb_hits, t->translations - t->tlb_misses);
+  STATS_ADD(pwc_hits, t->pwc_hits);
+  STATS_ADD(table_reads, t->table_reads);
+  free(t);
+}
+
+/**
+ * This function reads one 8 byte paging entry from the dump
+ * @returns 0 or -1 if the table is not in the dump
+*/
+static inline int read_entry(Translator *t, unsigned long long paddr, unsigned long long *entry) {
+  const unsigned char *p = dump_ptr(t->dump, paddr, sizeof(unsigned long long));
+  t->table_reads += 1;
+  if (!p) {
+    return -1;
+  }
+  memcpy(entry, p, sizeof(unsigned long long));
+  return 0;
+}
+
+/**
+ * This function folds the entry of one level into the effective entry of the walk
+ * The address comes from the new entry, writable/user must hold at every level
+ * and no-execute at any level applies to the whole page
+*/
+static inline unsigned long long fold_entry(unsigned long long eff, unsigned long long entry) {
+  return (entry & PTE_KEEP) |
+    (eff & entry & (PTE_RW | PTE_USER)) |
+    ((eff | entry) & PTE_NX);
+}
+
+/**
+ * This function looks a page up in one of the direct mapped tlbs
+ * @returns the effective entry or 0 on a miss
+*/
+static inline unsigned long long tlb_lookup(VtopEntry *tlb, int size, unsigned long long tag) {
+  VtopEntry *e = &tlb[tag & (size - 1)];
+  return e->tag == tag ? e->entry : 0;
+}
+
+static inline void tlb_insert(VtopEntry *tlb, int size, unsigned long long tag, unsigned long long entry) {
+  VtopEntry *e = &tlb[tag & (size - 1)];
+  e->tag = tag;
+  e->entry = entry;
+}
+
+/* walk_step: the entry pointed to another table */
+#define WALK_DOWN 1
+
+/**
+ * This function starts a translation
+ * The tlbs are tried first, then the walk resumes from the lowest cached
+ * paging-structure entry, so only tables below it are read from the dump
+ * @params t - the translator
+ * @params vaddr - the virtual address to translate
+ * @params eff - set to the effective entry
+ * @params size - set to the page size on a tlb hit
+ * @params table - set to the table the walk reads next on a miss
+ * @params level - set to the level of that table
+ * @returns 1 on a tlb hit, 0 if tables have to be read
+*/
+static inline int walk_start(Translator *t, unsigned long long vaddr, unsigned long long *eff, unsigned long long *size,
+    unsigned long long *table, int *level) {
+  t->translations += 1;
+  if ((*eff = tlb_lookup(t->tlb_4k, VTOP_TLB_SIZE, vaddr >> PAGE_SHIFT))) {
+    *size = 1ULL << PAGE_SHIFT;
+    return 1;
+  } else if ((*eff = tlb_lookup(t->tlb_2m, VTOP_TLB_LARGE_SIZE, vaddr >> PMD_SHIFT))) {
+    *size = 1ULL << PMD_SHIFT;
+    return 1;
+  } else if ((*eff = tlb_lookup(t->tlb_1g, VTOP_TLB_LARGE_SIZE, vaddr >> PUD_SHIFT))) {
+    *size = 1ULL << PUD_SHIFT;
+    return 1;
+  }
+
+  /* resume from the lowest cached level */
+  t->tlb_misses += 1;
+  *level = t->levels - 1;
+  *table = t->root;
+  *eff = PTE_RW | PTE_USER;
+  for (int l = 1; l < t->levels; l++) {
+    VtopEntry *e = &t->pwc[l][(vaddr >> LEVEL_SHIFT(l)) & (VTOP_PWC_SIZE - 1)];
+    if (e->tag == vaddr >> LEVEL_SHIFT(l)) {
+      *eff = e->entry;
+      *table = *eff & PTE_ADDR_MASK;
+      *level = l - 1;
+      t->pwc_hits += 1;
+      break;
+    }
+  }
+  return 0;
+}
+
+/**
+ * This function applies the entry read from the table at one level of a walk
+ * 2 MB and 1 GB pages (PS bit) end the walk early, the result is cached in
+ * the tlbs and every table entry in the paging-structure cache
+ * @params eff - the effective entry, updated
+ * @params size - set to the page size once the walk is done
+ * @returns VTOP_OK when the page was reached, WALK_DOWN to read the table at
+ * eff on the next level down or VTOP_NOT_PRESENT
+*/
+static inline int walk_step(Translator *t, unsigned long long vaddr, int level, unsigned long long entry,
+    unsigned long long *eff, unsigned long long *size) {
+  if (!(entry & PTE_PRESENT)) {
+    return VTOP_NOT_PRESENT;
+  }
+  *eff = fold_entry(*eff, entry);
+
+  if (level == 0) {
+    *size = 1ULL << PAGE_SHIFT;
+    *eff &= ~PTE_PS; // bit 7 is PAT in a PTE
+    tlb_insert(t->tlb_4k, VTOP_TLB_SIZE, vaddr >> PAGE_SHIFT, *eff);
+    return VTOP_OK;
+  }
+  if ((level == 1 || level == 2) && (entry & PTE_PS)) {
+    *size = 1ULL << LEVEL_SHIFT(level);
+    *eff &= ~((*size - 1) & PTE_ADDR_MASK); // drop PAT and reserved low bits
+    if (level == 1) {
+      tlb_insert(t->tlb_2m, VTOP_TLB_LARGE_SIZE, vaddr >> PMD_SHIFT, *eff);
+    } else {
+      tlb_insert(t->tlb_1g, VTOP_TLB_LARGE_SIZE, vaddr >> PUD_SHIFT, *eff);
+    }
+    return VTOP_OK;
+  }
+
+  *eff &= ~PTE_PS;
+  VtopEntry *e = &t->pwc[level][(vaddr >> LEVEL_SHIFT(level)) & (VTOP_PWC_SIZE - 1)];
+  e->tag = vaddr >> LEVEL_SHIFT(level);
+  e->entry = *eff;
+  return WALK_DOWN;
+}
+
+/**
+ * This function translates a virtual address to a physical address
+ * @params t - the translator
+ * @params vaddr - the virtual address to translate
+ * @params paddr - set to the physical address on success
+ * @params flags - if not NULL set to the effective PTE_RW/PTE_USER/PTE_NX/PTE_PS bits
+ * @returns VTOP_OK, VTOP_NOT_PRESENT or VTOP_NOT_IN_DUMP
+*/
+int vtop_translate(Translator *t, unsigned long long vaddr, unsigned long long *paddr, unsigned long long *flags) {
+  unsigned long long span;
+  return vtop_translate_span(t, vaddr, paddr, flags, &span);
+}
+
+/**
+ * This function translates a virtual address and says how far the result
+ * holds, so a caller going through a range steps a page, a large page or a
+ * whole absent table at a time
+ * @params t - the translator
+ * @params vaddr - the virtual address to translate
+ * @params paddr - set to the physical address on success
+ * @params flags - if not NULL set to the effective PTE_RW/PTE_USER/PTE_NX/PTE_PS bits
+ * @params span - set to the size of the aligned block around vaddr the result
+ * is the same for: the page on success, else what the absent entry or the
+ * table missing from the dump would have mapped
+ * @returns VTOP_OK, VTOP_NOT_PRESENT or VTOP_NOT_IN_DUMP
+*/
+int vtop_translate_span(Translator *t, unsigned long long vaddr, unsigned long long *paddr, unsigned long long *flags,
+    unsigned long long *span) {
+  unsigned long long eff;
+  unsigned long long size;
+  unsigned long long table;
+  int level;
+
+  if (!walk_start(t, vaddr, &eff, &size, &table, &level)) {
+    for (;; level--) {
+      unsigned long long entry;
+      if (read_entry(t, table + 8 * LEVEL_INDEX(vaddr, level), &entry) == -1) {
+        *span = 1ULL << LEVEL_SHIFT(level + 1); // all the table maps
+        return VTOP_NOT_IN_DUMP;
+      }
+      int ret = walk_step(t, vaddr, level, entry, &eff, &size);
+      if (ret == VTOP_OK) {
+        break;
+      }
+      if (ret != WALK_DOWN) {
+        *span = 1ULL << LEVEL_SHIFT(level);
+        return ret;
+      }
+      table = eff & PTE_ADDR_MASK;
+    }
+  }
+
+  *paddr = (eff & PTE_ADDR_MASK) + (vaddr & (size - 1));
+  *span = size;
+  if (flags) {
+    *flags = eff & (PTE_RW | PTE_USER | PTE_NX | PTE_PS);
+  }
+  return VTOP_OK;
+}
+
+/**
+ * This struct is one address of a batch
+*/
+typedef struct batch_walk {
+  unsigned long long vaddr;
+  unsigned long long eff;
+  unsigned long long size;
+  unsigned long long table;
+  unsigned long long entry;  /* read into when this walk leads its group */
+  int level;
+  int err;                   /* WALK_DOWN while the walk goes on */
+  int leader;                /* walk whose read of the entry this one uses */
+  int read_ok;
+} BatchWalk;
+
+/**
+ * This struct is one slot of the open addressed table of a round's reads
+ * walk is -1 in an empty slot
+*/
+typedef struct batch_read {
+  unsigned long long paddr;
+  int walk;
+} BatchRead;
+
+/**
+ * This function translates many virtual addresses, walking them all down
+ * one level per round
+ * A round looks up the entry each unfinished walk needs next in a table of
+ * the round's reads, so every walk sharing a page-table path, whatever level
+ * it resumed from, waits on a single read of each shared entry. With a reader those reads
+ * are in flight together, without one they are read from the mapped dump
+ * @params ar - reader of t's dump with nothing outstanding, or NULL
+ * @returns the number of addresses that translated
+*/
+static int translate_grouped(Translator *t, AReader *ar, const unsigned long long *vaddrs, int count,
+    unsigned long long *paddrs, int *errs) {
+  BatchWalk *walks = malloc(sizeof(BatchWalk) * (count ? count : 1));
+  int slots = 2;
+  while (slots < 2 * count) {
+    slots <<= 1;
+  }
+  BatchRead *reads = malloc(sizeof(BatchRead) * slots);
+  for (int i = 0; i < count; i++) {
+    BatchWalk *w = &walks[i];
+    w->vaddr = vaddrs[i];
+    w->err = walk_start(t, w->vaddr, &w->eff, &w->size, &w->table, &w->level) ? VTOP_OK : WALK_DOWN;
+  }
+
+  for (;;) {
+    int submitted = 0;
+    memset(reads, 0xff, sizeof(BatchRead) * slots);
+    for (int i = 0; i < count; i++) {
+      BatchWalk *w = &walks[i];
+      if (w->err != WALK_DOWN) {
+        continue;
+      }
+      unsigned long long paddr = w->table + 8 * LEVEL_INDEX(w->vaddr, w->level);
+      unsigned int h = (paddr >> 3) * 0x9e3779b97f4a7c15ULL >> 32;
+      BatchRead *r = &reads[h & (slots - 1)];
+      while (r->walk != -1 && r->paddr != paddr) {
+        r = &reads[(++h) & (slots - 1)];
+      }
+      if (r->walk != -1) {
+        w->leader = r->walk;
+        continue;
+      }
+      r->paddr = paddr;
+      r->walk = w->leader = i;
+      if (ar) {
+        w->read_ok = 0;
+        aread_submit(ar, paddr, &w->entry, sizeof(w->entry), w);
+        t->table_reads += 1;
+      } else {
+        w->read_ok = read_entry(t, paddr, &w->entry) == 0;
+      }
+      submitted += 1;
+    }
+    if (!submitted) {
+      break;
+    }
+
+    void *tag;
+    int status;
+    while (ar && (status = aread_complete(ar, &tag)) != AREAD_IDLE) {
+      ((BatchWalk *) tag)->read_ok = status == 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+      BatchWalk *w = &walks[i];
+      if (w->err != WALK_DOWN) {
+        continue;
+      }
+      const BatchWalk *src = &walks[w->leader];
+      if (!src->read_ok) {
+        w->err = VTOP_NOT_IN_DUMP;
+        continue;
+      }
+      w->err = walk_step(t, w->vaddr, w->level, src->entry, &w->eff, &w->size);
+      if (w->err == WALK_DOWN) {
+        w->table = w->eff & PTE_ADDR_MASK;
+        w->level -= 1;
+      }
+    }
+  }
+
+  int ok = 0;
+  for (int i = 0; i < count; i++) {
+    BatchWalk *w = &walks[i];
+    if (w->err == VTOP_OK) {
+      paddrs[i] = (w->eff & PTE_ADDR_MASK) + (w->vaddr & (w->size - 1));
+      ok += 1;
+    } else {
+      paddrs[i] = 0;
+    }
+    if (errs) {
+      errs[i] = w->err;
+    }
+  }
+  free(reads);
+  free(walks);
+  return ok;
+}
+
+/**
+ * This function translates many virtual addresses at once
+ * Addresses sharing a page-table path are grouped so each shared table
+ * entry is read from the dump once per batch; results are in input order
+ * @params t - the translator
+ * @params vaddrs - the virtual addresses to translate
+ * @params count - number of addresses
+ * @params paddrs - set to the physical address of each vaddr (0 on failure),
+ * may be vaddrs itself
+ * @params errs - if not NULL set to the VTOP_* code of each vaddr
+ * @returns the number of addresses that translated
+*/
+int vtop_translate_batch(Translator *t, const unsigned long long *vaddrs, int count, unsigned long long *paddrs, int *errs) {
+  return translate_grouped(t, NULL, vaddrs, count, paddrs, errs);
+}
+
+/**
+ * This function translates many virtual addresses like vtop_translate_batch
+ * with each round's reads in flight together, so the storage sees up to the
+ * reader's depth of reads at once instead of one dependent read at a time
+ * @params t - the translator
+ * @params ar - reader of t's dump with nothing outstanding
+ * @params vaddrs - the virtual addresses to translate
+ * @params count - number of addresses
+ * @params paddrs - set to the physical address of each vaddr (0 on failure),
+ * may be vaddrs itself
+ * @params errs - if not NULL set to the VTOP_* code of each vaddr
+ * @returns the number of addresses that translated
+*/
+int vtop_translate_async(Translator *t, AReader *ar, const unsigned long long *vaddrs, int count, unsigned long long *paddrs, int *errs) {
+  return translate_grouped(t, ar, vaddrs, count, paddrs, errs);
+}
@@ -0,0 +1,71 @@
+#ifndef _VTOP_H
+#define _VTOP_H
+
+#include "dump.h"
+#include "aread.h"
+
+/* x86_64 paging entry bits */
+#define PTE_PRESENT   (1ULL << 0)
+#define PTE_RW        (1ULL << 1)
+#define PTE_USER      (1ULL << 2)
+#define PTE_PS        (1ULL << 7)
+#define PTE_NX        (1ULL << 63)
+#define PTE_ADDR_MASK 0x000ffffffffff000ULL
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1ULL << PAGE_SHIFT)
+#define PMD_SHIFT 21  /* 2 MB pages */
+#define PUD_SHIFT 30  /* 1 GB pages */
+#define PGD_SHIFT 39
+#define P4D_SHIFT 48  /* only with 5-level paging (LA57) */
+
+/* return codes of vtop_translate */
+#define VTOP_OK 0
+#define VTOP_NOT_PRESENT -1  /* an entry on the path is not present */
+#define VTOP_NOT_IN_DUMP -2  /* a table on the path is not in the dump */
+
+/* sizes of the direct mapped caches, must be powers of two */
+#define VTOP_TLB_SIZE 1024
+#define VTOP_TLB_LARGE_SIZE 64
+#define VTOP_PWC_SIZE 64
+
+/**
+ * This struct is one cached translation or paging-structure entry
+ * tag is the virtual address shifted down by the level's shift
+*/
+
+typedef struct vtop_entry {
+	unsigned long long tag;
+	unsigned long long entry;
+} VtopEntry;
+
+/**
+ * This struct is an address space being translated
+ * tlb_* cache final translations per page size, pwc caches the entry
+ * found at each non-leaf level so walks of nearby addresses skip the upper tables
+*/
+
+typedef struct translator {
+	Dump *dump;
+	unsigned long long root;   /* physical address of the PML4 (or PML5) */
+	int levels;                /* 4 or 5 */
+	VtopEntry tlb_4k[VTOP_TLB_SIZE];
+	VtopEntry tlb_2m[VTOP_TLB_LARGE_SIZE];
+	VtopEntry tlb_1g[VTOP_TLB_LARGE_SIZE];
+	VtopEntry pwc[5][VTOP_PWC_SIZE]; /* indexed by the level the entry was read from */
+	unsigned long long translations; /* counters added to stats by vtop_free */
+	unsigned long long tlb_misses;
+	unsigned long long pwc_hits;
+	unsigned long long table_reads;
+} Translator;
+
+Translator* vtop_create(Dump *dump, unsigned long long root, int la57);
+void vtop_flush(Translator *t);
+void vtop_free(Translator *t);
+int vtop_translate(Translator *t, unsigned long long vaddr, unsigned long long *paddr, unsigned long long *flags);
+int vtop_translate_span(Translator *t, unsigned long long vaddr, unsigned long long *paddr, unsigned long long *flags,
+  unsigned long long *span);
+int vtop_translate_batch(Translator *t, const unsigned long long *vaddrs, int count, unsigned long long *paddrs, int *errs);
+int vtop_translate_async(Translator *t, AReader *ar, const unsigned long long *vaddrs, int count, unsigned long long *paddrs, int *errs);
+
+#endif